@@ -0,0 +1,165 @@
+// line_bench: the REPL's line splitting on core 1, byte at a time as it used
+// to be in repl_client_recv, against line_splitter.c. Input arrives in
+// TCP-segment-sized pieces, as from lwIP. Throughput is in bytes per cycle of
+// the time stamp counter where there is one, else in bytes per nanosecond.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#include "line_splitter.h"
+#include "wifi_repl.h"
+
+namespace {
+
+constexpr size_t kSegment = 1460;     // one TCP MSS
+constexpr size_t kInputSize = 1 << 20;
+
+struct Result {
+    size_t lines;
+    uint32_t checksum;
+};
+
+void on_line(Result &r, const char *line, size_t len) {
+    ++r.lines;
+    r.checksum = r.checksum * 31 + static_cast<uint32_t>(len);
+    if (len > 0) {
+        r.checksum += static_cast<unsigned char>(line[0]) + static_cast<unsigned char>(line[len - 1]);
+    }
+}
+
+// The loop repl_client_split used to run.
+struct ByteSplitter {
+    char buf[WIFI_REPL_LINE_MAX];
+    size_t len = 0;
+
+    void feed(const char *data, size_t n, Result &r) {
+        for (size_t i = 0; i < n; ++i) {
+            char c = data[i];
+            if (c == '\r') {
+                continue;
+            }
+            if (c == '\n') {
+                buf[len] = '\0';
+                if (len > 0) {
+                    on_line(r, buf, len);
+                }
+                len = 0;
+            } else if (len < WIFI_REPL_LINE_MAX - 1) {
+                buf[len++] = c;
+            }
+        }
+    }
+};
+
+struct WordSplitter {
+    char buf[WIFI_REPL_LINE_MAX];
+    line_splitter_t s;
+
+    WordSplitter() {
+        line_splitter_init(&s, buf, sizeof(buf));
+    }
+
+    void feed(const char *data, size_t n, Result &r) {
+        size_t used = 0;
+        while (used < n) {
+            bool done;
+            used += line_splitter_feed(&s, data + used, n - used, &done);
+            if (done) {
+                if (s.len > 0) {
+                    on_line(r, buf, s.len);
+                }
+                s.len = 0;
+            }
+        }
+    }
+};
+
+std::string make_input(size_t line_len, bool crlf) {
+    static const char kText[] = "the quick brown fox jumps over the lazy dog <enter> 0123456789 ";
+    std::string out;
+    size_t pos = 0;
+    while (out.size() < kInputSize) {
+        for (size_t i = 0; i < line_len; ++i) {
+            out += kText[pos++ % (sizeof(kText) - 1)];
+        }
+        out += crlf ? "\r\n" : "\n";
+    }
+    out.resize(kInputSize);
+    return out;
+}
+
+struct Timing {
+    double bytes_per_unit;
+    Result result;
+};
+
+uint64_t now_units() {
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+template <typename Splitter>
+Timing measure(const std::string &input) {
+    Timing best{0, {}};
+    for (int run = 0; run < 20; ++run) {
+        Splitter splitter;
+        Result r{0, 0};
+        uint64_t start = now_units();
+        for (size_t off = 0; off < input.size(); off += kSegment) {
+            splitter.feed(input.data() + off, std::min(kSegment, input.size() - off), r);
+        }
+        uint64_t units = now_units() - start;
+        double rate = static_cast<double>(input.size()) / static_cast<double>(units ? units : 1);
+        if (rate > best.bytes_per_unit) {
+            best = {rate, r};
+        }
+    }
+    return best;
+}
+
+}  // namespace
+
+int main() {
+    struct Case {
+        const char *name;
+        size_t line_len;
+        bool crlf;
+    };
+    static const Case kCases[] = {
+        {"short lines, LF",     20,   false},
+        {"short lines, CRLF",   20,   true},
+        {"typical lines, CRLF", 60,   true},
+        {"full lines, LF",      250,  false},
+        {"overlong lines, LF",  2000, false},
+    };
+
+#ifdef HAVE_TSC
+    const char *unit = "bytes/cycle";
+#else
+    const char *unit = "bytes/ns";
+#endif
+    printf("%-22s %14s %14s %8s\n", unit, "byte at a time", "line_splitter", "speedup");
+    bool ok = true;
+    for (const Case &c : kCases) {
+        std::string input = make_input(c.line_len, c.crlf);
+        Timing before = measure<ByteSplitter>(input);
+        Timing after = measure<WordSplitter>(input);
+        bool same = before.result.lines == after.result.lines && before.result.checksum == after.result.checksum;
+        ok &= same;
+        printf("%-22s %14.2f %14.2f %7.1fx%s\n", c.name, before.bytes_per_unit, after.bytes_per_unit,
+               after.bytes_per_unit / before.bytes_per_unit, same ? "" : "  MISMATCH");
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,95 @@
+// payload_bench: how payload_compile() scales with line length, on normal
+// text and on inputs built to make a lexer search the rest of the line again
+// and again. Time per input byte should stay flat as the lines grow; a
+// lexer that rescans shows up as time per byte growing with the length.
+//
+// Lines on the device are at most WIFI_REPL_LINE_MAX bytes; the longer ones
+// here only make the growth easy to see.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "payload.h"
+
+// Runtime macros are not part of what is measured.
+int macro_table_copy(const char * /*name*/, size_t /*name_len*/, uint8_t * /*dst*/, size_t /*max*/) {
+    return -1;
+}
+
+namespace {
+
+struct Pattern {
+    const char *name;
+    const char *unit;   // repeated to the wanted length
+    const char *tail;   // appended once
+};
+
+static const Pattern kPatterns[] = {
+    {"plain text",       "The quick brown fox. ", ""},
+    {"closed tags",      "ab<enter><ctrl+c>",     ""},
+    {"open '<'",         "<",                     ""},
+    {"open '<' + text",  "<a",                    ""},
+    {"open '<<'",        "<<a",                   ""},
+    {"'<' closed late",  "<",                     ">"},
+    {"'<<' then '>'",    "<<a>",                  ""},
+};
+
+static const size_t kLengths[] = {256, 1024, 4096, 16384, 65536};
+
+void ignore_error(PayloadError, size_t, const char *, const char *) {}
+
+std::string make_line(const Pattern &pat, size_t len) {
+    std::string line;
+    while (line.size() < len) {
+        line += pat.unit;
+    }
+    line.resize(len - std::string(pat.tail).size());
+    return line + pat.tail;
+}
+
+// Best of several runs, each long enough to read the clock reliably.
+double ns_per_byte(const std::string &line) {
+    static Program prog;
+    using clock = std::chrono::steady_clock;
+    double best = 1e30;
+    for (int run = 0; run < 5; ++run) {
+        size_t iterations = 0;
+        clock::time_point start = clock::now();
+        clock::duration elapsed{};
+        do {
+            payload_compile(line.c_str(), prog, ignore_error);
+            ++iterations;
+            elapsed = clock::now() - start;
+        } while (elapsed < std::chrono::milliseconds(20));
+        double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+        best = std::min(best, ns / static_cast<double>(iterations * line.size()));
+    }
+    return best;
+}
+
+}  // namespace
+
+int main() {
+    printf("%-18s", "ns/byte");
+    for (size_t len : kLengths) {
+        printf("%10zu", len);
+    }
+    printf("%10s\n", "growth");
+
+    for (const Pattern &pat : kPatterns) {
+        printf("%-18s", pat.name);
+        std::vector<double> results;
+        for (size_t len : kLengths) {
+            results.push_back(ns_per_byte(make_line(pat, len)));
+            printf("%10.2f", results.back());
+            fflush(stdout);
+        }
+        // Time per byte at the longest length over the shortest: about 1 for
+        // a linear lexer, about 256 for one that is quadratic.
+        printf("%9.1fx\n", results.back() / results.front());
+    }
+    return 0;
+}
@@ -0,0 +1,575 @@
+// bad_pico_send: streams files to the Bad Pico KB REPL.
+//
+// Keeps at most --window lines outstanding, which matches the firmware's text
+// queue, and follows each one through its result records ("#7 queued",
+// "#7 done 40ms"). Lines the firmware rejected because its queue was full are
+// sent again once a slot frees up. As long as nothing else feeds the queue
+// (scheduled jobs, a second client) the window keeps it from ever filling, so
+// retries, which can reorder lines, stay the exception. Throughput and
+// latency are shown live on stderr.
+//
+// --lz4 sends each batch of lines as one "!lz4 N" block when that is
+// shorter, compressed with matches no further back than the firmware's
+// 1 KiB history. The firmware types the lines inside exactly as if they had
+// been sent plain, record for record.
+//
+// --bench BYTES measures the network path alone: it sends "!bench BYTES" and
+// that many filler bytes, which the firmware counts and discards, then prints
+// the firmware's report next to the retransmits this end had to make.
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "lz4_block.h"
+
+namespace {
+
+constexpr size_t kLineMax = 255;            // WIFI_REPL_LINE_MAX - 1
+constexpr size_t kDefaultWindow = 8;        // depth of s_text_queue
+constexpr unsigned kDefaultRetries = 100;
+constexpr int kRetryTimeoutMs = 1000;    // when no slot frees up in the meantime
+constexpr int kStatusIntervalMs = 500;
+constexpr int kBenchReportTimeoutMs = 10000;
+constexpr unsigned long kBenchMax = 64ul * 1024 * 1024;   // BENCH_MAX
+constexpr size_t kLz4Window = 1024;     // LZ4_STREAM_WINDOW
+
+struct Options {
+    std::string host = "192.168.4.1";
+    std::string port = "4242";
+    size_t window = kDefaultWindow;
+    unsigned retries = kDefaultRetries;
+    bool quiet = false;
+    bool lz4 = false;
+    unsigned long bench_bytes = 0;
+    std::vector<std::string> files;
+};
+
+using Clock = std::chrono::steady_clock;
+
+struct Line {
+    size_t number;          // 1-based, across all input files
+    std::string text;
+    unsigned attempts = 0;
+    Clock::time_point sent;
+};
+
+struct Totals {
+    size_t lines = 0;
+    size_t done = 0;
+    size_t aborted = 0;
+    size_t with_errors = 0;
+    size_t failed = 0;
+    size_t retries = 0;
+    uint64_t chars = 0;
+    double latency_total_ms = 0;
+    double latency_max_ms = 0;
+};
+
+struct Session {
+    int fd = -1;
+    Options opts;
+    std::deque<Line> todo;              // not sent yet, or rejected and due again
+    std::deque<Line> unacked;           // sent, waiting for "#id queued|rejected"
+    std::map<unsigned, Line> in_flight; // queued on the device, by line id
+    std::string rx;
+    std::string tx;
+    Clock::time_point start;
+    Clock::time_point retry_at;
+    size_t requeued = 0;                // rejected lines put back since the last send
+    uint64_t plain_bytes = 0;           // --lz4: lines sent, before and after compression
+    uint64_t sent_bytes = 0;
+    Clock::time_point status_at;
+    Totals totals;
+};
+
+double ms_since(Clock::time_point t) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+}
+
+void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [options] FILE... (- for stdin)\n"
+            "       %s [options] --bench BYTES\n"
+            "  --host HOST     REPL address (default 192.168.4.1)\n"
+            "  --port PORT     REPL port (default 4242)\n"
+            "  --window N      lines outstanding at once (default %zu, the firmware's queue depth)\n"
+            "  --retries N     how often a rejected line is sent again (default %u)\n"
+            "  --quiet         no live status line (implied when stderr is not a terminal)\n"
+            "  --lz4           send lines LZ4-compressed (\"!lz4 N\") where that saves bytes\n"
+            "  --bench BYTES   measure raw upload throughput instead of typing anything\n",
+            argv0, argv0, kDefaultWindow, kDefaultRetries);
+}
+
+bool parse_args(int argc, char **argv, Options &opts) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (arg == "--quiet") {
+            opts.quiet = true;
+        } else if (arg == "--lz4") {
+            opts.lz4 = true;
+        } else if (arg == "--host" && value) {
+            opts.host = value;
+            ++i;
+        } else if (arg == "--port" && value) {
+            opts.port = value;
+            ++i;
+        } else if (arg == "--window" && value) {
+            opts.window = static_cast<size_t>(std::max(1, atoi(value)));
+            ++i;
+        } else if (arg == "--retries" && value) {
+            opts.retries = static_cast<unsigned>(atoi(value));
+            ++i;
+        } else if (arg == "--bench" && value) {
+            opts.bench_bytes = strtoul(value, nullptr, 10);
+            if (opts.bench_bytes == 0 || opts.bench_bytes > kBenchMax) {
+                return false;
+            }
+            ++i;
+        } else if (arg == "-" || arg[0] != '-') {
+            opts.files.push_back(arg);
+        } else {
+            return false;
+        }
+    }
+    return opts.bench_bytes > 0 ? opts.files.empty() : !opts.files.empty();
+}
+
+bool load_lines(Session &s) {
+    size_t number = 0;
+    for (const std::string &path : s.opts.files) {
+        std::ifstream file;
+        std::istream *in = &std::cin;
+        if (path != "-") {
+            file.open(path, std::ios::binary);
+            if (!file) {
+                fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+                return false;
+            }
+            in = &file;
+        }
+
+        std::string text;
+        while (std::getline(*in, text)) {
+            ++number;
+            if (!text.empty() && text.back() == '\r') {
+                text.pop_back();
+            }
+            if (text.empty()) {
+                continue;   // the REPL ignores empty lines
+            }
+            if (text.size() > kLineMax) {
+                fprintf(stderr, "%s:%zu: line longer than %zu bytes\n", path.c_str(), number, kLineMax);
+                return false;
+            }
+            if (text[0] != '!') {
+                ++s.totals.lines;
+            }
+            s.todo.push_back({number, text, 0, {}});
+        }
+    }
+    return true;
+}
+
+int connect_to(const Options &opts) {
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *res = nullptr;
+    int rc = getaddrinfo(opts.host.c_str(), opts.port.c_str(), &hints, &res);
+    if (rc != 0) {
+        fprintf(stderr, "%s: %s\n", opts.host.c_str(), gai_strerror(rc));
+        return -1;
+    }
+
+    int fd = -1;
+    for (addrinfo *ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+
+    if (fd < 0) {
+        fprintf(stderr, "%s:%s: %s\n", opts.host.c_str(), opts.port.c_str(), strerror(errno));
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+void clear_status(const Session &s) {
+    if (!s.opts.quiet) {
+        fprintf(stderr, "\r\033[K");
+    }
+}
+
+void print_status(Session &s) {
+    if (s.opts.quiet) {
+        return;
+    }
+    double secs = ms_since(s.start) / 1000;
+    size_t finished = s.totals.done + s.totals.aborted;
+    fprintf(stderr, "\r\033[K%zu/%zu lines, %zu in flight, %zu retries, %.1f chars/s",
+            finished, s.totals.lines, s.in_flight.size() + s.unacked.size(), s.totals.retries,
+            secs > 0 ? s.totals.chars / secs : 0.0);
+    if (finished > 0) {
+        fprintf(stderr, ", latency avg %.0f ms max %.0f ms", s.totals.latency_total_ms / finished,
+                s.totals.latency_max_ms);
+    }
+    s.status_at = Clock::now();
+}
+
+// The device's own messages (typing errors, command replies) pass through.
+void print_message(Session &s, const std::string &text) {
+    clear_status(s);
+    fprintf(stderr, "%s\n", text.c_str());
+}
+
+void on_record(Session &s, unsigned id, const std::string &state, const std::string &rest) {
+    if (state == "queued" || state == "rejected") {
+        // Records for one connection come back in the order the lines were sent.
+        if (s.unacked.empty()) {
+            return;
+        }
+        Line line = std::move(s.unacked.front());
+        s.unacked.pop_front();
+        if (state == "queued") {
+            s.in_flight.emplace(id, std::move(line));
+            return;
+        }
+        if (line.attempts > s.opts.retries) {
+            clear_status(s);
+            fprintf(stderr, "line %zu: still rejected after %u attempts, giving up\n", line.number, line.attempts);
+            ++s.totals.failed;
+            return;
+        }
+        // Rejected lines go back to the front of the backlog, in the order
+        // they were sent.
+        ++s.totals.retries;
+        s.todo.insert(s.todo.begin() + static_cast<long>(s.requeued++), std::move(line));
+        s.retry_at = Clock::now() + std::chrono::milliseconds(kRetryTimeoutMs);
+        return;
+    }
+
+    if (state != "done" && state != "aborted") {
+        return;     // "started"
+    }
+    auto it = s.in_flight.find(id);
+    if (it == s.in_flight.end()) {
+        return;     // a line from another client or an earlier run
+    }
+    const Line &line = it->second;
+    double latency = ms_since(line.sent);
+    s.totals.latency_total_ms += latency;
+    s.totals.latency_max_ms = std::max(s.totals.latency_max_ms, latency);
+
+    if (state == "aborted") {
+        ++s.totals.aborted;
+        clear_status(s);
+        fprintf(stderr, "line %zu: aborted\n", line.number);
+    } else {
+        ++s.totals.done;
+        s.totals.chars += line.text.size();
+    }
+    size_t err = rest.find("err ");
+    if (err != std::string::npos) {
+        ++s.totals.with_errors;
+        clear_status(s);
+        fprintf(stderr, "line %zu: %s\n", line.number, rest.substr(err).c_str());
+    }
+    s.in_flight.erase(it);
+    s.retry_at = Clock::now();  // a slot in the text queue just freed up
+}
+
+void on_line(Session &s, std::string text) {
+    // Prompts are not newline-terminated, so they lead the next line.
+    while (text.compare(0, 2, "> ") == 0) {
+        text.erase(0, 2);
+    }
+    if (text.empty()) {
+        return;
+    }
+
+    unsigned id;
+    char state[16];
+    int consumed = 0;
+    if (text[0] == '#' && sscanf(text.c_str(), "#%u %15s%n", &id, state, &consumed) == 2) {
+        on_record(s, id, state, text.substr(static_cast<size_t>(consumed)));
+    } else {
+        print_message(s, text);
+    }
+}
+
+void on_receive(Session &s, const char *data, size_t len) {
+    s.rx.append(data, len);
+    size_t pos;
+    while ((pos = s.rx.find('\n')) != std::string::npos) {
+        std::string text = s.rx.substr(0, pos);
+        s.rx.erase(0, pos + 1);
+        if (!text.empty() && text.back() == '\r') {
+            text.pop_back();
+        }
+        on_line(s, text);
+    }
+}
+
+void fill_window(Session &s) {
+    if (Clock::now() < s.retry_at) {
+        return;
+    }
+    s.requeued = 0;
+    std::string batch;
+    while (!s.todo.empty() && s.unacked.size() + s.in_flight.size() < s.opts.window) {
+        Line line = std::move(s.todo.front());
+        s.todo.pop_front();
+        batch += line.text;
+        batch += '\n';
+        if (line.text[0] == '!') {
+            continue;   // REPL commands get a reply but no result record
+        }
+        ++line.attempts;
+        line.sent = Clock::now();
+        s.unacked.push_back(std::move(line));
+    }
+    if (batch.empty()) {
+        return;
+    }
+
+    s.plain_bytes += batch.size();
+    if (s.opts.lz4) {
+        std::string block = lz4_block_compress(batch, kLz4Window);
+        std::string header = "!lz4 " + std::to_string(block.size()) + "\n";
+        if (header.size() + block.size() < batch.size()) {
+            batch = header + block;
+        }
+    }
+    s.sent_bytes += batch.size();
+    s.tx += batch;
+}
+
+bool finished(const Session &s) {
+    return s.todo.empty() && s.unacked.empty() && s.in_flight.empty();
+}
+
+int run(Session &s) {
+    s.start = Clock::now();
+    s.status_at = s.start;
+
+    while (!finished(s)) {
+        fill_window(s);
+
+        pollfd pfd = {s.fd, static_cast<short>(POLLIN | (s.tx.empty() ? 0 : POLLOUT)), 0};
+        int timeout = kStatusIntervalMs;
+        if (!s.todo.empty() && Clock::now() < s.retry_at) {
+            timeout = std::min(timeout, static_cast<int>(
+                std::chrono::duration_cast<std::chrono::milliseconds>(s.retry_at - Clock::now()).count()) + 1);
+        }
+        if (poll(&pfd, 1, timeout) < 0 && errno != EINTR) {
+            perror("poll");
+            return 2;
+        }
+
+        if (pfd.revents & POLLOUT) {
+            ssize_t n = send(s.fd, s.tx.data(), s.tx.size(), MSG_NOSIGNAL);
+            if (n < 0 && errno != EAGAIN) {
+                perror("send");
+                return 2;
+            }
+            if (n > 0) {
+                s.tx.erase(0, static_cast<size_t>(n));
+            }
+        }
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+            char buf[4096];
+            ssize_t n = recv(s.fd, buf, sizeof(buf), 0);
+            if (n <= 0) {
+                clear_status(s);
+                fprintf(stderr, "connection closed with %zu line(s) outstanding\n",
+                        s.todo.size() + s.unacked.size() + s.in_flight.size());
+                return 2;
+            }
+            on_receive(s, buf, static_cast<size_t>(n));
+        }
+
+        if (ms_since(s.status_at) >= kStatusIntervalMs) {
+            print_status(s);
+        }
+    }
+    return 0;
+}
+
+unsigned total_retransmits(int fd) {
+    tcp_info info = {};
+    socklen_t len = sizeof(info);
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) != 0) {
+        return 0;
+    }
+    return info.tcpi_total_retrans;
+}
+
+// Sends the filler as fast as the socket takes it, then waits for the two
+// "bench:" lines the firmware writes when the last byte arrived.
+int run_bench(Session &s) {
+    unsigned long bytes = s.opts.bench_bytes;
+    s.tx = "!bench " + std::to_string(bytes) + "\n";
+    std::string filler(16 * 1024, 'x');
+    unsigned long unsent = bytes;
+    unsigned retrans_start = total_retransmits(s.fd);
+    s.start = Clock::now();
+    s.status_at = s.start;
+
+    Clock::time_point sent_at;
+    size_t reports = 0;
+    while (reports < 2) {
+        if (s.tx.empty() && unsent > 0) {
+            size_t n = static_cast<size_t>(std::min<unsigned long>(unsent, filler.size()));
+            s.tx.assign(filler, 0, n);
+            unsent -= n;
+        }
+        if (s.tx.empty() && unsent == 0 && sent_at == Clock::time_point()) {
+            sent_at = Clock::now();
+        }
+        if (sent_at != Clock::time_point() && ms_since(sent_at) > kBenchReportTimeoutMs) {
+            clear_status(s);
+            fprintf(stderr, "no bench report from the device\n");
+            return 2;
+        }
+
+        pollfd pfd = {s.fd, static_cast<short>(POLLIN | (s.tx.empty() ? 0 : POLLOUT)), 0};
+        if (poll(&pfd, 1, kStatusIntervalMs) < 0 && errno != EINTR) {
+            perror("poll");
+            return 2;
+        }
+        if (pfd.revents & POLLOUT) {
+            ssize_t n = send(s.fd, s.tx.data(), s.tx.size(), MSG_NOSIGNAL);
+            if (n < 0 && errno != EAGAIN) {
+                perror("send");
+                return 2;
+            }
+            if (n > 0) {
+                s.tx.erase(0, static_cast<size_t>(n));
+            }
+        }
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+            char buf[4096];
+            ssize_t n = recv(s.fd, buf, sizeof(buf), 0);
+            if (n <= 0) {
+                clear_status(s);
+                fprintf(stderr, "connection closed during the bench\n");
+                return 2;
+            }
+            s.rx.append(buf, static_cast<size_t>(n));
+            size_t pos;
+            while ((pos = s.rx.find('\n')) != std::string::npos) {
+                std::string text = s.rx.substr(0, pos);
+                s.rx.erase(0, pos + 1);
+                if (!text.empty() && text.back() == '\r') {
+                    text.pop_back();
+                }
+                while (text.compare(0, 2, "> ") == 0) {
+                    text.erase(0, 2);
+                }
+                if (text.compare(0, 6, "bench:") == 0) {
+                    clear_status(s);
+                    printf("device:%s\n", text.c_str() + 6);
+                    ++reports;
+                    if (text.find("invalid") != std::string::npos) {
+                        return 2;
+                    }
+                }
+            }
+        }
+
+        if (!s.opts.quiet && ms_since(s.status_at) >= kStatusIntervalMs) {
+            double secs = ms_since(s.start) / 1000;
+            fprintf(stderr, "\r\033[K%lu/%lu bytes sent, %.0f B/s", bytes - unsent - s.tx.size(), bytes,
+                    secs > 0 ? (bytes - unsent - s.tx.size()) / secs : 0.0);
+            s.status_at = Clock::now();
+        }
+    }
+
+    double secs = ms_since(s.start) / 1000;
+    printf("client: %lu bytes in %.2f s, %.0f B/s, %u retransmits\n", bytes, secs, bytes / secs,
+           total_retransmits(s.fd) - retrans_start);
+    return 0;
+}
+
+void print_summary(const Session &s) {
+    clear_status(s);
+    const Totals &t = s.totals;
+    double secs = ms_since(s.start) / 1000;
+    size_t finished = t.done + t.aborted;
+    fprintf(stderr, "%zu line(s) typed, %zu aborted, %zu failed, %zu with errors, %zu retries\n",
+            t.done, t.aborted, t.failed, t.with_errors, t.retries);
+    fprintf(stderr, "%llu chars in %.2f s, %.1f chars/s", static_cast<unsigned long long>(t.chars), secs,
+            secs > 0 ? t.chars / secs : 0.0);
+    if (finished > 0) {
+        fprintf(stderr, ", latency avg %.0f ms max %.0f ms", t.latency_total_ms / finished, t.latency_max_ms);
+    }
+    fprintf(stderr, "\n");
+    if (s.opts.lz4 && s.plain_bytes > 0) {
+        fprintf(stderr, "lz4: %llu bytes of lines sent as %llu (%.0f%%)\n",
+                static_cast<unsigned long long>(s.plain_bytes), static_cast<unsigned long long>(s.sent_bytes),
+                100.0 * static_cast<double>(s.sent_bytes) / static_cast<double>(s.plain_bytes));
+    }
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    Session s;
+    if (!parse_args(argc, argv, s.opts)) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (!isatty(STDERR_FILENO)) {
+        s.opts.quiet = true;    // the live status line is for terminals
+    }
+    if (!load_lines(s)) {
+        return 2;
+    }
+
+    s.fd = connect_to(s.opts);
+    if (s.fd < 0) {
+        return 2;
+    }
+    if (s.opts.bench_bytes > 0) {
+        int rc = run_bench(s);
+        close(s.fd);
+        return rc;
+    }
+    int rc = run(s);
+    close(s.fd);
+
+    print_summary(s);
+    if (rc == 0 && (s.totals.failed || s.totals.aborted || s.totals.with_errors)) {
+        rc = 1;
+    }
+    return rc;
+}
@@ -0,0 +1,91 @@
+#include "lz4_block.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+constexpr size_t kMinMatch = 4;
+constexpr size_t kLastLiterals = 5;     // the block ends with at least this many literals
+constexpr size_t kMatchLimit = 12;      // no match starts closer than this to the end
+constexpr unsigned kHashBits = 12;
+
+uint32_t read32(const std::string &s, size_t pos) {
+    uint32_t v;
+    memcpy(&v, s.data() + pos, sizeof(v));
+    return v;
+}
+
+uint32_t hash4(uint32_t v) {
+    return (v * 2654435761u) >> (32 - kHashBits);
+}
+
+// A length field: 4 bits in the token, the rest in 255-bytes and a remainder.
+void put_length(std::string &out, size_t len) {
+    if (len < 15) {
+        return;
+    }
+    len -= 15;
+    for (; len >= 255; len -= 255) {
+        out += static_cast<char>(255);
+    }
+    out += static_cast<char>(len);
+}
+
+void put_sequence(std::string &out, const std::string &in, size_t anchor, size_t literals, size_t offset,
+                  size_t match) {
+    size_t lit_nibble = literals < 15 ? literals : 15;
+    size_t match_nibble = 0;
+    if (match > 0) {
+        match_nibble = match - kMinMatch < 15 ? match - kMinMatch : 15;
+    }
+    out += static_cast<char>(lit_nibble << 4 | match_nibble);
+    put_length(out, literals);
+    out.append(in, anchor, literals);
+    if (match == 0) {
+        return;     // the final, literals-only sequence
+    }
+    out += static_cast<char>(offset & 0xff);
+    out += static_cast<char>(offset >> 8);
+    put_length(out, match - kMinMatch);
+}
+
+}  // namespace
+
+std::string lz4_block_compress(const std::string &input, size_t max_distance) {
+    std::string out;
+    std::vector<int64_t> table(size_t{1} << kHashBits, -1);
+    size_t n = input.size();
+    size_t anchor = 0;
+    size_t pos = 0;
+
+    while (n >= kMatchLimit && pos + kMatchLimit <= n) {
+        uint32_t seq = read32(input, pos);
+        uint32_t h = hash4(seq);
+        int64_t candidate = table[h];
+        table[h] = static_cast<int64_t>(pos);
+        if (candidate < 0 || pos - static_cast<size_t>(candidate) > max_distance ||
+            read32(input, static_cast<size_t>(candidate)) != seq) {
+            ++pos;
+            continue;
+        }
+
+        size_t from = static_cast<size_t>(candidate);
+        size_t len = kMinMatch;
+        while (pos + len < n - kLastLiterals && input[from + len] == input[pos + len]) {
+            ++len;
+        }
+        put_sequence(out, input, anchor, pos - anchor, pos - from, len);
+
+        // Remember the positions inside the match too, for later ones.
+        for (size_t i = pos + 1; i < pos + len && i + kMinMatch <= n; ++i) {
+            table[hash4(read32(input, i))] = static_cast<int64_t>(i);
+        }
+        pos += len;
+        anchor = pos;
+    }
+
+    put_sequence(out, input, anchor, n - anchor, 0, 0);
+    return out;
+}
@@ -0,0 +1,14 @@
+#ifndef LZ4_BLOCK_H
+#define LZ4_BLOCK_H
+
+#include <cstddef>
+#include <string>
+
+// Minimal LZ4 block compressor for the firmware's "!lz4 N" upload. Matches
+// reach back at most max_distance bytes, so the output suits a decoder that
+// keeps only that much history (LZ4_STREAM_WINDOW on the Pico). Greedy and
+// single-probe: fast and small, not the best ratio. The output also follows
+// the reference format's end-of-block rules, so any LZ4 decoder takes it.
+std::string lz4_block_compress(const std::string &input, size_t max_distance);
+
+#endif
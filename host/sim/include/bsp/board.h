@@ -0,0 +1,14 @@
+#ifndef SIM_BSP_BOARD_H
+#define SIM_BSP_BOARD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void board_init(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef SIM_HARDWARE_REGS_ADDRESSMAP_H
+#define SIM_HARDWARE_REGS_ADDRESSMAP_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The simulated flash image is "memory mapped" at wherever it lives in RAM.
+extern uint8_t sim_flash[];
+
+#ifdef __cplusplus
+}
+#endif
+
+#define XIP_BASE ((uintptr_t)sim_flash)
+
+#endif
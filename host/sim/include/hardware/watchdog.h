@@ -0,0 +1,9 @@
+// Simulator stand-in: every start is a power-on.
+#ifndef SIM_HARDWARE_WATCHDOG_H
+#define SIM_HARDWARE_WATCHDOG_H
+
+#include <stdbool.h>
+
+static inline bool watchdog_caused_reboot(void) { return false; }
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef SIM_LWIP_IP_ADDR_H
+#define SIM_LWIP_IP_ADDR_H
+
+#include "lwip/arch.h"
+
+typedef struct {
+    u32_t addr;
+} ip_addr_t;
+
+#define IPADDR_TYPE_V4  0
+#define IPADDR_TYPE_ANY 46
+
+#define IP_ANY_TYPE ((const ip_addr_t *)0)
+
+#endif
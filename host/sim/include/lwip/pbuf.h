@@ -0,0 +1,23 @@
+#ifndef SIM_LWIP_PBUF_H
+#define SIM_LWIP_PBUF_H
+
+#include "lwip/err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct pbuf {
+    struct pbuf *next;
+    void *payload;
+    u16_t tot_len;
+    u16_t len;
+};
+
+u8_t pbuf_free(struct pbuf *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef SIM_LWIP_STATS_H
+#define SIM_LWIP_STATS_H
+
+// The simulated stack is the host kernel's; it keeps no lwIP counters, so
+// "!bench" reports zeros for them.
+#define LWIP_STATS 0
+
+#endif
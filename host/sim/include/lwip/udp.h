@@ -0,0 +1,7 @@
+#ifndef SIM_LWIP_UDP_H
+#define SIM_LWIP_UDP_H
+
+#include "lwip/pbuf.h"
+#include "lwip/ip_addr.h"
+
+#endif
@@ -0,0 +1,4 @@
+#ifndef SIM_NETIF_ETHARP_H
+#define SIM_NETIF_ETHARP_H
+
+#endif
@@ -0,0 +1,23 @@
+// Simulator stand-in: a critical section is a mutex shared by all threads
+// (cores and the simulated alarm interrupt).
+#ifndef SIM_PICO_CRITICAL_SECTION_H
+#define SIM_PICO_CRITICAL_SECTION_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    void *impl;
+} critical_section_t;
+
+void critical_section_init(critical_section_t *crit_sec);
+void critical_section_enter_blocking(critical_section_t *crit_sec);
+void critical_section_exit(critical_section_t *crit_sec);
+void critical_section_deinit(critical_section_t *crit_sec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
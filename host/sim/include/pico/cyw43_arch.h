@@ -0,0 +1,33 @@
+// Simulator stand-in: the radio is always up; the REPL listens on a real
+// localhost socket instead (see sim_lwip.cpp).
+#ifndef SIM_PICO_CYW43_ARCH_H
+#define SIM_PICO_CYW43_ARCH_H
+
+#include "pico/stdlib.h"
+
+#define CYW43_WL_GPIO_LED_PIN 0
+#define CYW43_AUTH_WPA2_AES_PSK 0x00400004
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    int itf_state;
+} cyw43_t;
+
+extern cyw43_t cyw43_state;
+
+int cyw43_arch_init(void);
+void cyw43_arch_deinit(void);
+void cyw43_arch_enable_ap_mode(const char *ssid, const char *password, uint32_t auth);
+void cyw43_arch_gpio_put(uint wl_gpio, bool value);
+void cyw43_arch_lwip_begin(void);
+void cyw43_arch_lwip_end(void);
+int cyw43_ioctl(cyw43_t *self, uint32_t cmd, size_t len, uint8_t *buf, uint32_t iface);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,21 @@
+// Simulator stand-in: flash writes just take a global lock.
+#ifndef SIM_PICO_FLASH_H
+#define SIM_PICO_FLASH_H
+
+#include "pico/stdlib.h"
+
+#define PICO_OK 0
+#define PICO_ERROR_TIMEOUT -1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bool flash_safe_execute_core_init(void);
+int flash_safe_execute(void (*func)(void *), void *param, uint32_t enter_exit_timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,19 @@
+// Simulator stand-in: core 1 is a thread.
+#ifndef SIM_PICO_MULTICORE_H
+#define SIM_PICO_MULTICORE_H
+
+#include "pico/stdlib.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void multicore_launch_core1(void (*entry)(void));
+
+uint get_core_num(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,30 @@
+// Simulator stand-in for pico/util/queue.h, backed by a mutex-protected ring.
+#ifndef SIM_PICO_UTIL_QUEUE_H
+#define SIM_PICO_UTIL_QUEUE_H
+
+#include "pico/stdlib.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    void *impl;
+} queue_t;
+
+void queue_init(queue_t *q, uint element_size, uint element_count);
+void queue_free(queue_t *q);
+uint queue_get_level(queue_t *q);
+bool queue_is_empty(queue_t *q);
+bool queue_is_full(queue_t *q);
+bool queue_try_add(queue_t *q, const void *data);
+bool queue_try_remove(queue_t *q, void *data);
+bool queue_try_peek(queue_t *q, void *data);
+void queue_add_blocking(queue_t *q, const void *data);
+void queue_remove_blocking(queue_t *q, void *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
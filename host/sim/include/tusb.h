@@ -0,0 +1,489 @@
+// Simulator stand-in for the TinyUSB device stack. The descriptor and HID
+// macros produce the same bytes as TinyUSB's; the device side is implemented
+// in sim_usb.cpp against a simulated host that polls on a 1 ms frame clock.
+#ifndef SIM_TUSB_H
+#define SIM_TUSB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tusb_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TU_ATTR_WEAK __attribute__((weak))
+#define TU_ATTR_PACKED __attribute__((packed))
+#define TU_BIT(n) (1UL << (n))
+#define TU_U16_HIGH(u16) ((uint8_t)(((u16) >> 8) & 0x00ff))
+#define TU_U16_LOW(u16) ((uint8_t)((u16) & 0x00ff))
+#define U16_TO_U8S_LE(u16) TU_U16_LOW(u16), TU_U16_HIGH(u16)
+#define U32_TO_U8S_LE(u32) ((uint8_t)(u32)), ((uint8_t)((u32) >> 8)), ((uint8_t)((u32) >> 16)), ((uint8_t)((u32) >> 24))
+
+//--------------------------------------------------------------------+
+// Descriptors
+//--------------------------------------------------------------------+
+
+enum {
+    TUSB_DESC_DEVICE = 0x01,
+    TUSB_DESC_CONFIGURATION = 0x02,
+    TUSB_DESC_STRING = 0x03,
+    TUSB_DESC_INTERFACE = 0x04,
+    TUSB_DESC_ENDPOINT = 0x05,
+    TUSB_DESC_BOS = 0x0F,
+};
+
+enum {
+    TUSB_CLASS_UNSPECIFIED = 0,
+    TUSB_CLASS_HID = 3,
+};
+
+enum {
+    TUSB_XFER_CONTROL = 0,
+    TUSB_XFER_ISOCHRONOUS,
+    TUSB_XFER_BULK,
+    TUSB_XFER_INTERRUPT,
+};
+
+#define TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP TU_BIT(5)
+#define TUSB_DESC_CONFIG_ATT_SELF_POWERED TU_BIT(6)
+
+typedef struct TU_ATTR_PACKED {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint16_t bcdUSB;
+    uint8_t bDeviceClass;
+    uint8_t bDeviceSubClass;
+    uint8_t bDeviceProtocol;
+    uint8_t bMaxPacketSize0;
+    uint16_t idVendor;
+    uint16_t idProduct;
+    uint16_t bcdDevice;
+    uint8_t iManufacturer;
+    uint8_t iProduct;
+    uint8_t iSerialNumber;
+    uint8_t bNumConfigurations;
+} tusb_desc_device_t;
+
+#define TUD_CONFIG_DESC_LEN (9)
+
+#define TUD_CONFIG_DESCRIPTOR(config_num, _itfcount, _stridx, _total_len, _attribute, _power_ma) \
+    9, TUSB_DESC_CONFIGURATION, U16_TO_U8S_LE(_total_len), _itfcount, config_num, _stridx, TU_BIT(7) | _attribute, (_power_ma) / 2
+
+//--------------------------------------------------------------------+
+// HID
+//--------------------------------------------------------------------+
+
+typedef enum {
+    HID_REPORT_TYPE_INVALID = 0,
+    HID_REPORT_TYPE_INPUT,
+    HID_REPORT_TYPE_OUTPUT,
+    HID_REPORT_TYPE_FEATURE,
+} hid_report_type_t;
+
+enum {
+    HID_ITF_PROTOCOL_NONE = 0,
+    HID_ITF_PROTOCOL_KEYBOARD = 1,
+    HID_ITF_PROTOCOL_MOUSE = 2,
+};
+
+enum {
+    HID_SUBCLASS_NONE = 0,
+    HID_SUBCLASS_BOOT = 1,
+};
+
+enum {
+    HID_DESC_TYPE_HID = 0x21,
+    HID_DESC_TYPE_REPORT = 0x22,
+};
+
+#define TUD_HID_DESC_LEN (9 + 9 + 7)
+
+#define TUD_HID_DESCRIPTOR(_itfnum, _stridx, _boot_protocol, _report_desc_len, _epin, _epsize, _ep_interval) \
+    9, TUSB_DESC_INTERFACE, _itfnum, 0, 1, TUSB_CLASS_HID, (uint8_t)((_boot_protocol) ? (uint8_t)HID_SUBCLASS_BOOT : 0), _boot_protocol, _stridx, \
+    9, HID_DESC_TYPE_HID, U16_TO_U8S_LE(0x0111), 0, 1, HID_DESC_TYPE_REPORT, U16_TO_U8S_LE(_report_desc_len), \
+    7, TUSB_DESC_ENDPOINT, _epin, TUSB_XFER_INTERRUPT, U16_TO_U8S_LE(_epsize), _ep_interval
+
+// Report descriptor items
+#define HID_REPORT_DATA_0(data)
+#define HID_REPORT_DATA_1(data) , data
+#define HID_REPORT_DATA_2(data) , U16_TO_U8S_LE(data)
+#define HID_REPORT_DATA_3(data) , U32_TO_U8S_LE(data)
+
+#define HID_REPORT_ITEM(data, tag, type, size) \
+    (((tag) << 4) | ((type) << 2) | (size)) HID_REPORT_DATA_##size(data)
+
+#define RI_TYPE_MAIN 0
+#define RI_TYPE_GLOBAL 1
+#define RI_TYPE_LOCAL 2
+
+#define HID_DATA (0 << 0)
+#define HID_CONSTANT (1 << 0)
+#define HID_ARRAY (0 << 1)
+#define HID_VARIABLE (1 << 1)
+#define HID_ABSOLUTE (0 << 2)
+#define HID_RELATIVE (1 << 2)
+#define HID_WRAP_NO (0 << 3)
+#define HID_LINEAR (0 << 4)
+#define HID_PREFERRED_STATE (0 << 5)
+#define HID_NO_NULL_POSITION (0 << 6)
+
+#define HID_INPUT(x) HID_REPORT_ITEM(x, 8, RI_TYPE_MAIN, 1)
+#define HID_OUTPUT(x) HID_REPORT_ITEM(x, 9, RI_TYPE_MAIN, 1)
+#define HID_COLLECTION(x) HID_REPORT_ITEM(x, 10, RI_TYPE_MAIN, 1)
+#define HID_FEATURE(x) HID_REPORT_ITEM(x, 11, RI_TYPE_MAIN, 1)
+#define HID_COLLECTION_END HID_REPORT_ITEM(x, 12, RI_TYPE_MAIN, 0)
+
+#define HID_USAGE_PAGE(x) HID_REPORT_ITEM(x, 0, RI_TYPE_GLOBAL, 1)
+#define HID_USAGE_PAGE_N(x, n) HID_REPORT_ITEM(x, 0, RI_TYPE_GLOBAL, n)
+#define HID_LOGICAL_MIN(x) HID_REPORT_ITEM(x, 1, RI_TYPE_GLOBAL, 1)
+#define HID_LOGICAL_MIN_N(x, n) HID_REPORT_ITEM(x, 1, RI_TYPE_GLOBAL, n)
+#define HID_LOGICAL_MAX(x) HID_REPORT_ITEM(x, 2, RI_TYPE_GLOBAL, 1)
+#define HID_LOGICAL_MAX_N(x, n) HID_REPORT_ITEM(x, 2, RI_TYPE_GLOBAL, n)
+#define HID_PHYSICAL_MIN(x) HID_REPORT_ITEM(x, 3, RI_TYPE_GLOBAL, 1)
+#define HID_PHYSICAL_MIN_N(x, n) HID_REPORT_ITEM(x, 3, RI_TYPE_GLOBAL, n)
+#define HID_PHYSICAL_MAX(x) HID_REPORT_ITEM(x, 4, RI_TYPE_GLOBAL, 1)
+#define HID_PHYSICAL_MAX_N(x, n) HID_REPORT_ITEM(x, 4, RI_TYPE_GLOBAL, n)
+#define HID_REPORT_SIZE(x) HID_REPORT_ITEM(x, 7, RI_TYPE_GLOBAL, 1)
+#define HID_REPORT_ID(x) HID_REPORT_ITEM(x, 8, RI_TYPE_GLOBAL, 1),
+#define HID_REPORT_COUNT(x) HID_REPORT_ITEM(x, 9, RI_TYPE_GLOBAL, 1)
+#define HID_REPORT_COUNT_N(x, n) HID_REPORT_ITEM(x, 9, RI_TYPE_GLOBAL, n)
+
+#define HID_USAGE(x) HID_REPORT_ITEM(x, 0, RI_TYPE_LOCAL, 1)
+#define HID_USAGE_N(x, n) HID_REPORT_ITEM(x, 0, RI_TYPE_LOCAL, n)
+#define HID_USAGE_MIN(x) HID_REPORT_ITEM(x, 1, RI_TYPE_LOCAL, 1)
+#define HID_USAGE_MIN_N(x, n) HID_REPORT_ITEM(x, 1, RI_TYPE_LOCAL, n)
+#define HID_USAGE_MAX(x) HID_REPORT_ITEM(x, 2, RI_TYPE_LOCAL, 1)
+#define HID_USAGE_MAX_N(x, n) HID_REPORT_ITEM(x, 2, RI_TYPE_LOCAL, n)
+
+enum {
+    HID_COLLECTION_PHYSICAL = 0,
+    HID_COLLECTION_APPLICATION,
+    HID_COLLECTION_LOGICAL,
+};
+
+enum {
+    HID_USAGE_PAGE_DESKTOP = 0x01,
+    HID_USAGE_PAGE_KEYBOARD = 0x07,
+    HID_USAGE_PAGE_LED = 0x08,
+    HID_USAGE_PAGE_BUTTON = 0x09,
+    HID_USAGE_PAGE_CONSUMER = 0x0c,
+};
+
+enum {
+    HID_USAGE_DESKTOP_POINTER = 0x01,
+    HID_USAGE_DESKTOP_MOUSE = 0x02,
+    HID_USAGE_DESKTOP_KEYBOARD = 0x06,
+    HID_USAGE_DESKTOP_X = 0x30,
+    HID_USAGE_DESKTOP_Y = 0x31,
+    HID_USAGE_DESKTOP_WHEEL = 0x38,
+    HID_USAGE_DESKTOP_SYSTEM_CONTROL = 0x80,
+    HID_USAGE_DESKTOP_SYSTEM_POWER_DOWN = 0x81,
+    HID_USAGE_DESKTOP_SYSTEM_SLEEP = 0x82,
+    HID_USAGE_DESKTOP_SYSTEM_WAKE_UP = 0x83,
+};
+
+#define TUD_HID_REPORT_DESC_KEYBOARD(...) \
+    HID_USAGE_PAGE(HID_USAGE_PAGE_DESKTOP), \
+    HID_USAGE(HID_USAGE_DESKTOP_KEYBOARD), \
+    HID_COLLECTION(HID_COLLECTION_APPLICATION), \
+        __VA_ARGS__ \
+        HID_USAGE_PAGE(HID_USAGE_PAGE_KEYBOARD), \
+            HID_USAGE_MIN(224), \
+            HID_USAGE_MAX(231), \
+            HID_LOGICAL_MIN(0), \
+            HID_LOGICAL_MAX(1), \
+            HID_REPORT_COUNT(8), \
+            HID_REPORT_SIZE(1), \
+            HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), \
+            HID_REPORT_COUNT(1), \
+            HID_REPORT_SIZE(8), \
+            HID_INPUT(HID_CONSTANT), \
+        HID_USAGE_PAGE(HID_USAGE_PAGE_LED), \
+            HID_USAGE_MIN(1), \
+            HID_USAGE_MAX(5), \
+            HID_REPORT_COUNT(5), \
+            HID_REPORT_SIZE(1), \
+            HID_OUTPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), \
+            HID_REPORT_COUNT(1), \
+            HID_REPORT_SIZE(3), \
+            HID_OUTPUT(HID_CONSTANT), \
+        HID_USAGE_PAGE(HID_USAGE_PAGE_KEYBOARD), \
+            HID_USAGE_MIN(0), \
+            HID_USAGE_MAX_N(255, 2), \
+            HID_LOGICAL_MIN(0), \
+            HID_LOGICAL_MAX_N(255, 2), \
+            HID_REPORT_COUNT(6), \
+            HID_REPORT_SIZE(8), \
+            HID_INPUT(HID_DATA | HID_ARRAY | HID_ABSOLUTE), \
+    HID_COLLECTION_END
+
+enum {
+    HID_USAGE_CONSUMER_CONTROL = 0x0001,
+    HID_USAGE_CONSUMER_BRIGHTNESS_INCREMENT = 0x006F,
+    HID_USAGE_CONSUMER_BRIGHTNESS_DECREMENT = 0x0070,
+    HID_USAGE_CONSUMER_SCAN_NEXT = 0x00B5,
+    HID_USAGE_CONSUMER_SCAN_PREVIOUS = 0x00B6,
+    HID_USAGE_CONSUMER_STOP = 0x00B7,
+    HID_USAGE_CONSUMER_PLAY_PAUSE = 0x00CD,
+    HID_USAGE_CONSUMER_MUTE = 0x00E2,
+    HID_USAGE_CONSUMER_VOLUME_INCREMENT = 0x00E9,
+    HID_USAGE_CONSUMER_VOLUME_DECREMENT = 0x00EA,
+    HID_USAGE_CONSUMER_AC_PAN = 0x0238,
+};
+
+// One 16-bit consumer usage
+#define TUD_HID_REPORT_DESC_CONSUMER(...) \
+    HID_USAGE_PAGE(HID_USAGE_PAGE_CONSUMER), \
+    HID_USAGE(HID_USAGE_CONSUMER_CONTROL), \
+    HID_COLLECTION(HID_COLLECTION_APPLICATION), \
+        __VA_ARGS__ \
+        HID_LOGICAL_MIN(0x00), \
+        HID_LOGICAL_MAX_N(0x03FF, 2), \
+        HID_USAGE_MIN(0x00), \
+        HID_USAGE_MAX_N(0x03FF, 2), \
+        HID_REPORT_COUNT(1), \
+        HID_REPORT_SIZE(16), \
+        HID_INPUT(HID_DATA | HID_ARRAY | HID_ABSOLUTE), \
+    HID_COLLECTION_END
+
+// 1 power down, 2 sleep, 3 wake up, in the low 2 bits of one byte
+#define TUD_HID_REPORT_DESC_SYSTEM_CONTROL(...) \
+    HID_USAGE_PAGE(HID_USAGE_PAGE_DESKTOP), \
+    HID_USAGE(HID_USAGE_DESKTOP_SYSTEM_CONTROL), \
+    HID_COLLECTION(HID_COLLECTION_APPLICATION), \
+        __VA_ARGS__ \
+        HID_LOGICAL_MIN(1), \
+        HID_LOGICAL_MAX(3), \
+        HID_REPORT_COUNT(1), \
+        HID_REPORT_SIZE(2), \
+        HID_USAGE(HID_USAGE_DESKTOP_SYSTEM_POWER_DOWN), \
+        HID_USAGE(HID_USAGE_DESKTOP_SYSTEM_SLEEP), \
+        HID_USAGE(HID_USAGE_DESKTOP_SYSTEM_WAKE_UP), \
+        HID_INPUT(HID_DATA | HID_ARRAY | HID_ABSOLUTE), \
+        HID_REPORT_COUNT(1), \
+        HID_REPORT_SIZE(6), \
+        HID_INPUT(HID_CONSTANT), \
+    HID_COLLECTION_END
+
+// Buttons, X and Y in 0..32767 across the screen, vertical and horizontal
+// wheel
+#define TUD_HID_REPORT_DESC_ABSMOUSE(...) \
+    HID_USAGE_PAGE(HID_USAGE_PAGE_DESKTOP), \
+    HID_USAGE(HID_USAGE_DESKTOP_MOUSE), \
+    HID_COLLECTION(HID_COLLECTION_APPLICATION), \
+        __VA_ARGS__ \
+        HID_USAGE(HID_USAGE_DESKTOP_POINTER), \
+        HID_COLLECTION(HID_COLLECTION_PHYSICAL), \
+            HID_USAGE_PAGE(HID_USAGE_PAGE_BUTTON), \
+                HID_USAGE_MIN(1), \
+                HID_USAGE_MAX(5), \
+                HID_LOGICAL_MIN(0), \
+                HID_LOGICAL_MAX(1), \
+                HID_REPORT_COUNT(5), \
+                HID_REPORT_SIZE(1), \
+                HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), \
+                HID_REPORT_COUNT(1), \
+                HID_REPORT_SIZE(3), \
+                HID_INPUT(HID_CONSTANT), \
+            HID_USAGE_PAGE(HID_USAGE_PAGE_DESKTOP), \
+                HID_USAGE(HID_USAGE_DESKTOP_X), \
+                HID_USAGE(HID_USAGE_DESKTOP_Y), \
+                HID_LOGICAL_MIN(0x00), \
+                HID_LOGICAL_MAX_N(0x7FFF, 2), \
+                HID_REPORT_SIZE(16), \
+                HID_REPORT_COUNT(2), \
+                HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), \
+                HID_USAGE(HID_USAGE_DESKTOP_WHEEL), \
+                HID_LOGICAL_MIN(0x81), \
+                HID_LOGICAL_MAX(0x7f), \
+                HID_REPORT_COUNT(1), \
+                HID_REPORT_SIZE(8), \
+                HID_INPUT(HID_DATA | HID_VARIABLE | HID_RELATIVE), \
+            HID_USAGE_PAGE(HID_USAGE_PAGE_CONSUMER), \
+                HID_USAGE_N(HID_USAGE_CONSUMER_AC_PAN, 2), \
+                HID_LOGICAL_MIN(0x81), \
+                HID_LOGICAL_MAX(0x7f), \
+                HID_REPORT_COUNT(1), \
+                HID_REPORT_SIZE(8), \
+                HID_INPUT(HID_DATA | HID_VARIABLE | HID_RELATIVE), \
+        HID_COLLECTION_END, \
+    HID_COLLECTION_END
+
+typedef enum {
+    MOUSE_BUTTON_LEFT = TU_BIT(0),
+    MOUSE_BUTTON_RIGHT = TU_BIT(1),
+    MOUSE_BUTTON_MIDDLE = TU_BIT(2),
+    MOUSE_BUTTON_BACKWARD = TU_BIT(3),
+    MOUSE_BUTTON_FORWARD = TU_BIT(4),
+} hid_mouse_button_bm_t;
+
+// Keyboard modifiers and key codes (HID usage page 0x07)
+typedef enum {
+    KEYBOARD_MODIFIER_LEFTCTRL = TU_BIT(0),
+    KEYBOARD_MODIFIER_LEFTSHIFT = TU_BIT(1),
+    KEYBOARD_MODIFIER_LEFTALT = TU_BIT(2),
+    KEYBOARD_MODIFIER_LEFTGUI = TU_BIT(3),
+    KEYBOARD_MODIFIER_RIGHTCTRL = TU_BIT(4),
+    KEYBOARD_MODIFIER_RIGHTSHIFT = TU_BIT(5),
+    KEYBOARD_MODIFIER_RIGHTALT = TU_BIT(6),
+    KEYBOARD_MODIFIER_RIGHTGUI = TU_BIT(7),
+} hid_keyboard_modifier_bm_t;
+
+#define HID_KEY_NONE 0x00
+#define HID_KEY_A 0x04
+#define HID_KEY_B 0x05
+#define HID_KEY_C 0x06
+#define HID_KEY_D 0x07
+#define HID_KEY_E 0x08
+#define HID_KEY_F 0x09
+#define HID_KEY_G 0x0A
+#define HID_KEY_H 0x0B
+#define HID_KEY_I 0x0C
+#define HID_KEY_J 0x0D
+#define HID_KEY_K 0x0E
+#define HID_KEY_L 0x0F
+#define HID_KEY_M 0x10
+#define HID_KEY_N 0x11
+#define HID_KEY_O 0x12
+#define HID_KEY_P 0x13
+#define HID_KEY_Q 0x14
+#define HID_KEY_R 0x15
+#define HID_KEY_S 0x16
+#define HID_KEY_T 0x17
+#define HID_KEY_U 0x18
+#define HID_KEY_V 0x19
+#define HID_KEY_W 0x1A
+#define HID_KEY_X 0x1B
+#define HID_KEY_Y 0x1C
+#define HID_KEY_Z 0x1D
+#define HID_KEY_1 0x1E
+#define HID_KEY_2 0x1F
+#define HID_KEY_3 0x20
+#define HID_KEY_4 0x21
+#define HID_KEY_5 0x22
+#define HID_KEY_6 0x23
+#define HID_KEY_7 0x24
+#define HID_KEY_8 0x25
+#define HID_KEY_9 0x26
+#define HID_KEY_0 0x27
+#define HID_KEY_ENTER 0x28
+#define HID_KEY_ESCAPE 0x29
+#define HID_KEY_BACKSPACE 0x2A
+#define HID_KEY_TAB 0x2B
+#define HID_KEY_SPACE 0x2C
+#define HID_KEY_MINUS 0x2D
+#define HID_KEY_EQUAL 0x2E
+#define HID_KEY_BRACKET_LEFT 0x2F
+#define HID_KEY_BRACKET_RIGHT 0x30
+#define HID_KEY_BACKSLASH 0x31
+#define HID_KEY_EUROPE_1 0x32
+#define HID_KEY_SEMICOLON 0x33
+#define HID_KEY_APOSTROPHE 0x34
+#define HID_KEY_GRAVE 0x35
+#define HID_KEY_COMMA 0x36
+#define HID_KEY_PERIOD 0x37
+#define HID_KEY_SLASH 0x38
+#define HID_KEY_CAPS_LOCK 0x39
+#define HID_KEY_F1 0x3A
+#define HID_KEY_F2 0x3B
+#define HID_KEY_F3 0x3C
+#define HID_KEY_F4 0x3D
+#define HID_KEY_F5 0x3E
+#define HID_KEY_F6 0x3F
+#define HID_KEY_F7 0x40
+#define HID_KEY_F8 0x41
+#define HID_KEY_F9 0x42
+#define HID_KEY_F10 0x43
+#define HID_KEY_F11 0x44
+#define HID_KEY_F12 0x45
+#define HID_KEY_PRINT_SCREEN 0x46
+#define HID_KEY_SCROLL_LOCK 0x47
+#define HID_KEY_PAUSE 0x48
+#define HID_KEY_INSERT 0x49
+#define HID_KEY_HOME 0x4A
+#define HID_KEY_PAGE_UP 0x4B
+#define HID_KEY_DELETE 0x4C
+#define HID_KEY_END 0x4D
+#define HID_KEY_PAGE_DOWN 0x4E
+#define HID_KEY_ARROW_RIGHT 0x4F
+#define HID_KEY_ARROW_LEFT 0x50
+#define HID_KEY_ARROW_DOWN 0x51
+#define HID_KEY_ARROW_UP 0x52
+#define HID_KEY_NUM_LOCK 0x53
+#define HID_KEY_KEYPAD_DIVIDE 0x54
+#define HID_KEY_KEYPAD_MULTIPLY 0x55
+#define HID_KEY_KEYPAD_SUBTRACT 0x56
+#define HID_KEY_KEYPAD_ADD 0x57
+#define HID_KEY_KEYPAD_ENTER 0x58
+#define HID_KEY_KEYPAD_1 0x59
+#define HID_KEY_KEYPAD_2 0x5A
+#define HID_KEY_KEYPAD_3 0x5B
+#define HID_KEY_KEYPAD_4 0x5C
+#define HID_KEY_KEYPAD_5 0x5D
+#define HID_KEY_KEYPAD_6 0x5E
+#define HID_KEY_KEYPAD_7 0x5F
+#define HID_KEY_KEYPAD_8 0x60
+#define HID_KEY_KEYPAD_9 0x61
+#define HID_KEY_KEYPAD_0 0x62
+#define HID_KEY_KEYPAD_DECIMAL 0x63
+#define HID_KEY_EUROPE_2 0x64
+#define HID_KEY_APPLICATION 0x65
+#define HID_KEY_CONTROL_LEFT 0xE0
+#define HID_KEY_SHIFT_LEFT 0xE1
+#define HID_KEY_ALT_LEFT 0xE2
+#define HID_KEY_GUI_LEFT 0xE3
+
+//--------------------------------------------------------------------+
+// Device API
+//--------------------------------------------------------------------+
+
+bool tusb_init(void);
+void tud_task(void);
+bool tud_mounted(void);
+bool tud_suspended(void);
+bool tud_ready(void);
+bool tud_remote_wakeup(void);
+bool tud_disconnect(void);
+bool tud_connect(void);
+
+typedef enum {
+    HID_PROTOCOL_BOOT = 0,
+    HID_PROTOCOL_REPORT = 1,
+} hid_protocol_mode_enum_t;
+
+bool tud_hid_n_ready(uint8_t instance);
+uint8_t tud_hid_n_get_protocol(uint8_t instance);
+bool tud_hid_n_report(uint8_t instance, uint8_t report_id, void const *report, uint16_t len);
+bool tud_hid_n_keyboard_report(uint8_t instance, uint8_t report_id, uint8_t modifier, const uint8_t keycode[6]);
+bool tud_hid_n_abs_mouse_report(uint8_t instance, uint8_t report_id, uint8_t buttons, int16_t x, int16_t y,
+                                int8_t vertical, int8_t horizontal);
+
+static inline bool tud_hid_ready(void) { return tud_hid_n_ready(0); }
+static inline bool tud_hid_report(uint8_t report_id, void const *report, uint16_t len) { return tud_hid_n_report(0, report_id, report, len); }
+static inline bool tud_hid_keyboard_report(uint8_t report_id, uint8_t modifier, const uint8_t keycode[6]) { return tud_hid_n_keyboard_report(0, report_id, modifier, keycode); }
+
+// Application callbacks
+uint8_t const *tud_descriptor_device_cb(void);
+uint8_t const *tud_descriptor_configuration_cb(uint8_t index);
+uint16_t const *tud_descriptor_string_cb(uint8_t index, uint16_t langid);
+uint8_t const *tud_hid_descriptor_report_cb(uint8_t instance);
+uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t *buffer, uint16_t reqlen);
+void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t const *buffer, uint16_t bufsize);
+
+TU_ATTR_WEAK void tud_mount_cb(void);
+TU_ATTR_WEAK void tud_umount_cb(void);
+TU_ATTR_WEAK void tud_suspend_cb(bool remote_wakeup_en);
+TU_ATTR_WEAK void tud_resume_cb(void);
+TU_ATTR_WEAK void tud_hid_report_complete_cb(uint8_t instance, uint8_t const *report, uint16_t len);
+TU_ATTR_WEAK void tud_hid_set_protocol_cb(uint8_t instance, uint8_t protocol);
+TU_ATTR_WEAK bool tud_hid_set_idle_cb(uint8_t instance, uint8_t idle_rate);
+TU_ATTR_WEAK uint8_t const *tud_descriptor_device_qualifier_cb(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
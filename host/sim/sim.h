@@ -0,0 +1,67 @@
+// Glue between the simulator modules. Nothing in src/ includes this.
+#ifndef SIM_H
+#define SIM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+// The host's Unicode input method, which puts together the key sequences
+// the firmware types for characters without a key.
+enum class SimInputMethod : uint8_t {
+    kNone,      // the sequences come out as the keys they are
+    kLinux,
+    kWindows,
+    kMac,
+};
+
+// Whose enumeration the simulated host imitates, for the firmware's OS
+// fingerprint. The generic host matches none of them.
+enum class SimHost : uint8_t {
+    kGeneric,
+    kWindows,
+    kLinux,
+    kMacos,
+};
+
+struct SimOptions {
+    int32_t port;               // -1: the firmware's REPL_PORT; 0: any free port
+    const char *flash_path;     // nullptr: flash starts erased and is not saved
+    bool once;                  // exit after the first client leaves and typing settles
+    uint32_t linger_ms;         // idle time that counts as settled
+    uint32_t enumerate_ms;      // delay before the simulated host enumerates
+    uint32_t suspend_at_ms;     // 0: the host never suspends the bus
+    uint32_t suspend_for_ms;    // 0: until the device signals remote wakeup
+    uint32_t reset_at_ms;       // 0: the host never resets the bus
+    SimInputMethod input_method;
+    SimHost host;
+    uint16_t screen_width;      // pixels the absolute mouse spans, for its tags
+    uint16_t screen_height;
+};
+
+extern SimOptions g_sim;
+
+// Decoded keystrokes go here; the firmware's own printf output goes to stderr.
+extern FILE *g_sim_out;
+
+// sim_pico.cpp
+bool sim_on_core1();
+void sim_flash_load();
+void sim_flash_save();
+void sim_stop_alarms();
+
+// sim_lwip.cpp: runs pending socket callbacks, waiting up to timeout_us.
+// Only called on core 1, where the cyw43 background work runs on hardware.
+void sim_lwip_poll(uint64_t timeout_us);
+bool sim_lwip_connected();
+uint32_t sim_lwip_clients();
+
+// sim_usb.cpp
+uint64_t sim_usb_last_report_us();
+
+// sim_main.cpp: line statistics
+void sim_stats_line_received(uint16_t id, uint64_t recv_us);
+void sim_stats_line_done(uint16_t id, uint64_t done_us);
+void sim_stats_report(uint64_t us, size_t chars);
+
+#endif
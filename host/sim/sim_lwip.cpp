@@ -0,0 +1,405 @@
+// lwIP raw TCP API and cyw43 for the simulator, on POSIX sockets. Everything
+// here runs on the core 1 thread: callbacks are dispatched from
+// sim_lwip_poll(), which core 1 calls whenever it sleeps.
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "lwip/tcp.h"
+#include "pico/cyw43_arch.h"
+
+#include "sim.h"
+
+// dhserver.h has no C++ guards; wifi_repl.c calls it with C linkage.
+extern "C" {
+#include "dhserver.h"
+}
+
+constexpr size_t kRecvChunk = 4096;
+constexpr u16_t kPbufSize = 1460;       // one TCP segment per pbuf, as on the air
+constexpr size_t kSndBuf = 8192;
+
+struct tcp_pcb {
+    int fd = -1;
+    bool listening = false;
+    bool closed = false;
+    bool broken = false;    // send failed; reported from the next poll, as lwIP would
+    void *arg = nullptr;
+    tcp_accept_fn accept = nullptr;
+    tcp_recv_fn recv = nullptr;
+    tcp_sent_fn sent = nullptr;
+    tcp_err_fn err = nullptr;
+    std::string out;
+    size_t unsent = 0;      // bytes of `out` written but not yet passed to tcp_output
+};
+
+cyw43_t cyw43_state;
+
+namespace {
+
+static std::vector<tcp_pcb *> s_pcbs;
+static uint32_t s_clients = 0;
+static uint64_t s_recv_us = 0;      // receipt time of the data being dispatched
+
+void set_nonblocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+void release(tcp_pcb *pcb) {
+    if (pcb->fd >= 0) {
+        close(pcb->fd);
+        pcb->fd = -1;
+    }
+    pcb->closed = true;
+}
+
+void fail(tcp_pcb *pcb, err_t err) {
+    tcp_err_fn cb = pcb->err;
+    void *arg = pcb->arg;
+    release(pcb);
+    if (cb) {
+        cb(arg, err);
+    }
+}
+
+// Returns false if the peer went away.
+bool flush(tcp_pcb *pcb) {
+    size_t ready = pcb->out.size() - pcb->unsent;
+    size_t done = 0;
+    while (done < ready) {
+        ssize_t n = send(pcb->fd, pcb->out.data() + done, ready - done, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return false;
+        }
+        done += static_cast<size_t>(n);
+    }
+    pcb->out.erase(0, done);
+    if (done > 0 && pcb->sent) {
+        pcb->sent(pcb->arg, pcb, static_cast<u16_t>(done > 0xffff ? 0xffff : done));
+    }
+    return true;
+}
+
+// The firmware's line result records ("#12 queued", "#12 done 40ms") pass
+// through here, which is where the simulator measures line latency.
+void observe_write(const char *data, u16_t len) {
+    if (len < 2 || data[0] != '#') {
+        return;
+    }
+    char record[64];
+    size_t n = len < sizeof(record) - 1 ? len : sizeof(record) - 1;
+    memcpy(record, data, n);
+    record[n] = '\0';
+
+    unsigned id;
+    char state[16];
+    if (sscanf(record, "#%u %15s", &id, state) != 2) {
+        return;
+    }
+    if (strcmp(state, "queued") == 0) {
+        sim_stats_line_received(static_cast<uint16_t>(id), s_recv_us);
+    } else if (strcmp(state, "done") == 0 || strcmp(state, "aborted") == 0) {
+        sim_stats_line_done(static_cast<uint16_t>(id), time_us_64());
+    }
+}
+
+void do_accept(tcp_pcb *listener) {
+    int fd = accept(listener->fd, nullptr, nullptr);
+    if (fd < 0) {
+        return;
+    }
+    set_nonblocking(fd);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    tcp_pcb *pcb = new tcp_pcb;
+    pcb->fd = fd;
+    s_pcbs.push_back(pcb);
+    ++s_clients;
+
+    if (!listener->accept || listener->accept(listener->arg, pcb, ERR_OK) != ERR_OK) {
+        if (!pcb->closed) {
+            release(pcb);
+        }
+        return;
+    }
+    if (!pcb->closed) {
+        tcp_output(pcb);
+    }
+}
+
+void do_recv(tcp_pcb *pcb) {
+    char buf[kRecvChunk];
+    ssize_t n = recv(pcb->fd, buf, sizeof(buf), 0);
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            fail(pcb, ERR_RST);
+        }
+        return;
+    }
+    s_recv_us = time_us_64();
+
+    if (n == 0) {
+        // Orderly shutdown from the peer: lwIP passes a NULL pbuf.
+        if (pcb->recv) {
+            pcb->recv(pcb->arg, pcb, nullptr, ERR_OK);
+        } else {
+            tcp_close(pcb);
+        }
+        return;
+    }
+
+    // Chain of segment-sized pbufs, like a burst off the radio
+    pbuf *head = nullptr;
+    pbuf **tail = &head;
+    for (ssize_t pos = 0; pos < n; pos += kPbufSize) {
+        u16_t len = static_cast<u16_t>(n - pos < kPbufSize ? n - pos : kPbufSize);
+        pbuf *p = static_cast<pbuf *>(malloc(sizeof(pbuf) + len));
+        p->next = nullptr;
+        p->payload = p + 1;
+        p->len = len;
+        p->tot_len = static_cast<u16_t>(n - pos);
+        memcpy(p->payload, buf + pos, len);
+        *tail = p;
+        tail = &p->next;
+    }
+
+    if (pcb->recv) {
+        pcb->recv(pcb->arg, pcb, head, ERR_OK);
+    } else {
+        pbuf_free(head);
+    }
+    // lwIP sends what the callback wrote once tcp_input() is done with the segment.
+    if (!pcb->closed) {
+        tcp_output(pcb);
+    }
+}
+
+}  // namespace
+
+bool sim_lwip_connected() {
+    for (tcp_pcb *pcb : s_pcbs) {
+        if (!pcb->listening && !pcb->closed) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t sim_lwip_clients() {
+    return s_clients;
+}
+
+void sim_lwip_poll(uint64_t timeout_us) {
+    std::vector<pollfd> fds;
+    std::vector<tcp_pcb *> pcbs;
+    for (tcp_pcb *pcb : s_pcbs) {
+        if (pcb->closed) {
+            continue;
+        }
+        if (pcb->broken) {
+            fail(pcb, ERR_RST);
+            continue;
+        }
+        short events = POLLIN;
+        if (!pcb->listening && pcb->out.size() > pcb->unsent) {
+            events |= POLLOUT;
+        }
+        fds.push_back({pcb->fd, events, 0});
+        pcbs.push_back(pcb);
+    }
+
+    timespec ts = {static_cast<time_t>(timeout_us / 1000000), static_cast<long>(timeout_us % 1000000) * 1000};
+    if (ppoll(fds.data(), fds.size(), &ts, nullptr) > 0) {
+        for (size_t i = 0; i < fds.size(); ++i) {
+            tcp_pcb *pcb = pcbs[i];
+            if (pcb->closed || fds[i].revents == 0) {
+                continue;
+            }
+            if (pcb->listening) {
+                do_accept(pcb);
+                continue;
+            }
+            if ((fds[i].revents & POLLOUT) && !flush(pcb)) {
+                fail(pcb, ERR_RST);
+                continue;
+            }
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                do_recv(pcb);
+            }
+        }
+    }
+
+    // Closed pcbs are only freed here, once no callback can still hold them.
+    for (size_t i = 0; i < s_pcbs.size();) {
+        if (s_pcbs[i]->closed) {
+            delete s_pcbs[i];
+            s_pcbs.erase(s_pcbs.begin() + static_cast<long>(i));
+        } else {
+            ++i;
+        }
+    }
+}
+
+extern "C" {
+
+u8_t pbuf_free(struct pbuf *p) {
+    u8_t count = 0;
+    while (p) {
+        pbuf *next = p->next;
+        free(p);
+        p = next;
+        ++count;
+    }
+    return count;
+}
+
+struct tcp_pcb *tcp_new_ip_type(u8_t /*type*/) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return nullptr;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    set_nonblocking(fd);
+
+    tcp_pcb *pcb = new tcp_pcb;
+    pcb->fd = fd;
+    s_pcbs.push_back(pcb);
+    return pcb;
+}
+
+// Binds to localhost only; --port overrides the firmware's REPL_PORT. The
+// port actually bound is printed, which is how tests find --port 0's.
+err_t tcp_bind(struct tcp_pcb *pcb, const ip_addr_t * /*ipaddr*/, u16_t port) {
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(g_sim.port >= 0 ? static_cast<u16_t>(g_sim.port) : port);
+    if (bind(pcb->fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+        fprintf(stderr, "sim: bind to port %u: %s\n", ntohs(addr.sin_port), strerror(errno));
+        return ERR_VAL;
+    }
+    socklen_t addr_len = sizeof(addr);
+    getsockname(pcb->fd, reinterpret_cast<sockaddr *>(&addr), &addr_len);
+    fprintf(stderr, "sim: REPL on 127.0.0.1:%u\n", ntohs(addr.sin_port));
+    return ERR_OK;
+}
+
+struct tcp_pcb *tcp_listen_with_backlog(struct tcp_pcb *pcb, u8_t backlog) {
+    if (listen(pcb->fd, backlog) != 0) {
+        return nullptr;
+    }
+    pcb->listening = true;
+    return pcb;
+}
+
+void tcp_accept(struct tcp_pcb *pcb, tcp_accept_fn accept) {
+    pcb->accept = accept;
+}
+
+void tcp_arg(struct tcp_pcb *pcb, void *arg) {
+    pcb->arg = arg;
+}
+
+void tcp_recv(struct tcp_pcb *pcb, tcp_recv_fn recv) {
+    pcb->recv = recv;
+}
+
+void tcp_sent(struct tcp_pcb *pcb, tcp_sent_fn sent) {
+    pcb->sent = sent;
+}
+
+void tcp_err(struct tcp_pcb *pcb, tcp_err_fn err) {
+    pcb->err = err;
+}
+
+void tcp_recved(struct tcp_pcb * /*pcb*/, u16_t /*len*/) {}
+
+err_t tcp_write(struct tcp_pcb *pcb, const void *dataptr, u16_t len, u8_t /*apiflags*/) {
+    if (pcb->closed || pcb->broken) {
+        return ERR_CONN;
+    }
+    if (pcb->out.size() + len > kSndBuf) {
+        return ERR_MEM;
+    }
+    observe_write(static_cast<const char *>(dataptr), len);
+    pcb->out.append(static_cast<const char *>(dataptr), len);
+    pcb->unsent += len;
+    return ERR_OK;
+}
+
+err_t tcp_output(struct tcp_pcb *pcb) {
+    if (pcb->closed || pcb->broken) {
+        return ERR_CONN;
+    }
+    pcb->unsent = 0;
+    if (!flush(pcb)) {
+        pcb->broken = true;
+    }
+    return ERR_OK;
+}
+
+u16_t tcp_sndbuf(const struct tcp_pcb *pcb) {
+    return static_cast<u16_t>(kSndBuf - pcb->out.size());
+}
+
+err_t tcp_close(struct tcp_pcb *pcb) {
+    if (!pcb->listening && pcb->fd >= 0) {
+        // Whatever the firmware queued still goes out, as lwIP would send it
+        // before the FIN.
+        fcntl(pcb->fd, F_SETFL, fcntl(pcb->fd, F_GETFL, 0) & ~O_NONBLOCK);
+        pcb->unsent = 0;
+        flush(pcb);
+        shutdown(pcb->fd, SHUT_RDWR);
+    }
+    release(pcb);
+    return ERR_OK;
+}
+
+void tcp_abort(struct tcp_pcb *pcb) {
+    fail(pcb, ERR_ABRT);
+}
+
+// cyw43: the radio is always up and has nothing to configure.
+
+int cyw43_arch_init(void) {
+    return 0;
+}
+
+void cyw43_arch_deinit(void) {}
+
+void cyw43_arch_enable_ap_mode(const char * /*ssid*/, const char * /*password*/, uint32_t /*auth*/) {}
+
+void cyw43_arch_gpio_put(uint /*wl_gpio*/, bool /*value*/) {}
+
+void cyw43_arch_lwip_begin(void) {}
+
+void cyw43_arch_lwip_end(void) {}
+
+int cyw43_ioctl(cyw43_t * /*self*/, uint32_t /*cmd*/, size_t /*len*/, uint8_t * /*buf*/, uint32_t /*iface*/) {
+    return 0;
+}
+
+// There are no DHCP clients on localhost.
+err_t dhserv_init(dhcp_config_t * /*config*/) {
+    return ERR_OK;
+}
+
+void dhserv_free(void) {}
+
+}  // extern "C"
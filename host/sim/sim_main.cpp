@@ -0,0 +1,271 @@
+// Runs the unmodified firmware on Linux. Clients connect to the REPL on
+// localhost; whatever the firmware types comes out of the simulated USB host
+// as text on stdout. Firmware logging goes to stderr, and so do the
+// throughput and latency figures printed at exit.
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "pico/stdlib.h"
+
+#include "sim.h"
+
+int firmware_main();
+
+SimOptions g_sim = {-1, nullptr, false, 500, 100, 0, 0, 0, SimInputMethod::kNone, SimHost::kGeneric, 1920, 1080};
+FILE *g_sim_out = nullptr;
+
+namespace {
+
+struct Latency {
+    uint32_t count = 0;
+    uint64_t min_us = UINT64_MAX;
+    uint64_t max_us = 0;
+    uint64_t total_us = 0;
+
+    void add(uint64_t us) {
+        ++count;
+        min_us = std::min(min_us, us);
+        max_us = std::max(max_us, us);
+        total_us += us;
+    }
+};
+
+struct Stats {
+    std::mutex lock;
+    std::map<uint16_t, uint64_t> in_flight;     // line id -> receipt time
+    uint16_t first_pending = 0;                 // idle-time line waiting for its first report
+    uint64_t first_pending_us = 0;
+    uint32_t lines = 0;
+    uint32_t reports = 0;
+    uint64_t chars = 0;
+    uint64_t first_report_us = 0;
+    uint64_t last_report_us = 0;
+    Latency first_report;
+    Latency done;
+};
+
+static Stats s_stats;
+static std::atomic<bool> s_interrupted{false};
+
+void print_latency(const char *what, const Latency &l) {
+    if (l.count == 0) {
+        return;
+    }
+    fprintf(stderr, "sim: %s min/avg/max %.1f/%.1f/%.1f ms over %u line(s)\n", what,
+            l.min_us / 1000.0, l.total_us / 1000.0 / l.count, l.max_us / 1000.0, l.count);
+}
+
+void print_stats() {
+    std::lock_guard<std::mutex> guard(s_stats.lock);
+    double span = (s_stats.last_report_us - s_stats.first_report_us) / 1e6;
+    fprintf(stderr, "sim: %u line(s), %u report(s), %llu char(s)", s_stats.lines, s_stats.reports,
+            static_cast<unsigned long long>(s_stats.chars));
+    if (span > 0) {
+        fprintf(stderr, " in %.3f s, %.1f chars/s, %.1f reports/s", span, s_stats.chars / span,
+                s_stats.reports / span);
+    }
+    fprintf(stderr, "\n");
+    // Only lines that arrived while nothing else was typing count towards
+    // first-report latency; for the others it is mostly queueing.
+    print_latency("receipt to first report", s_stats.first_report);
+    print_latency("receipt to done", s_stats.done);
+}
+
+// Result records stop once the client is gone, so after a disconnect the
+// only sign of pending work is the keyboard still typing.
+bool settled() {
+    return time_us_64() - sim_usb_last_report_us() >= static_cast<uint64_t>(g_sim.linger_ms) * 1000;
+}
+
+void on_signal(int) {
+    s_interrupted = true;
+}
+
+// Decides when to exit; the firmware threads never return.
+void monitor() {
+    uint64_t idle_since = 0;
+    while (!s_interrupted) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        if (!g_sim.once) {
+            continue;
+        }
+        // Core 1 owns the sockets, but these are only read as a hint here.
+        if (sim_lwip_clients() == 0 || sim_lwip_connected() || !settled()) {
+            idle_since = 0;
+            continue;
+        }
+        if (idle_since == 0) {
+            idle_since = time_us_64();
+        } else if (time_us_64() - idle_since >= static_cast<uint64_t>(g_sim.linger_ms) * 1000) {
+            break;
+        }
+    }
+
+    fflush(g_sim_out);
+    print_stats();
+    sim_stop_alarms();
+    fflush(stderr);
+    _exit(0);
+}
+
+void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [--port N] [--flash FILE] [--once] [--linger MS] [--enumerate MS]\n"
+            "       [--suspend AT,FOR] [--reset AT] [--unicode linux|windows|mac]\n"
+            "       [--host windows|linux|macos] [--screen WxH]\n"
+            "  --port N        REPL port on localhost (default: the firmware's REPL_PORT);\n"
+            "                  0 picks a free one, printed on stderr\n"
+            "  --flash FILE    keep the flash image (autorun etc.) in FILE across runs\n"
+            "  --once          exit after the first client disconnects and typing settles\n"
+            "  --linger MS     how long typing must be idle to count as settled (default 500)\n"
+            "  --enumerate MS  delay before the simulated host enumerates (default 100)\n"
+            "  --suspend AT,FOR  suspend the bus AT ms after enumeration for FOR ms;\n"
+            "                  FOR 0 keeps it suspended until the device wakes the host\n"
+            "  --reset AT      reset the bus AT ms after enumeration; the host enumerates\n"
+            "                  again after the --enumerate delay\n"
+            "  --unicode M     put together the input sequences of !unicode M into\n"
+            "                  characters, as the host's input method would\n"
+            "  --host OS       enumerate the way OS does, for the firmware's !os guess\n"
+            "  --screen WxH    screen the absolute mouse spans, to print its position in\n"
+            "                  pixels (default 1920x1080, like !screen)\n",
+            argv0);
+}
+
+bool parse_args(int argc, char **argv) {
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (strcmp(arg, "--once") == 0) {
+            g_sim.once = true;
+        } else if (strcmp(arg, "--port") == 0 && value) {
+            g_sim.port = atoi(value);
+            if (g_sim.port < 0 || g_sim.port > 65535) {
+                return false;
+            }
+            ++i;
+        } else if (strcmp(arg, "--flash") == 0 && value) {
+            g_sim.flash_path = value;
+            ++i;
+        } else if (strcmp(arg, "--linger") == 0 && value) {
+            g_sim.linger_ms = static_cast<uint32_t>(atoi(value));
+            ++i;
+        } else if (strcmp(arg, "--enumerate") == 0 && value) {
+            g_sim.enumerate_ms = static_cast<uint32_t>(atoi(value));
+            ++i;
+        } else if (strcmp(arg, "--suspend") == 0 && value) {
+            unsigned at, duration;
+            if (sscanf(value, "%u,%u", &at, &duration) != 2 || at == 0) {
+                return false;
+            }
+            g_sim.suspend_at_ms = at;
+            g_sim.suspend_for_ms = duration;
+            ++i;
+        } else if (strcmp(arg, "--reset") == 0 && value) {
+            g_sim.reset_at_ms = static_cast<uint32_t>(atoi(value));
+            ++i;
+        } else if (strcmp(arg, "--host") == 0 && value) {
+            if (strcmp(value, "windows") == 0) {
+                g_sim.host = SimHost::kWindows;
+            } else if (strcmp(value, "linux") == 0) {
+                g_sim.host = SimHost::kLinux;
+            } else if (strcmp(value, "macos") == 0) {
+                g_sim.host = SimHost::kMacos;
+            } else {
+                return false;
+            }
+            ++i;
+        } else if (strcmp(arg, "--screen") == 0 && value) {
+            unsigned width, height;
+            if (sscanf(value, "%ux%u", &width, &height) != 2 || width < 2 || height < 2 || width > 16384 ||
+                height > 16384) {
+                return false;
+            }
+            g_sim.screen_width = static_cast<uint16_t>(width);
+            g_sim.screen_height = static_cast<uint16_t>(height);
+            ++i;
+        } else if (strcmp(arg, "--unicode") == 0 && value) {
+            if (strcmp(value, "linux") == 0) {
+                g_sim.input_method = SimInputMethod::kLinux;
+            } else if (strcmp(value, "windows") == 0) {
+                g_sim.input_method = SimInputMethod::kWindows;
+            } else if (strcmp(value, "mac") == 0) {
+                g_sim.input_method = SimInputMethod::kMac;
+            } else {
+                return false;
+            }
+            ++i;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+void sim_stats_line_received(uint16_t id, uint64_t recv_us) {
+    std::lock_guard<std::mutex> guard(s_stats.lock);
+    if (s_stats.in_flight.empty() && s_stats.first_pending == 0) {
+        s_stats.first_pending = id;
+        s_stats.first_pending_us = recv_us;
+    }
+    s_stats.in_flight[id] = recv_us;
+    ++s_stats.lines;
+}
+
+void sim_stats_line_done(uint16_t id, uint64_t done_us) {
+    std::lock_guard<std::mutex> guard(s_stats.lock);
+    auto it = s_stats.in_flight.find(id);
+    if (it == s_stats.in_flight.end()) {
+        return;
+    }
+    s_stats.done.add(done_us - it->second);
+    s_stats.in_flight.erase(it);
+    if (s_stats.first_pending == id) {
+        s_stats.first_pending = 0;     // typed nothing
+    }
+}
+
+void sim_stats_report(uint64_t us, size_t chars) {
+    std::lock_guard<std::mutex> guard(s_stats.lock);
+    if (s_stats.reports == 0) {
+        s_stats.first_report_us = us;
+    }
+    s_stats.last_report_us = us;
+    ++s_stats.reports;
+    s_stats.chars += chars;
+    if (s_stats.first_pending != 0) {
+        s_stats.first_report.add(us - s_stats.first_pending_us);
+        s_stats.first_pending = 0;
+    }
+}
+
+int main(int argc, char **argv) {
+    if (!parse_args(argc, argv)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // Keystrokes keep the real stdout; the firmware's printf output joins stderr.
+    g_sim_out = fdopen(dup(STDOUT_FILENO), "w");
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    sim_flash_load();
+    std::thread(monitor).detach();
+    return firmware_main();
+}
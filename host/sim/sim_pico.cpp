@@ -0,0 +1,386 @@
+// Pico SDK runtime for the simulator: both cores are threads, hardware alarms
+// are threads that call their callback at the target time, and flash is a RAM
+// image that can be loaded from and saved to a file.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "bsp/board.h"
+#include "hardware/flash.h"
+#include "hardware/regs/addressmap.h"
+#include "hardware/timer.h"
+#include "pico/critical_section.h"
+#include "pico/flash.h"
+#include "pico/multicore.h"
+#include "pico/stdlib.h"
+#include "pico/util/queue.h"
+
+#include "sim.h"
+
+uint8_t sim_flash[PICO_FLASH_SIZE_BYTES];
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const Clock::time_point s_epoch = Clock::now();
+thread_local uint s_core_num = 0;
+
+struct Queue {
+    std::mutex lock;
+    std::vector<uint8_t> data;
+    uint element_size;
+    uint element_count;
+    uint head;
+    uint level;
+};
+
+Queue &queue_of(queue_t *q) {
+    return *static_cast<Queue *>(q->impl);
+}
+
+struct Alarm {
+    std::mutex lock;
+    std::condition_variable wake;
+    std::thread thread;
+    hardware_alarm_callback_t callback = nullptr;
+    uint64_t target_us = 0;     // 0: not armed
+    bool claimed = false;
+};
+
+Alarm s_alarms[NUM_TIMERS];
+std::mutex s_claim_lock;
+std::atomic<bool> s_alarms_stopping{false};
+
+// WFE: any alarm interrupt is an event that ends the wait.
+std::mutex s_event_lock;
+std::condition_variable s_event_wake;
+bool s_event = false;
+
+std::mutex s_flash_lock;
+
+void alarm_thread(uint num) {
+    Alarm &alarm = s_alarms[num];
+    std::unique_lock<std::mutex> guard(alarm.lock);
+    while (!s_alarms_stopping) {
+        if (alarm.target_us == 0) {
+            alarm.wake.wait(guard);
+            continue;
+        }
+        uint64_t now = time_us_64();
+        if (now < alarm.target_us) {
+            alarm.wake.wait_for(guard, std::chrono::microseconds(alarm.target_us - now));
+            continue;
+        }
+        alarm.target_us = 0;
+        hardware_alarm_callback_t callback = alarm.callback;
+        guard.unlock();
+        if (callback) {
+            callback(num);
+        }
+        {
+            std::lock_guard<std::mutex> event_guard(s_event_lock);
+            s_event = true;
+        }
+        s_event_wake.notify_all();
+        guard.lock();
+    }
+}
+
+}  // namespace
+
+bool sim_on_core1() {
+    return s_core_num == 1;
+}
+
+void sim_flash_load() {
+    memset(sim_flash, 0xff, sizeof(sim_flash));
+    if (!g_sim.flash_path) {
+        return;
+    }
+    if (FILE *f = fopen(g_sim.flash_path, "rb")) {
+        size_t n = fread(sim_flash, 1, sizeof(sim_flash), f);
+        (void)n;
+        fclose(f);
+    }
+}
+
+void sim_flash_save() {
+    if (!g_sim.flash_path) {
+        return;
+    }
+    if (FILE *f = fopen(g_sim.flash_path, "wb")) {
+        fwrite(sim_flash, 1, sizeof(sim_flash), f);
+        fclose(f);
+    }
+}
+
+void sim_stop_alarms() {
+    {
+        std::lock_guard<std::mutex> guard(s_claim_lock);
+        s_alarms_stopping = true;
+    }
+    for (Alarm &alarm : s_alarms) {
+        {
+            std::lock_guard<std::mutex> guard(alarm.lock);
+            alarm.wake.notify_all();
+        }
+        if (alarm.thread.joinable()) {
+            alarm.thread.join();
+        }
+    }
+}
+
+extern "C" {
+
+// Time
+
+uint64_t time_us_64(void) {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - s_epoch).count());
+}
+
+uint32_t time_us_32(void) {
+    return static_cast<uint32_t>(time_us_64());
+}
+
+void sleep_until(absolute_time_t t) {
+    // Core 1 services the network while it sleeps, as the cyw43 background
+    // worker does on hardware.
+    while (sim_on_core1()) {
+        uint64_t now = time_us_64();
+        if (now >= t) {
+            return;
+        }
+        sim_lwip_poll(t - now);
+    }
+    uint64_t now = time_us_64();
+    if (now < t) {
+        std::this_thread::sleep_for(std::chrono::microseconds(t - now));
+    }
+}
+
+void sleep_us(uint64_t us) {
+    sleep_until(time_us_64() + us);
+}
+
+void sleep_ms(uint32_t ms) {
+    sleep_us(static_cast<uint64_t>(ms) * 1000);
+}
+
+void busy_wait_us(uint64_t us) {
+    uint64_t end = time_us_64() + us;
+    while (time_us_64() < end) {
+    }
+}
+
+bool best_effort_wfe_or_timeout(absolute_time_t timeout_timestamp) {
+    if (sim_on_core1()) {
+        sleep_until(timeout_timestamp);
+        return true;
+    }
+    std::unique_lock<std::mutex> guard(s_event_lock);
+    uint64_t now = time_us_64();
+    if (!s_event && now < timeout_timestamp) {
+        s_event_wake.wait_for(guard, std::chrono::microseconds(timeout_timestamp - now));
+    }
+    s_event = false;
+    return time_us_64() >= timeout_timestamp;
+}
+
+bool stdio_init_all(void) {
+    return true;
+}
+
+void board_init(void) {}
+
+// Multicore
+
+void multicore_launch_core1(void (*entry)(void)) {
+    std::thread([entry] {
+        s_core_num = 1;
+        entry();
+    }).detach();
+}
+
+uint get_core_num(void) {
+    return s_core_num;
+}
+
+// Queues
+
+void queue_init(queue_t *q, uint element_size, uint element_count) {
+    Queue *impl = new Queue;
+    impl->data.resize(static_cast<size_t>(element_size) * element_count);
+    impl->element_size = element_size;
+    impl->element_count = element_count;
+    impl->head = 0;
+    impl->level = 0;
+    q->impl = impl;
+}
+
+void queue_free(queue_t *q) {
+    delete static_cast<Queue *>(q->impl);
+    q->impl = nullptr;
+}
+
+uint queue_get_level(queue_t *q) {
+    Queue &impl = queue_of(q);
+    std::lock_guard<std::mutex> guard(impl.lock);
+    return impl.level;
+}
+
+bool queue_is_empty(queue_t *q) {
+    return queue_get_level(q) == 0;
+}
+
+bool queue_is_full(queue_t *q) {
+    return queue_get_level(q) == queue_of(q).element_count;
+}
+
+bool queue_try_add(queue_t *q, const void *data) {
+    Queue &impl = queue_of(q);
+    std::lock_guard<std::mutex> guard(impl.lock);
+    if (impl.level == impl.element_count) {
+        return false;
+    }
+    uint slot = (impl.head + impl.level) % impl.element_count;
+    memcpy(&impl.data[static_cast<size_t>(slot) * impl.element_size], data, impl.element_size);
+    ++impl.level;
+    return true;
+}
+
+static bool queue_take(queue_t *q, void *data, bool remove) {
+    Queue &impl = queue_of(q);
+    std::lock_guard<std::mutex> guard(impl.lock);
+    if (impl.level == 0) {
+        return false;
+    }
+    memcpy(data, &impl.data[static_cast<size_t>(impl.head) * impl.element_size], impl.element_size);
+    if (remove) {
+        impl.head = (impl.head + 1) % impl.element_count;
+        --impl.level;
+    }
+    return true;
+}
+
+bool queue_try_remove(queue_t *q, void *data) {
+    return queue_take(q, data, true);
+}
+
+bool queue_try_peek(queue_t *q, void *data) {
+    return queue_take(q, data, false);
+}
+
+void queue_add_blocking(queue_t *q, const void *data) {
+    while (!queue_try_add(q, data)) {
+        sleep_us(100);
+    }
+}
+
+void queue_remove_blocking(queue_t *q, void *data) {
+    while (!queue_try_remove(q, data)) {
+        sleep_us(100);
+    }
+}
+
+// Critical sections
+
+void critical_section_init(critical_section_t *crit_sec) {
+    crit_sec->impl = new std::recursive_mutex;
+}
+
+void critical_section_enter_blocking(critical_section_t *crit_sec) {
+    static_cast<std::recursive_mutex *>(crit_sec->impl)->lock();
+}
+
+void critical_section_exit(critical_section_t *crit_sec) {
+    static_cast<std::recursive_mutex *>(crit_sec->impl)->unlock();
+}
+
+void critical_section_deinit(critical_section_t *crit_sec) {
+    delete static_cast<std::recursive_mutex *>(crit_sec->impl);
+    crit_sec->impl = nullptr;
+}
+
+// Hardware alarms
+
+int hardware_alarm_claim_unused(bool required) {
+    std::lock_guard<std::mutex> guard(s_claim_lock);
+    for (uint i = 0; i < NUM_TIMERS; ++i) {
+        Alarm &alarm = s_alarms[i];
+        if (!alarm.claimed && !s_alarms_stopping) {
+            alarm.claimed = true;
+            alarm.thread = std::thread(alarm_thread, i);
+            return static_cast<int>(i);
+        }
+    }
+    if (required) {
+        fprintf(stderr, "sim: no hardware alarm left\n");
+        abort();
+    }
+    return -1;
+}
+
+void hardware_alarm_unclaim(uint alarm_num) {
+    hardware_alarm_cancel(alarm_num);
+    std::lock_guard<std::mutex> guard(s_claim_lock);
+    s_alarms[alarm_num].claimed = false;
+}
+
+void hardware_alarm_set_callback(uint alarm_num, hardware_alarm_callback_t callback) {
+    Alarm &alarm = s_alarms[alarm_num];
+    std::lock_guard<std::mutex> guard(alarm.lock);
+    alarm.callback = callback;
+}
+
+// Like the SDK: returns true if the target has already passed and the alarm
+// was not armed.
+bool hardware_alarm_set_target(uint alarm_num, absolute_time_t t) {
+    if (t <= time_us_64()) {
+        return true;
+    }
+    Alarm &alarm = s_alarms[alarm_num];
+    std::lock_guard<std::mutex> guard(alarm.lock);
+    alarm.target_us = t;
+    alarm.wake.notify_all();
+    return false;
+}
+
+void hardware_alarm_cancel(uint alarm_num) {
+    Alarm &alarm = s_alarms[alarm_num];
+    std::lock_guard<std::mutex> guard(alarm.lock);
+    alarm.target_us = 0;
+}
+
+// Flash
+
+void flash_range_erase(uint32_t flash_offs, size_t count) {
+    memset(sim_flash + flash_offs, 0xff, count);
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count) {
+    // NOR flash can only clear bits.
+    for (size_t i = 0; i < count; ++i) {
+        sim_flash[flash_offs + i] &= data[i];
+    }
+}
+
+bool flash_safe_execute_core_init(void) {
+    return true;
+}
+
+int flash_safe_execute(void (*func)(void *), void *param, uint32_t /*enter_exit_timeout_ms*/) {
+    std::lock_guard<std::mutex> guard(s_flash_lock);
+    func(param);
+    sim_flash_save();
+    return PICO_OK;
+}
+
+}  // extern "C"
@@ -0,0 +1,59 @@
+// stack_watch for the simulator. The cores are threads with large stacks, so
+// only a window below the painting frame is watched. The figures are for
+// host frames, which are larger than Cortex-M0+ ones; compare them between
+// runs rather than against the firmware's budget.
+
+#include <pthread.h>
+
+#include "pico/multicore.h"
+#include "stack_watch.h"
+
+namespace {
+
+constexpr size_t kWindowWords = 64 * 1024 / sizeof(uint32_t);
+constexpr uint32_t kPaint = 0x5aa5c33cu;
+
+uint32_t *s_bottom[2];
+uint32_t *s_top[2];
+
+}  // namespace
+
+extern "C" {
+
+void __attribute__((noinline)) stack_watch_paint(void) {
+    unsigned core = get_core_num();
+    volatile uint32_t marker = 0;
+    uint32_t *limit = const_cast<uint32_t *>(&marker) - 64;
+
+    pthread_attr_t attr;
+    void *lo = nullptr;
+    size_t size = 0;
+    pthread_getattr_np(pthread_self(), &attr);
+    pthread_attr_getstack(&attr, &lo, &size);
+    pthread_attr_destroy(&attr);
+
+    uint32_t *bottom = limit - kWindowWords;
+    if (bottom < static_cast<uint32_t *>(lo)) {
+        bottom = static_cast<uint32_t *>(lo);
+    }
+    for (uint32_t *w = bottom; w < limit; ++w) {
+        *w = kPaint;
+    }
+    // The frames above the painter belong to the caller and count as used.
+    s_bottom[core] = bottom;
+    s_top[core] = limit + 64;
+}
+
+size_t stack_watch_size(unsigned core) {
+    return static_cast<size_t>(s_top[core] - s_bottom[core]) * sizeof(uint32_t);
+}
+
+size_t stack_watch_peak(unsigned core) {
+    const uint32_t *w = s_bottom[core];
+    while (w && w < s_top[core] && *w == kPaint) {
+        ++w;
+    }
+    return static_cast<size_t>(s_top[core] - w) * sizeof(uint32_t);
+}
+
+}  // extern "C"
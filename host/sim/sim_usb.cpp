@@ -0,0 +1,817 @@
+// TinyUSB device stack for the simulator. A simulated host enumerates the
+// device through the firmware's descriptor callbacks, then polls each HID IN
+// endpoint on a 1 ms virtual frame clock at the descriptor's bInterval. Each
+// report it takes is decoded back into text on g_sim_out, with the key state
+// of all keyboards merged the way a real host does. Report IDs are mapped to
+// keyboard, consumer or system control from the report descriptor; the host
+// always selects report protocol.
+//
+// With --suspend the host suspends the bus once: no polls until it resumes,
+// after a fixed time or when the device signals remote wakeup. With --reset
+// it resets the bus once, losing every report in flight, and enumerates the
+// device again.
+
+#include <atomic>
+#include <cstring>
+#include <string>
+
+#include "pico/stdlib.h"
+#include "tusb.h"
+
+#include "sim.h"
+
+namespace {
+
+enum class UsbState {
+    kDetached,
+    kAttached,      // waiting for the host to enumerate
+    kConfigured,
+};
+
+struct Endpoint {
+    uint8_t address;
+    uint8_t interval;   // frames between polls
+    uint8_t phase;      // frame offset within the interval
+    uint16_t report_desc_len;
+    bool busy;
+    uint64_t due_frame;
+    uint8_t report[CFG_TUD_HID_EP_BUFSIZE];
+    uint16_t len;
+    uint8_t modifier;   // what the host last took from this keyboard
+    uint8_t keys[6];
+    uint16_t consumer;
+    uint8_t system;
+    uint8_t buttons;    // mouse
+};
+
+enum class ReportKind : uint8_t {
+    kUnknown,
+    kKeyboard,
+    kConsumer,
+    kSystem,
+    kMouse,
+};
+
+static UsbState s_state = UsbState::kDetached;
+static uint64_t s_attach_us = 0;
+static Endpoint s_eps[CFG_TUD_HID] = {};
+static size_t s_ep_count = 0;
+static bool s_report_ids = false;
+static ReportKind s_report_kinds[256];     // by report ID
+static std::atomic<uint64_t> s_last_report_us{0};
+
+// Where the host's pointer is, 0-32767 on each axis
+static uint16_t s_pointer_x = 0;
+static uint16_t s_pointer_y = 0;
+
+static uint64_t s_mount_us = 0;
+static bool s_suspended = false;
+static bool s_suspend_done = false;
+static uint64_t s_resume_us = 0;    // 0: not scheduled
+static bool s_reset_done = false;
+
+// A host answers remote wakeup by driving resume for 20 ms.
+constexpr uint64_t kResumeSignalUs = 20000;
+
+uint64_t frame_now() {
+    return time_us_64() / 1000;
+}
+
+// Next frame the host polls the endpoint at, strictly after `frame`.
+uint64_t next_poll_frame(const Endpoint &ep, uint64_t frame) {
+    uint64_t interval = ep.interval ? ep.interval : 1;
+    if (frame < ep.phase) {
+        return ep.phase;
+    }
+    return ((frame - ep.phase) / interval + 1) * interval + ep.phase;
+}
+
+// Walks the configuration descriptor the way a host does, to find the HID IN
+// endpoints and their polling intervals. Like a host balancing its periodic
+// schedule, it spreads endpoints with the same interval over different frames.
+bool parse_configuration(const uint8_t *desc) {
+    uint16_t total = static_cast<uint16_t>(desc[2] | (desc[3] << 8));
+    s_ep_count = 0;
+    uint16_t report_desc_len = 0;   // from the interface's HID descriptor
+    for (uint16_t pos = 0; pos + 2 <= total && desc[pos] != 0; pos += desc[pos]) {
+        const uint8_t *d = desc + pos;
+        if (d[1] == HID_DESC_TYPE_HID) {
+            report_desc_len = static_cast<uint16_t>(d[7] | (d[8] << 8));
+        }
+        if (d[1] == TUSB_DESC_ENDPOINT && (d[2] & 0x80) && (d[3] & 0x03) == TUSB_XFER_INTERRUPT &&
+            s_ep_count < CFG_TUD_HID) {
+            s_eps[s_ep_count] = {};
+            s_eps[s_ep_count].address = d[2];
+            s_eps[s_ep_count].interval = d[6];
+            s_eps[s_ep_count].report_desc_len = report_desc_len;
+            ++s_ep_count;
+        }
+    }
+    for (size_t i = 0; i < s_ep_count; ++i) {
+        s_eps[i].phase = static_cast<uint8_t>(i * s_eps[i].interval / s_ep_count);
+    }
+    return s_ep_count > 0;
+}
+
+// Walks the short items of the report descriptor: each Report ID belongs to
+// the application collection it appears in.
+void parse_report_descriptor(const uint8_t *desc, size_t len) {
+    s_report_ids = false;
+    ReportKind app = ReportKind::kUnknown;
+    uint32_t page = 0;
+    uint32_t usage = 0;
+    int depth = 0;
+    for (size_t pos = 0; pos < len;) {
+        uint8_t prefix = desc[pos];
+        size_t size = (prefix & 3) == 3 ? 4 : (prefix & 3);
+        uint32_t data = 0;
+        for (size_t i = 0; i < size && pos + 1 + i < len; ++i) {
+            data |= static_cast<uint32_t>(desc[pos + 1 + i]) << (8 * i);
+        }
+        switch (prefix & 0xFC) {
+            case 0x04:      // Usage Page
+                page = data;
+                break;
+            case 0x08:      // Usage
+                usage = data;
+                break;
+            case 0xA0:      // Collection
+                if (depth++ == 0) {
+                    if (page == HID_USAGE_PAGE_DESKTOP && usage == HID_USAGE_DESKTOP_KEYBOARD) {
+                        app = ReportKind::kKeyboard;
+                    } else if (page == HID_USAGE_PAGE_CONSUMER) {
+                        app = ReportKind::kConsumer;
+                    } else if (page == HID_USAGE_PAGE_DESKTOP && usage == HID_USAGE_DESKTOP_SYSTEM_CONTROL) {
+                        app = ReportKind::kSystem;
+                    } else if (page == HID_USAGE_PAGE_DESKTOP && usage == HID_USAGE_DESKTOP_MOUSE) {
+                        app = ReportKind::kMouse;
+                    } else {
+                        app = ReportKind::kUnknown;
+                    }
+                }
+                break;
+            case 0xC0:      // End Collection
+                --depth;
+                break;
+            case 0x84:      // Report ID
+                s_report_ids = true;
+                s_report_kinds[data & 0xFF] = app;
+                break;
+            default:
+                break;
+        }
+        pos += 1 + size;
+    }
+}
+
+// The requests of one host's enumeration (--host), after the way the real
+// ones are known to go. A host that reads a descriptor's first bytes before
+// all of it asks twice.
+struct HostPattern {
+    uint8_t device_reads;
+    uint8_t config_reads;
+    uint8_t strings[4];         // string indices in the order asked for
+    bool qualifier;
+    bool set_idle;              // class requests after SET_CONFIGURATION
+    bool led_report;
+};
+
+// Indexed by SimHost
+static constexpr HostPattern kHostPatterns[] = {
+    {1, 1, {0, 1, 2, 3},    false, true,  false},
+    {2, 2, {0xEE, 3, 0, 2}, true,  true,  true},
+    {2, 2, {0, 2, 1, 3},    false, true,  true},
+    {2, 2, {0, 1, 2, 3},    false, false, false},
+};
+
+void enumerate() {
+    const HostPattern &host = kHostPatterns[static_cast<size_t>(g_sim.host)];
+    const tusb_desc_device_t *dev = nullptr;
+    for (uint8_t i = 0; i < host.device_reads; ++i) {
+        dev = reinterpret_cast<const tusb_desc_device_t *>(tud_descriptor_device_cb());
+    }
+    const uint8_t *config = nullptr;
+    for (uint8_t i = 0; i < host.config_reads; ++i) {
+        config = tud_descriptor_configuration_cb(0);
+    }
+    if (!dev || dev->bDescriptorType != TUSB_DESC_DEVICE || !config || !parse_configuration(config)) {
+        fprintf(stderr, "sim: enumeration failed, bad descriptors\n");
+        s_state = UsbState::kDetached;
+        return;
+    }
+    for (uint8_t index : host.strings) {
+        tud_descriptor_string_cb(index, index == 0 ? 0 : 0x0409);
+    }
+    if (host.qualifier && tud_descriptor_device_qualifier_cb) {
+        tud_descriptor_device_qualifier_cb();
+    }
+
+    fprintf(stderr, "sim: enumerated %04x:%04x", dev->idVendor, dev->idProduct);
+    for (size_t i = 0; i < s_ep_count; ++i) {
+        fprintf(stderr, ", HID IN endpoint 0x%02x every %u ms", s_eps[i].address, s_eps[i].interval);
+    }
+    fprintf(stderr, "\n");
+    s_state = UsbState::kConfigured;
+    s_mount_us = time_us_64();
+    if (tud_mount_cb) {
+        tud_mount_cb();
+    }
+
+    for (size_t i = 0; i < s_ep_count; ++i) {
+        uint8_t instance = static_cast<uint8_t>(i);
+        if (host.set_idle && tud_hid_set_idle_cb) {
+            tud_hid_set_idle_cb(instance, 0);
+        }
+        parse_report_descriptor(tud_hid_descriptor_report_cb(instance), s_eps[i].report_desc_len);
+        if (host.led_report) {
+            const uint8_t leds = 0;
+            tud_hid_set_report_cb(instance, s_report_ids ? HID_REPORT_ID_KEYBOARD : 0, HID_REPORT_TYPE_OUTPUT, &leds, 1);
+        }
+    }
+}
+
+struct KeyText {
+    uint8_t keycode;
+    char plain;
+    char shifted;
+};
+
+// US layout, the one the firmware types for.
+static constexpr KeyText kKeyText[] = {
+    {HID_KEY_1, '1', '!'}, {HID_KEY_2, '2', '@'}, {HID_KEY_3, '3', '#'}, {HID_KEY_4, '4', '$'},
+    {HID_KEY_5, '5', '%'}, {HID_KEY_6, '6', '^'}, {HID_KEY_7, '7', '&'}, {HID_KEY_8, '8', '*'},
+    {HID_KEY_9, '9', '('}, {HID_KEY_0, '0', ')'},
+    {HID_KEY_ENTER, '\n', 0}, {HID_KEY_TAB, '\t', 0}, {HID_KEY_SPACE, ' ', ' '},
+    {HID_KEY_MINUS, '-', '_'}, {HID_KEY_EQUAL, '=', '+'},
+    {HID_KEY_BRACKET_LEFT, '[', '{'}, {HID_KEY_BRACKET_RIGHT, ']', '}'},
+    {HID_KEY_BACKSLASH, '\\', '|'}, {HID_KEY_SEMICOLON, ';', ':'},
+    {HID_KEY_APOSTROPHE, '\'', '"'}, {HID_KEY_GRAVE, '`', '~'},
+    {HID_KEY_COMMA, ',', '<'}, {HID_KEY_PERIOD, '.', '>'}, {HID_KEY_SLASH, '/', '?'},
+};
+
+struct KeyTag {
+    uint8_t keycode;
+    const char *name;
+};
+
+// Names as the REPL spells them, so decoded output can be fed back in.
+static constexpr KeyTag kKeyTags[] = {
+    {HID_KEY_ENTER, "enter"}, {HID_KEY_TAB, "tab"}, {HID_KEY_ESCAPE, "esc"},
+    {HID_KEY_BACKSPACE, "backspace"}, {HID_KEY_DELETE, "delete"}, {HID_KEY_SPACE, "space"},
+    {HID_KEY_ARROW_UP, "up"}, {HID_KEY_ARROW_DOWN, "down"}, {HID_KEY_ARROW_LEFT, "left"},
+    {HID_KEY_ARROW_RIGHT, "right"}, {HID_KEY_HOME, "home"}, {HID_KEY_END, "end"},
+    {HID_KEY_PAGE_UP, "pageup"}, {HID_KEY_PAGE_DOWN, "pagedown"}, {HID_KEY_INSERT, "insert"},
+    {HID_KEY_CAPS_LOCK, "capslock"}, {HID_KEY_PRINT_SCREEN, "printscreen"},
+};
+
+char key_char(uint8_t keycode, bool shift) {
+    if (keycode >= HID_KEY_A && keycode <= HID_KEY_Z) {
+        return static_cast<char>((shift ? 'A' : 'a') + (keycode - HID_KEY_A));
+    }
+    for (const KeyText &k : kKeyText) {
+        if (k.keycode == keycode) {
+            return shift ? k.shifted : k.plain;
+        }
+    }
+    return 0;
+}
+
+std::string key_tag(uint8_t modifier, uint8_t keycode) {
+    std::string tag = "<";
+    auto add = [&tag](const char *part) {
+        if (tag.size() > 1) {
+            tag += '+';
+        }
+        tag += part;
+    };
+    if (modifier & (KEYBOARD_MODIFIER_LEFTCTRL | KEYBOARD_MODIFIER_RIGHTCTRL)) add("ctrl");
+    if (modifier & (KEYBOARD_MODIFIER_LEFTALT | KEYBOARD_MODIFIER_RIGHTALT)) add("alt");
+    if (modifier & (KEYBOARD_MODIFIER_LEFTSHIFT | KEYBOARD_MODIFIER_RIGHTSHIFT)) add("shift");
+    if (modifier & (KEYBOARD_MODIFIER_LEFTGUI | KEYBOARD_MODIFIER_RIGHTGUI)) add("gui");
+
+    char buf[8];
+    const char *name = nullptr;
+    for (const KeyTag &k : kKeyTags) {
+        if (k.keycode == keycode) {
+            name = k.name;
+        }
+    }
+    if (keycode >= HID_KEY_F1 && keycode <= HID_KEY_F12) {
+        snprintf(buf, sizeof(buf), "f%d", keycode - HID_KEY_F1 + 1);
+        name = buf;
+    } else if (!name) {
+        char c = key_char(keycode, false);
+        if (c > ' ') {
+            buf[0] = c;
+            buf[1] = '\0';
+        } else {
+            snprintf(buf, sizeof(buf), "0x%02x", keycode);
+        }
+        name = buf;
+    }
+    add(name);
+    tag += '>';
+    return tag;
+}
+
+struct ControlTag {
+    ReportKind kind;
+    uint16_t usage;
+    const char *name;
+};
+
+// Spelled as the REPL spells them; system control by report value.
+static constexpr ControlTag kControlTags[] = {
+    {ReportKind::kConsumer, HID_USAGE_CONSUMER_MUTE, "mute"},
+    {ReportKind::kConsumer, HID_USAGE_CONSUMER_VOLUME_INCREMENT, "volumeup"},
+    {ReportKind::kConsumer, HID_USAGE_CONSUMER_VOLUME_DECREMENT, "volumedown"},
+    {ReportKind::kConsumer, HID_USAGE_CONSUMER_PLAY_PAUSE, "playpause"},
+    {ReportKind::kConsumer, HID_USAGE_CONSUMER_SCAN_NEXT, "nexttrack"},
+    {ReportKind::kConsumer, HID_USAGE_CONSUMER_SCAN_PREVIOUS, "prevtrack"},
+    {ReportKind::kConsumer, HID_USAGE_CONSUMER_STOP, "stopmedia"},
+    {ReportKind::kConsumer, HID_USAGE_CONSUMER_BRIGHTNESS_INCREMENT, "brightnessup"},
+    {ReportKind::kConsumer, HID_USAGE_CONSUMER_BRIGHTNESS_DECREMENT, "brightnessdown"},
+    {ReportKind::kSystem, 1, "power"},
+    {ReportKind::kSystem, 2, "systemsleep"},
+    {ReportKind::kSystem, 3, "systemwake"},
+};
+
+std::string control_tag(ReportKind kind, uint16_t usage) {
+    for (const ControlTag &t : kControlTags) {
+        if (t.kind == kind && t.usage == usage) {
+            return std::string("<") + t.name + ">";
+        }
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), "<%s:0x%04x>", kind == ReportKind::kConsumer ? "consumer" : "system", usage);
+    return buf;
+}
+
+bool control_held(ReportKind kind, uint16_t usage) {
+    for (size_t i = 0; i < s_ep_count; ++i) {
+        if (kind == ReportKind::kConsumer ? s_eps[i].consumer == usage : s_eps[i].system == usage) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool key_held(uint8_t key) {
+    for (size_t i = 0; i < s_ep_count; ++i) {
+        if (memchr(s_eps[i].keys, key, sizeof(s_eps[i].keys))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The host's input method (--unicode), fed every key that goes down and
+// every change of the modifiers held across all keyboards.
+struct Composer {
+    bool active;
+    uint32_t value;
+    unsigned digits;
+};
+
+static Composer s_composer;
+
+void append_utf8(std::string &out, uint32_t cp) {
+    if (cp < 0x80) {
+        out += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        out += static_cast<char>(0xC0 | (cp >> 6));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        out += static_cast<char>(0xE0 | (cp >> 12));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (cp >> 18));
+        out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+}
+
+// The digit a key stands for in an input sequence, or -1.
+int hex_digit(uint8_t key) {
+    char c = key_char(key, false);
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+int keypad_digit(uint8_t key) {
+    if (key == HID_KEY_KEYPAD_0) {
+        return 0;
+    }
+    if (key >= HID_KEY_KEYPAD_1 && key <= HID_KEY_KEYPAD_9) {
+        return key - HID_KEY_KEYPAD_1 + 1;
+    }
+    return -1;
+}
+
+void compose_digit(unsigned base, int digit) {
+    s_composer.active = true;
+    s_composer.value = s_composer.value * base + static_cast<unsigned>(digit);
+    ++s_composer.digits;
+}
+
+void compose_commit(std::string &text) {
+    uint32_t cp = s_composer.value;
+    if (g_sim.input_method == SimInputMethod::kMac && s_composer.digits == 8) {
+        // A surrogate pair, four digits each
+        cp = 0x10000 + (((cp >> 16) - 0xD800) << 10) + ((cp & 0xFFFF) - 0xDC00);
+    }
+    append_utf8(text, cp);
+    s_composer = {};
+}
+
+// True if the key was taken by the input method.
+bool compose_key(uint8_t modifier, uint8_t key, std::string &text) {
+    constexpr uint8_t kCtrlShift = KEYBOARD_MODIFIER_LEFTCTRL | KEYBOARD_MODIFIER_LEFTSHIFT;
+    switch (g_sim.input_method) {
+        case SimInputMethod::kLinux:
+            if (!s_composer.active) {
+                if (modifier == kCtrlShift && key == HID_KEY_U) {
+                    s_composer = {true, 0, 0};
+                    return true;
+                }
+                return false;
+            }
+            if (modifier == 0 && hex_digit(key) >= 0) {
+                compose_digit(16, hex_digit(key));
+                return true;
+            }
+            if (modifier == 0 && (key == HID_KEY_SPACE || key == HID_KEY_ENTER)) {
+                compose_commit(text);
+                return true;
+            }
+            s_composer = {};
+            return false;
+
+        case SimInputMethod::kWindows:
+            if (modifier == KEYBOARD_MODIFIER_LEFTALT && keypad_digit(key) >= 0) {
+                compose_digit(10, keypad_digit(key));
+                return true;
+            }
+            return false;
+
+        case SimInputMethod::kMac:
+            if (modifier == KEYBOARD_MODIFIER_LEFTALT && hex_digit(key) >= 0) {
+                compose_digit(16, hex_digit(key));
+                return true;
+            }
+            return false;
+
+        default:
+            return false;
+    }
+}
+
+// Alt codes and Unicode Hex Input are committed when the modifier goes up.
+void compose_modifiers(uint8_t before, uint8_t after, std::string &text) {
+    if (g_sim.input_method != SimInputMethod::kWindows && g_sim.input_method != SimInputMethod::kMac) {
+        return;
+    }
+    if (s_composer.active && (before & KEYBOARD_MODIFIER_LEFTALT) && !(after & KEYBOARD_MODIFIER_LEFTALT)) {
+        compose_commit(text);
+    }
+}
+
+uint8_t held_modifiers() {
+    uint8_t modifier = 0;
+    for (size_t i = 0; i < s_ep_count; ++i) {
+        modifier |= s_eps[i].modifier;
+    }
+    return modifier;
+}
+
+// Every key that goes down in this report, and was not already held on any
+// keyboard, becomes text: a plain character if shift is the only modifier
+// held anywhere, otherwise a <mod+key> tag.
+std::string decode_keyboard(Endpoint &ep, const uint8_t *report, size_t len) {
+    if (len < 8) {
+        return "";
+    }
+    const uint8_t *keys = report + 2;
+    uint8_t before = held_modifiers();
+    ep.modifier = report[0];
+    uint8_t modifier = held_modifiers();
+    bool shift = modifier & (KEYBOARD_MODIFIER_LEFTSHIFT | KEYBOARD_MODIFIER_RIGHTSHIFT);
+    bool other = modifier & ~(KEYBOARD_MODIFIER_LEFTSHIFT | KEYBOARD_MODIFIER_RIGHTSHIFT);
+
+    std::string text;
+    compose_modifiers(before, modifier, text);
+    for (int i = 0; i < 6; ++i) {
+        uint8_t key = keys[i];
+        if (key == 0 || key_held(key) || compose_key(modifier, key, text)) {
+            continue;
+        }
+        char c = other ? 0 : key_char(key, shift);
+        if (c) {
+            text += c;
+        } else {
+            text += key_tag(modifier, key);
+        }
+    }
+    memcpy(ep.keys, keys, sizeof(ep.keys));
+    return text;
+}
+
+// A consumer or system control usage that goes down, and was not already
+// held on another keyboard, becomes its tag.
+std::string decode_control(Endpoint &ep, ReportKind kind, const uint8_t *report, size_t len) {
+    if (len < (kind == ReportKind::kConsumer ? 2u : 1u)) {
+        return "";
+    }
+    uint16_t usage = kind == ReportKind::kConsumer ? static_cast<uint16_t>(report[0] | (report[1] << 8))
+                                                   : static_cast<uint16_t>(report[0] & 0x03);
+    std::string text;
+    if (usage != 0 && !control_held(kind, usage)) {
+        text = control_tag(kind, usage);
+    }
+    if (kind == ReportKind::kConsumer) {
+        ep.consumer = usage;
+    } else {
+        ep.system = static_cast<uint8_t>(usage);
+    }
+    return text;
+}
+
+// Absolute mouse position to --screen pixels, as the host scales it.
+unsigned pixel(uint16_t position, uint16_t size) {
+    return (static_cast<unsigned>(position) * (size - 1u) + 16383) / 32767;
+}
+
+// A button that goes down, and was not already held on another keyboard,
+// becomes a click tag where the pointer is; a report that only moves the
+// pointer becomes <move:X,Y>.
+std::string decode_mouse(Endpoint &ep, const uint8_t *report, size_t len) {
+    if (len < 5) {
+        return "";
+    }
+    static const struct {
+        uint8_t button;
+        const char *tag;
+    } kClicks[] = {
+        {MOUSE_BUTTON_LEFT, "click"},
+        {MOUSE_BUTTON_RIGHT, "rclick"},
+        {MOUSE_BUTTON_MIDDLE, "mclick"},
+    };
+    uint8_t buttons = report[0];
+    uint16_t x = static_cast<uint16_t>(report[1] | (report[2] << 8));
+    uint16_t y = static_cast<uint16_t>(report[3] | (report[4] << 8));
+    uint8_t held = 0;
+    for (size_t i = 0; i < s_ep_count; ++i) {
+        held |= s_eps[i].buttons;
+    }
+
+    char tag[48];
+    std::string text;
+    for (const auto &click : kClicks) {
+        if (buttons & click.button & ~held) {
+            snprintf(tag, sizeof(tag), "<%s:%u,%u>", click.tag, pixel(x, g_sim.screen_width),
+                     pixel(y, g_sim.screen_height));
+            text += tag;
+        }
+    }
+    if (text.empty() && buttons == 0 && (x != s_pointer_x || y != s_pointer_y)) {
+        snprintf(tag, sizeof(tag), "<move:%u,%u>", pixel(x, g_sim.screen_width), pixel(y, g_sim.screen_height));
+        text = tag;
+    }
+    s_pointer_x = x;
+    s_pointer_y = y;
+    ep.buttons = buttons;
+    return text;
+}
+
+void decode_report(Endpoint &ep) {
+    const uint8_t *report = ep.report;
+    size_t len = ep.len;
+    ReportKind kind = ReportKind::kKeyboard;
+    if (s_report_ids && len > 0) {
+        kind = s_report_kinds[report[0]];
+        ++report;
+        --len;
+    }
+
+    std::string text;
+    if (kind == ReportKind::kKeyboard) {
+        text = decode_keyboard(ep, report, len);
+    } else if (kind == ReportKind::kConsumer || kind == ReportKind::kSystem) {
+        text = decode_control(ep, kind, report, len);
+    } else if (kind == ReportKind::kMouse) {
+        text = decode_mouse(ep, report, len);
+    }
+
+    uint64_t now = time_us_64();
+    s_last_report_us.store(now);
+    sim_stats_report(now, text.size());
+    if (!text.empty()) {
+        fwrite(text.data(), 1, text.size(), g_sim_out);
+        fflush(g_sim_out);
+    }
+}
+
+}  // namespace
+
+uint64_t sim_usb_last_report_us() {
+    return s_last_report_us.load();
+}
+
+namespace {
+
+// Like TinyUSB on a bus reset, this only clears the configuration; the
+// firmware has to notice tud_mounted() going false, or the next mount.
+bool update_reset() {
+    uint64_t now = time_us_64();
+    if (s_reset_done || g_sim.reset_at_ms == 0 ||
+        now - s_mount_us < static_cast<uint64_t>(g_sim.reset_at_ms) * 1000) {
+        return false;
+    }
+    s_reset_done = true;
+    size_t lost = 0;
+    for (size_t i = 0; i < s_ep_count; ++i) {
+        lost += s_eps[i].busy ? 1 : 0;
+        s_eps[i].busy = false;
+        s_eps[i].modifier = 0;
+        memset(s_eps[i].keys, 0, sizeof(s_eps[i].keys));
+        s_eps[i].consumer = 0;
+        s_eps[i].system = 0;
+        s_eps[i].buttons = 0;
+    }
+    fprintf(stderr, "sim: host reset the bus, %zu report(s) in flight lost\n", lost);
+    s_state = UsbState::kAttached;
+    s_attach_us = now;
+    return true;
+}
+
+// True while the bus stays suspended.
+bool update_suspend() {
+    uint64_t now = time_us_64();
+    if (!s_suspended) {
+        if (s_suspend_done || g_sim.suspend_at_ms == 0 ||
+            now - s_mount_us < static_cast<uint64_t>(g_sim.suspend_at_ms) * 1000) {
+            return false;
+        }
+        s_suspended = true;
+        s_suspend_done = true;
+        s_resume_us = g_sim.suspend_for_ms ? now + static_cast<uint64_t>(g_sim.suspend_for_ms) * 1000 : 0;
+        fprintf(stderr, "sim: host suspended the bus\n");
+        if (tud_suspend_cb) {
+            tud_suspend_cb(true);
+        }
+        return true;
+    }
+    if (s_resume_us == 0 || now < s_resume_us) {
+        return true;
+    }
+
+    // Polling starts over from the current frame; whatever was handed to an
+    // endpoint before the suspend goes out at its first poll.
+    s_suspended = false;
+    uint64_t frame = frame_now();
+    for (size_t i = 0; i < s_ep_count; ++i) {
+        if (s_eps[i].busy) {
+            s_eps[i].due_frame = next_poll_frame(s_eps[i], frame);
+        }
+    }
+    fprintf(stderr, "sim: host resumed the bus\n");
+    if (tud_resume_cb) {
+        tud_resume_cb();
+    }
+    return false;
+}
+
+}  // namespace
+
+extern "C" {
+
+bool tusb_init(void) {
+    s_state = UsbState::kAttached;
+    s_attach_us = time_us_64();
+    return true;
+}
+
+void tud_task(void) {
+    if (s_state == UsbState::kAttached) {
+        if (time_us_64() - s_attach_us >= static_cast<uint64_t>(g_sim.enumerate_ms) * 1000) {
+            enumerate();
+        }
+        return;
+    }
+    if (s_state != UsbState::kConfigured || update_reset() || update_suspend()) {
+        return;
+    }
+
+    // The host took each due report at its poll frame; TinyUSB reports the
+    // completions from the next tud_task(), oldest first.
+    uint64_t now = frame_now();
+    while (true) {
+        Endpoint *next = nullptr;
+        for (size_t i = 0; i < s_ep_count; ++i) {
+            Endpoint &ep = s_eps[i];
+            if (ep.busy && ep.due_frame <= now && (!next || ep.due_frame < next->due_frame)) {
+                next = &ep;
+            }
+        }
+        if (!next) {
+            return;
+        }
+        next->busy = false;
+        decode_report(*next);
+        if (tud_hid_report_complete_cb) {
+            tud_hid_report_complete_cb(static_cast<uint8_t>(next - s_eps), next->report, next->len);
+        }
+    }
+}
+
+bool tud_mounted(void) {
+    return s_state == UsbState::kConfigured;
+}
+
+bool tud_suspended(void) {
+    return s_suspended;
+}
+
+bool tud_ready(void) {
+    return tud_mounted() && !s_suspended;
+}
+
+bool tud_remote_wakeup(void) {
+    if (!s_suspended) {
+        return false;
+    }
+    if (s_resume_us == 0) {
+        fprintf(stderr, "sim: device signalled remote wakeup\n");
+        s_resume_us = time_us_64() + kResumeSignalUs;
+    }
+    return true;
+}
+
+bool tud_disconnect(void) {
+    s_state = UsbState::kDetached;
+    if (tud_umount_cb) {
+        tud_umount_cb();
+    }
+    return true;
+}
+
+bool tud_connect(void) {
+    return tusb_init();
+}
+
+uint8_t tud_hid_n_get_protocol(uint8_t /*instance*/) {
+    return HID_PROTOCOL_REPORT;
+}
+
+bool tud_hid_n_ready(uint8_t instance) {
+    return instance < s_ep_count && tud_ready() && !s_eps[instance].busy;
+}
+
+bool tud_hid_n_report(uint8_t instance, uint8_t report_id, void const *report, uint16_t len) {
+    if (!tud_hid_n_ready(instance)) {
+        return false;
+    }
+    Endpoint &ep = s_eps[instance];
+    uint16_t pos = 0;
+    if (report_id) {
+        ep.report[pos++] = report_id;
+    }
+    if (len > sizeof(ep.report) - pos) {
+        len = static_cast<uint16_t>(sizeof(ep.report) - pos);
+    }
+    if (report) {
+        memcpy(ep.report + pos, report, len);
+    } else {
+        memset(ep.report + pos, 0, len);
+    }
+    ep.len = static_cast<uint16_t>(pos + len);
+    ep.busy = true;
+    ep.due_frame = next_poll_frame(ep, frame_now());
+    return true;
+}
+
+bool tud_hid_n_keyboard_report(uint8_t instance, uint8_t report_id, uint8_t modifier, const uint8_t keycode[6]) {
+    uint8_t report[8] = {modifier, 0};
+    if (keycode) {
+        memcpy(report + 2, keycode, 6);
+    }
+    return tud_hid_n_report(instance, report_id, report, sizeof(report));
+}
+
+bool tud_hid_n_abs_mouse_report(uint8_t instance, uint8_t report_id, uint8_t buttons, int16_t x, int16_t y,
+                                int8_t vertical, int8_t horizontal) {
+    const uint8_t report[7] = {buttons,
+                               static_cast<uint8_t>(x), static_cast<uint8_t>(x >> 8),
+                               static_cast<uint8_t>(y), static_cast<uint8_t>(y >> 8),
+                               static_cast<uint8_t>(vertical), static_cast<uint8_t>(horizontal)};
+    return tud_hid_n_report(instance, report_id, report, sizeof(report));
+}
+
+}  // extern "C"
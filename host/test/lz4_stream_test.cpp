@@ -0,0 +1,160 @@
+// bad_pico_lz4_test: src/lz4_stream.c against blocks from client/lz4_block.cpp
+// and against hand-made ones, fed in pieces of every size so that tokens,
+// offsets and length bytes are split across calls. Run by ctest.
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "lz4_block.h"
+#include "lz4_stream.h"
+
+namespace {
+
+int s_failures = 0;
+
+void check(bool ok, const std::string &what) {
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s\n", what.c_str());
+        ++s_failures;
+    }
+}
+
+void collect(void *ctx, const char *data, size_t len) {
+    static_cast<std::string *>(ctx)->append(data, len);
+}
+
+struct Decoded {
+    lz4_stream_result_t result;
+    bool complete;
+    std::string out;
+};
+
+// Feeds the block in pieces of `piece` bytes, stopping at the first error.
+Decoded decode(const std::string &block, size_t piece) {
+    static lz4_stream_t s;
+    lz4_stream_init(&s);
+    Decoded d = {LZ4_STREAM_OK, false, {}};
+    for (size_t pos = 0; pos < block.size() && d.result == LZ4_STREAM_OK; pos += piece) {
+        size_t n = block.size() - pos < piece ? block.size() - pos : piece;
+        d.result = lz4_stream_feed(&s, reinterpret_cast<const uint8_t *>(block.data()) + pos, n, collect, &d.out);
+    }
+    d.complete = lz4_stream_complete(&s);
+    return d;
+}
+
+void check_round_trip(const std::string &name, const std::string &input) {
+    std::string block = lz4_block_compress(input, LZ4_STREAM_WINDOW);
+    for (size_t piece : {size_t{1}, size_t{2}, size_t{3}, size_t{7}, size_t{64}, block.size() + 1}) {
+        Decoded d = decode(block, piece);
+        std::string what = name + ", pieces of " + std::to_string(piece);
+        check(d.result == LZ4_STREAM_OK && d.complete, what + ": decodes");
+        check(d.out == input, what + ": output matches");
+    }
+}
+
+void check_decodes(const std::string &name, const std::string &block, const std::string &expected) {
+    for (size_t piece = 1; piece <= block.size(); ++piece) {
+        Decoded d = decode(block, piece);
+        std::string what = name + ", pieces of " + std::to_string(piece);
+        check(d.result == LZ4_STREAM_OK && d.complete, what + ": decodes");
+        check(d.out == expected, what + ": output matches");
+    }
+}
+
+void check_rejected(const std::string &name, const std::string &block) {
+    for (size_t piece : {size_t{1}, block.size()}) {
+        check(decode(block, piece).result == LZ4_STREAM_ERR_OFFSET, name + ": rejected");
+    }
+}
+
+// One sequence: literals, then a match of match_len (>= 4) at offset.
+std::string sequence(const std::string &literals, uint16_t offset, size_t match_len) {
+    std::string out;
+    size_t lit = literals.size();
+    size_t extra = match_len - 4;
+    out += static_cast<char>((lit < 15 ? lit : 15) << 4 | (extra < 15 ? extra : 15));
+    if (lit >= 15) {
+        for (lit -= 15; lit >= 255; lit -= 255) {
+            out += static_cast<char>(255);
+        }
+        out += static_cast<char>(lit);
+    }
+    out += literals;
+    out += static_cast<char>(offset & 0xff);
+    out += static_cast<char>(offset >> 8);
+    if (extra >= 15) {
+        for (extra -= 15; extra >= 255; extra -= 255) {
+            out += static_cast<char>(255);
+        }
+        out += static_cast<char>(extra);
+    }
+    return out;
+}
+
+std::string last_literals(const std::string &literals) {
+    return std::string(1, static_cast<char>(literals.size() << 4)) + literals;
+}
+
+std::string filler(size_t len, uint32_t seed) {
+    std::string out;
+    for (size_t i = 0; i < len; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        out += static_cast<char>('a' + (seed >> 16) % 26);
+    }
+    return out;
+}
+
+}  // namespace
+
+int main() {
+    // Compressor output, as sent by bad_pico_send --lz4.
+    check_round_trip("empty", "");
+    check_round_trip("short", "hello");
+    check_round_trip("text", "Hello, world!\nHello, world!\nHello again, world!\n<ctrl+c><ctrl+v>\n");
+    check_round_trip("run", std::string(5000, 'x'));
+    check_round_trip("random", filler(3000, 1));
+    std::string repeated;
+    for (int i = 0; i < 40; ++i) {
+        repeated += "<repeat:" + std::to_string(i) + "><tab></repeat> line " + std::to_string(i % 7) + "\n";
+    }
+    check_round_trip("lines", repeated);
+    // Repeats exactly one window back, and just beyond it: the compressor
+    // must use the first and skip the second.
+    std::string block_a = filler(LZ4_STREAM_WINDOW, 2);
+    check_round_trip("window apart", block_a + block_a + block_a);
+    std::string block_b = filler(LZ4_STREAM_WINDOW + 1, 3);
+    check_round_trip("beyond the window", block_b + block_b);
+
+    // Overlapping matches: offset smaller than the length repeats a pattern.
+    check_decodes("offset 1", sequence("a", 1, 20) + last_literals("end"), "a" + std::string(20, 'a') + "end");
+    check_decodes("offset 2", sequence("ab", 2, 9) + last_literals(""), "ab" + std::string("ababababa"));
+    check_decodes("long lengths", sequence(std::string(300, 'q'), 3, 600) + last_literals("!"),
+                  std::string(900, 'q') + "!");
+
+    // A match that runs over the end of the ring, so the decoder hands out
+    // its output in two pieces, and one that reaches back across it.
+    std::string head = filler(1000, 4);
+    std::string expected = head + head.substr(0, 500);
+    expected += expected.substr(expected.size() - LZ4_STREAM_WINDOW, 100);
+    check_decodes("wrap", sequence(head, 1000, 500) + sequence("", LZ4_STREAM_WINDOW, 100) + last_literals("x"),
+                  expected + "x");
+
+    // Offsets the decoder has no history for.
+    check_rejected("offset 0", sequence("abcd", 0, 4) + last_literals(""));
+    check_rejected("offset before the start", sequence("abcd", 5, 4) + last_literals(""));
+    check_rejected("offset beyond the window",
+                   sequence(filler(LZ4_STREAM_WINDOW + 10, 5), LZ4_STREAM_WINDOW + 1, 4) + last_literals(""));
+
+    // A block cut off in the middle of a sequence is not complete.
+    std::string cut = sequence("abcd", 4, 8);
+    check(!decode(cut.substr(0, cut.size() - 1), 1).complete, "truncated: not complete");
+
+    if (s_failures > 0) {
+        fprintf(stderr, "%d check(s) failed\n", s_failures);
+        return 1;
+    }
+    printf("lz4_stream: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,163 @@
+#!/usr/bin/env python3
+# End-to-end checks against bad_pico_sim, run by ctest (see host/CMakeLists.txt):
+#
+#   sim_test.py path/to/bad_pico_sim CASE
+#
+# Starts the simulator on a free port, plays the case's steps over the REPL
+# and compares what the simulated host decoded on stdout. A step either sends
+# a line or waits for a line from the REPL matching a regular expression.
+# Waits consume everything up to their match, so a series of waits also
+# checks the order the firmware sent things in.
+
+import re
+import socket
+import subprocess
+import sys
+import threading
+import time
+
+TIMEOUT_S = 10
+
+
+def send(line):
+    return ("send", line)
+
+
+def expect(pattern):
+    return ("expect", pattern)
+
+
+CASES = {
+    "plain": {
+        "steps": [send("Hello, world!"), expect(r"#1 done \d+ms$")],
+        "typed": "Hello, world!",
+    },
+    "repeat": {
+        "steps": [send("a<repeat:3>bc</repeat>d"), expect(r"#1 done \d+ms$")],
+        "typed": "abcbcbcd",
+    },
+    "macro": {
+        "steps": [
+            send("!def sig Best regards,<enter>Jane"),
+            expect(r"macro sig defined"),
+            send("<<sig>>"),
+            expect(r"#1 done \d+ms$"),
+        ],
+        "typed": "Best regards,\nJane",
+    },
+    "unicode": {
+        "args": ["--unicode", "linux"],
+        "steps": [
+            send("!unicode linux"),
+            expect(r"unicode: linux"),
+            send("café €"),
+            expect(r"#1 done \d+ms$"),
+        ],
+        "typed": "café €",
+    },
+    # The unknown tag is skipped. Its message belongs to line 1 and comes
+    # between the line's records.
+    "bad_tag": {
+        "steps": [
+            send("a<foo>b"),
+            expect(r"#1 started$"),
+            expect(r"#1 err 1@1: unknown key: foo$"),
+            expect(r"#1 done \d+ms err 1@1$"),
+            send("ok"),
+            expect(r"#2 done \d+ms$"),
+        ],
+        "typed": "abok",
+    },
+    # Typed slowly enough to be caught mid-line; the next line is unaffected.
+    "abort": {
+        "steps": [
+            send("!pace 20"),
+            expect(r"pace: 20 reports/s"),
+            send("abcdefghijklmnopqrstuvwxyz"),
+            expect(r"#1 started$"),
+            send("!abort"),
+            expect(r"#1 aborted \d+ms$"),
+            send("!pace off"),
+            expect(r"pace: off"),
+            send("xyz"),
+            expect(r"#2 done \d+ms$"),
+        ],
+        "typed": re.compile(r"a[b-y]*xyz"),
+    },
+}
+
+
+class Repl:
+    def __init__(self, port):
+        self.sock = socket.create_connection(("127.0.0.1", port), timeout=TIMEOUT_S)
+        self.buf = b""
+
+    def send(self, line):
+        self.sock.sendall(line.encode() + b"\n")
+
+    def expect(self, pattern):
+        deadline = time.monotonic() + TIMEOUT_S
+        regex = re.compile(pattern)
+        while True:
+            while b"\n" in self.buf:
+                raw, self.buf = self.buf.split(b"\n", 1)
+                # Replies follow the prompt on the same line.
+                line = raw.decode(errors="replace").rstrip("\r").lstrip("> ")
+                print("  < " + line)
+                if regex.search(line):
+                    return
+            if time.monotonic() > deadline:
+                raise AssertionError("timed out waiting for /%s/" % pattern)
+            data = self.sock.recv(4096)
+            if not data:
+                raise AssertionError("connection closed waiting for /%s/" % pattern)
+            self.buf += data
+
+
+def run(sim, case):
+    spec = CASES[case]
+    cmd = [sim, "--port", "0", "--once", "--linger", "300"] + spec.get("args", [])
+    proc = subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    try:
+        port = None
+        for raw in proc.stderr:
+            match = re.search(rb"sim: REPL on 127\.0\.0\.1:(\d+)", raw)
+            if match:
+                port = int(match.group(1))
+                break
+        if port is None:
+            raise AssertionError("simulator exited before listening")
+        # Keep draining the log, so the simulator never blocks on it.
+        threading.Thread(target=proc.stderr.read, daemon=True).start()
+
+        repl = Repl(port)
+        for kind, arg in spec["steps"]:
+            print(("> " if kind == "send" else "? ") + arg)
+            getattr(repl, kind)(arg)
+        repl.sock.close()
+
+        typed = proc.stdout.read().decode()
+        proc.wait(timeout=TIMEOUT_S)
+    finally:
+        if proc.poll() is None:
+            proc.kill()
+
+    expected = spec["typed"]
+    ok = expected.fullmatch(typed) if hasattr(expected, "fullmatch") else typed == expected
+    if not ok:
+        raise AssertionError("typed %r, expected %r" % (typed, getattr(expected, "pattern", expected)))
+    if proc.returncode != 0:
+        raise AssertionError("simulator exited with %d" % proc.returncode)
+
+
+def main():
+    if len(sys.argv) != 3 or sys.argv[2] not in CASES:
+        sys.exit("usage: sim_test.py BAD_PICO_SIM {%s}" % ",".join(CASES))
+    try:
+        run(sys.argv[1], sys.argv[2])
+    except AssertionError as e:
+        sys.exit("FAIL: %s" % e)
+
+
+if __name__ == "__main__":
+    main()
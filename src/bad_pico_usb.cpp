@@ -1,8 +1,7 @@
-#include <array>
-#include <cctype>
 #include <cstdint>
-#include <cstring>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 #include "bsp/board.h"
 #include "pico/stdlib.h"
@@ -10,396 +9,1267 @@
 #include "pico/util/queue.h"
 #include "tusb.h"
 
+#include "boot_log.h"
+#include "flash_store.h"
+#include "hid_keyboards.h"
+#include "host_fingerprint.h"
+#include "macro_table.h"
+#include "metrics_log.h"
+#include "payload.h"
+#include "program_cache.h"
+#include "report_pacer.h"
+#include "scheduler.h"
+#include "stack_watch.h"
 #include "wifi_repl.h"
 
 namespace {
 
-constexpr uint8_t kReportId = 0;
-constexpr size_t kTagMaxLen = 64;
-
 struct TextMessage {
+    uint16_t id;    // 0 for lines that did not come from a client (jobs, autorun)
     char text[WIFI_REPL_LINE_MAX];
 };
 
-struct ErrorMessage {
+struct ReplyMessage {
     char text[WIFI_REPL_LINE_MAX];
 };
 
-static queue_t s_text_queue;
-static queue_t s_error_queue;
+// Commands that must not wait behind queued text. They travel on their own
+// queue, which core 0 drains between every report it sends.
+enum class ControlCommand : uint8_t {
+    kAbort,
+    kStatus,
+    kStats,
+    kPace,      // arg: reports/s, 0 for off, kPaceQuery to only show it
+    kJitter,
+    kCache,     // arg: 1 to clear the cache first
+    kWake,      // arg: 1 on, 0 off, kWakeQuery to only show it
+    kSettle,    // arg: ms, kSettleQuery to only show it
+    kUnicode,   // arg: UnicodeMode, kUnicodeQuery to only show it
+    kOs,        // arg: host_os_t, HOST_OS_UNKNOWN for the guess, kOsQuery to only show it
+    kScreen,    // arg: width << 16 | height in pixels, kScreenQuery to only show it
+};
 
-struct KeyName {
+constexpr uint32_t kPaceQuery = UINT32_MAX;
+constexpr uint32_t kWakeQuery = UINT32_MAX;
+constexpr uint32_t kSettleQuery = UINT32_MAX;
+constexpr uint32_t kUnicodeQuery = UINT32_MAX;
+constexpr uint32_t kOsQuery = UINT32_MAX;
+constexpr uint32_t kScreenQuery = UINT32_MAX;
+
+struct UnicodeModeName {
     const char *name;
-    uint8_t keycode;
-    uint8_t modifier;
+    const char *how;
 };
 
-static constexpr KeyName key_names[] = {
-    // Modifiers (keycode 0 = modifier-only)
-    {"ctrl",        0, KEYBOARD_MODIFIER_LEFTCTRL},
-    {"control",     0, KEYBOARD_MODIFIER_LEFTCTRL},
-    {"alt",         0, KEYBOARD_MODIFIER_LEFTALT},
-    {"shift",       0, KEYBOARD_MODIFIER_LEFTSHIFT},
-    {"super",       0, KEYBOARD_MODIFIER_LEFTGUI},
-    {"win",         0, KEYBOARD_MODIFIER_LEFTGUI},
-    {"gui",         0, KEYBOARD_MODIFIER_LEFTGUI},
-    {"cmd",         0, KEYBOARD_MODIFIER_LEFTGUI},
-
-    // Special keys
-    {"enter",       HID_KEY_ENTER,        0},
-    {"return",      HID_KEY_ENTER,        0},
-    {"tab",         HID_KEY_TAB,          0},
-    {"esc",         HID_KEY_ESCAPE,       0},
-    {"escape",      HID_KEY_ESCAPE,       0},
-    {"backspace",   HID_KEY_BACKSPACE,    0},
-    {"delete",      HID_KEY_DELETE,       0},
-    {"del",         HID_KEY_DELETE,       0},
-    {"space",       HID_KEY_SPACE,        0},
-
-    // Arrow keys
-    {"up",          HID_KEY_ARROW_UP,     0},
-    {"down",        HID_KEY_ARROW_DOWN,   0},
-    {"left",        HID_KEY_ARROW_LEFT,   0},
-    {"right",       HID_KEY_ARROW_RIGHT,  0},
-
-    // Navigation
-    {"home",        HID_KEY_HOME,         0},
-    {"end",         HID_KEY_END,          0},
-    {"pageup",      HID_KEY_PAGE_UP,      0},
-    {"pagedown",    HID_KEY_PAGE_DOWN,    0},
-    {"insert",      HID_KEY_INSERT,       0},
-    {"capslock",    HID_KEY_CAPS_LOCK,    0},
-    {"printscreen", HID_KEY_PRINT_SCREEN, 0},
-
-    // Function keys
-    {"f1",  HID_KEY_F1,  0},
-    {"f2",  HID_KEY_F2,  0},
-    {"f3",  HID_KEY_F3,  0},
-    {"f4",  HID_KEY_F4,  0},
-    {"f5",  HID_KEY_F5,  0},
-    {"f6",  HID_KEY_F6,  0},
-    {"f7",  HID_KEY_F7,  0},
-    {"f8",  HID_KEY_F8,  0},
-    {"f9",  HID_KEY_F9,  0},
-    {"f10", HID_KEY_F10, 0},
-    {"f11", HID_KEY_F11, 0},
-    {"f12", HID_KEY_F12, 0},
+// Indexed by UnicodeMode
+static constexpr UnicodeModeName kUnicodeModeNames[kUnicodeModeCount] = {
+    {"off",     "characters without a key are errors"},
+    {"linux",   "Ctrl+Shift+U, hex code, Space"},
+    {"windows", "Alt + decimal code on the keypad"},
+    {"mac",     "Option + hex code, needs the Unicode Hex Input source"},
 };
 
-static constexpr size_t kKeyNameCount = sizeof(key_names) / sizeof(key_names[0]);
+// What is set up for each host OS, from the enumeration fingerprint or !os.
+struct HostProfile {
+    uint32_t pace;          // reports/s, 0 for off
+    UnicodeMode unicode;
+    uint8_t primary;        // what <primary> stands for
+};
 
-struct Macro {
-    const char *name;
-    const char *expansion;
+// Indexed by host_os_t. An unknown host keeps whatever is set. macOS starts
+// out paced at a conservative rate; !pace changes it for the session.
+static constexpr HostProfile kHostProfiles[HOST_OS_COUNT] = {
+    {0,   UnicodeMode::kNone,    KEYBOARD_MODIFIER_LEFTCTRL},
+    {0,   UnicodeMode::kWindows, KEYBOARD_MODIFIER_LEFTCTRL},
+    {0,   UnicodeMode::kLinux,   KEYBOARD_MODIFIER_LEFTCTRL},
+    {250, UnicodeMode::kMac,     KEYBOARD_MODIFIER_LEFTGUI},
+};
+
+// Compile errors go to the client as wifi_repl_error_t events. Those of one
+// line are collected while it compiles, one event per error code, and sent
+// once it is compiled. A token bucket limits how many go out over time, so a
+// script full of mistakes cannot fill the queue; what is held back is counted
+// and announced with the next event that is sent.
+constexpr size_t kErrorEventsPerLine = 4;
+constexpr uint32_t kErrorEventBurst = 8;
+constexpr uint32_t kErrorEventIntervalMs = 100;     // one more event every 100 ms
+
+struct ErrorEvents {
+    wifi_repl_error_t line[kErrorEventsPerLine];
+    size_t count;
+    uint32_t left_out;      // errors of the line with a code beyond the first few
+    uint32_t tokens;
+    absolute_time_t refilled;
+    uint32_t unreported;    // errors held back since the last event sent
+};
+
+struct ControlMessage {
+    ControlCommand command;
+    uint32_t arg;
+};
+
+struct Stats {
+    uint32_t lines;
+    uint32_t reports;
+    uint32_t aborts;
+    uint32_t resumes;       // lines picked up again after a bus reset
+    uint32_t errors_suppressed;
 };
 
-static constexpr Macro macros[] = {
-    {"selectall",    "<ctrl+a>"},
-    {"copyall",      "<ctrl+a><ctrl+c>"},
-    {"paste",        "<ctrl+v>"},
-    {"hello",        "Hello, World!<enter>"},
-    {"slack",        "<cmd+space>slack<sleep:1><enter>"},
-    {"s:vie",        "<cmd+k>office-vie<enter>"},
-    {"s:general",    "<cmd+k>general<enter>"},
-    {"s:cake",       "CAKE! I'll bring cake for everyone! @cakekeepersvie<ctrl+enter><enter>"},
-    {"autocake",     "<<slack>><<s:vie>><<s:cake>><<s:general>>"},
+static queue_t s_text_queue;
+static queue_t s_reply_queue;
+static queue_t s_control_queue;
+static queue_t s_record_queue;    // wifi_repl_record_t: result records and errors
+
+// Core 0 state
+static Stats s_stats;
+static bool s_abort = false;
+static const PayloadCursor *s_cursor = nullptr;
+static host_os_t s_os_override = HOST_OS_UNKNOWN;  // !os, for this session
+static host_os_t s_profile_os = HOST_OS_UNKNOWN;   // whose profile is applied
+
+// First error of the line being typed, for its result record
+struct LineResult {
+    PayloadError error;
+    uint16_t error_offset;
+    uint16_t error_count;
 };
+static LineResult s_line_result;
+static ErrorEvents s_errors;
 
-static constexpr size_t kMacroCount = sizeof(macros) / sizeof(macros[0]);
+// Written by core 1 only
+static volatile uint32_t s_lines_dropped = 0;
 
-bool char_to_key(char c, uint8_t &keycode, uint8_t &modifier) {
-    modifier = 0;
+// Written by core 0 only: a line is being compiled or typed
+static volatile bool s_typing = false;
+
+void post_line_event(uint16_t id, wifi_repl_line_state_t state, uint32_t duration_ms) {
+    if (id == 0) {
+        return;
+    }
+    wifi_repl_record_t rec{};
+    rec.kind = WIFI_REPL_RECORD_EVENT;
+    wifi_repl_event_t &ev = rec.event;
+    ev.id = id;
+    ev.state = static_cast<uint8_t>(state);
+    if (state == WIFI_REPL_LINE_DONE || state == WIFI_REPL_LINE_ABORTED) {
+        ev.error = static_cast<uint8_t>(s_line_result.error);
+        ev.error_offset = s_line_result.error_offset;
+        ev.error_count = s_line_result.error_count;
+        ev.duration_ms = duration_ms;
+    }
+    if (!queue_try_add(&s_record_queue, &rec)) {
+        metrics_add(METRICS_QUEUE_OVERFLOWS, 1);
+    }
+}
 
-    if (c >= 'a' && c <= 'z') {
-        keycode = HID_KEY_A + (c - 'a');
-        return true;
+void send_reply(const char *text) {
+    ReplyMessage msg{};
+    strncpy(msg.text, text, sizeof(msg.text) - 1);
+    if (!queue_try_add(&s_reply_queue, &msg)) {
+        metrics_add(METRICS_QUEUE_OVERFLOWS, 1);
     }
+}
 
-    if (c >= 'A' && c <= 'Z') {
-        keycode = HID_KEY_A + (c - 'A');
-        modifier = KEYBOARD_MODIFIER_LEFTSHIFT;
-        return true;
+static uint32_t s_macro_errors = 0;
+
+void count_macro_error(PayloadError /*code*/, size_t /*offset*/, const char * /*fmt*/, const char * /*arg*/) {
+    ++s_macro_errors;
+}
+
+const uint8_t *compile_macro(const char *source, size_t &code_len) {
+    static Program prog;
+    s_macro_errors = 0;
+    if (!payload_compile(source, prog, count_macro_error) || s_macro_errors > 0) {
+        return nullptr;
     }
+    code_len = prog.len;
+    return prog.code;
+}
 
-    if (c == ' ') {
-        keycode = HID_KEY_SPACE;
-        return true;
+// Runtime macros hold code compiled against the settings of the moment
+// (primary modifier, Unicode mode, screen size); build them again whenever
+// one of those changes. Core 0 only.
+void recompile_macros() {
+    size_t failed = macro_table_recompile(compile_macro);
+    if (failed > 0) {
+        printf("macros: %u no longer compile, kept their old code\n", static_cast<unsigned>(failed));
     }
+}
 
-    if (c >= '0' && c <= '9') {
-        keycode = HID_KEY_0 + (c - '0');
-        return true;
+host_os_t current_os() {
+    return s_os_override != HOST_OS_UNKNOWN ? s_os_override : fingerprint_guess(nullptr);
+}
+
+// Sets up the profile of the host once it is known, and again if !os or a
+// new enumeration changes it. Only called between lines, so a line is typed
+// with one profile throughout.
+void update_host_profile() {
+    host_os_t os = current_os();
+    if (os == HOST_OS_UNKNOWN || os == s_profile_os) {
+        return;
     }
+    s_profile_os = os;
+    const HostProfile &profile = kHostProfiles[os];
+    pacer_set_rate(profile.pace);
+    payload_set_unicode_mode(profile.unicode);
+    payload_set_primary_modifier(profile.primary);
+    recompile_macros();
+    program_cache_clear();
+    printf("host: %s profile\n", host_os_name(os));
+}
 
-    switch (c) {
-        case '.': keycode = HID_KEY_PERIOD;    return true;
-        case ',': keycode = HID_KEY_COMMA;     return true;
-        case '-': keycode = HID_KEY_MINUS;     return true;
-        case '=': keycode = HID_KEY_EQUAL;     return true;
-        case '/': keycode = HID_KEY_SLASH;     return true;
-        case ';': keycode = HID_KEY_SEMICOLON; return true;
-        case '\'': keycode = HID_KEY_APOSTROPHE; return true;
-        case '[': keycode = HID_KEY_BRACKET_LEFT;  return true;
-        case ']': keycode = HID_KEY_BRACKET_RIGHT; return true;
-        case '\\': keycode = HID_KEY_BACKSLASH; return true;
-        case '`': keycode = HID_KEY_GRAVE;     return true;
-        case '@': keycode = HID_KEY_2; modifier = KEYBOARD_MODIFIER_LEFTSHIFT; return true;
-        case '\t': keycode = HID_KEY_TAB;      return true;
-        case '\n': keycode = HID_KEY_ENTER;    return true;
-        default: break;
+void reply_os() {
+    char buf[WIFI_REPL_LINE_MAX];
+    int scores[HOST_OS_COUNT];
+    host_os_t guess = fingerprint_guess(scores);
+    if (s_os_override != HOST_OS_UNKNOWN) {
+        snprintf(buf, sizeof(buf), "os: %s, set by !os; guess %s\r\n",
+                 host_os_name(s_os_override), host_os_name(guess));
+    } else {
+        snprintf(buf, sizeof(buf), "os: %s, %s guess\r\n", host_os_name(guess),
+                 fingerprint_final() ? "final" : "early");
     }
+    send_reply(buf);
 
-    return false;
+    char rules[96];
+    fingerprint_format_rules(rules, sizeof(rules));
+    snprintf(buf, sizeof(buf), "os: scores windows %d, linux %d, macos %d; matched %s\r\n",
+             scores[HOST_OS_WINDOWS], scores[HOST_OS_LINUX], scores[HOST_OS_MACOS], rules);
+    send_reply(buf);
+
+    char trace[WIFI_REPL_LINE_MAX - 16];
+    fingerprint_format_trace(trace, sizeof(trace));
+    snprintf(buf, sizeof(buf), "os: trace %s\r\n", trace);
+    send_reply(buf);
 }
 
-void send_combo(uint8_t modifier, uint8_t keycode) {
-    while (!tud_hid_ready()) {
-        tud_task();
-        sleep_ms(2);
+void handle_control(const ControlMessage &ctl) {
+    char buf[WIFI_REPL_LINE_MAX];
+    switch (ctl.command) {
+        case ControlCommand::kAbort: {
+            unsigned dropped = 0;
+            TextMessage msg;
+            while (queue_try_remove(&s_text_queue, &msg)) {
+                post_line_event(msg.id, WIFI_REPL_LINE_ABORTED, 0);
+                ++dropped;
+            }
+            if (s_cursor) {
+                s_abort = true;
+                ++s_stats.aborts;
+            }
+            snprintf(buf, sizeof(buf), "aborted%s, %u queued line(s) dropped\r\n",
+                     s_cursor ? " current line" : "", dropped);
+            send_reply(buf);
+            break;
+        }
+
+        case ControlCommand::kStatus: {
+            const char *usb = tud_suspended() ? ", USB suspended" : "";
+            if (s_cursor) {
+                snprintf(buf, sizeof(buf), "status: typing, at byte %u/%u of program, %u line(s) queued%s\r\n",
+                         static_cast<unsigned>(s_cursor->pc),
+                         static_cast<unsigned>(s_cursor->prog->len),
+                         static_cast<unsigned>(queue_get_level(&s_text_queue)), usb);
+            } else {
+                snprintf(buf, sizeof(buf), "status: idle, %u line(s) queued%s\r\n",
+                         static_cast<unsigned>(queue_get_level(&s_text_queue)), usb);
+            }
+            send_reply(buf);
+            break;
+        }
+
+        case ControlCommand::kStats: {
+            KeyboardsUsbStats usb;
+            keyboards_usb_stats(usb);
+            snprintf(buf, sizeof(buf), "stats: %lu lines, %lu reports, %lu aborts, %lu dropped, "
+                     "%lu bus resets, %lu resumes, %lu controls dropped, %lu errors suppressed, host %s%s\r\n",
+                     static_cast<unsigned long>(s_stats.lines),
+                     static_cast<unsigned long>(s_stats.reports),
+                     static_cast<unsigned long>(s_stats.aborts),
+                     static_cast<unsigned long>(s_lines_dropped),
+                     static_cast<unsigned long>(usb.resets),
+                     static_cast<unsigned long>(s_stats.resumes),
+                     static_cast<unsigned long>(usb.controls_dropped),
+                     static_cast<unsigned long>(s_stats.errors_suppressed),
+                     host_os_name(current_os()), s_os_override != HOST_OS_UNKNOWN ? " (set)" : "");
+            send_reply(buf);
+            break;
+        }
+
+        case ControlCommand::kPace: {
+            if (ctl.arg != kPaceQuery) {
+                pacer_set_rate(ctl.arg);
+            }
+            PacerStats st;
+            pacer_stats(st);
+            if (st.rate == 0) {
+                snprintf(buf, sizeof(buf), "pace: off\r\n");
+            } else {
+                snprintf(buf, sizeof(buf), "pace: %lu reports/s\r\n", static_cast<unsigned long>(st.rate));
+            }
+            send_reply(buf);
+            break;
+        }
+
+        case ControlCommand::kCache: {
+            if (ctl.arg) {
+                program_cache_clear();
+            }
+            ProgramCacheStats st;
+            program_cache_stats(st);
+            uint32_t lookups = st.hits + st.misses;
+            snprintf(buf, sizeof(buf), "cache: %lu hits, %lu misses (%lu%% hit), %lu evictions, %u/%u entries\r\n",
+                     static_cast<unsigned long>(st.hits), static_cast<unsigned long>(st.misses),
+                     static_cast<unsigned long>(lookups ? 100ull * st.hits / lookups : 0),
+                     static_cast<unsigned long>(st.evictions), static_cast<unsigned>(st.used),
+                     static_cast<unsigned>(kProgramCacheEntries));
+            send_reply(buf);
+            break;
+        }
+
+        case ControlCommand::kWake: {
+            if (ctl.arg != kWakeQuery) {
+                keyboards_set_remote_wakeup(ctl.arg != 0);
+            }
+            KeyboardsUsbStats st;
+            keyboards_usb_stats(st);
+            snprintf(buf, sizeof(buf), "wake: %s, host %s it; %s, %lu suspends, %lu wakeups sent\r\n",
+                     keyboards_remote_wakeup() ? "on" : "off",
+                     st.host_allows_wakeup ? "allows" : "does not allow",
+                     st.suspended ? "suspended" : "awake",
+                     static_cast<unsigned long>(st.suspends), static_cast<unsigned long>(st.wakeups));
+            send_reply(buf);
+            break;
+        }
+
+        case ControlCommand::kSettle:
+            if (ctl.arg != kSettleQuery) {
+                keyboards_set_settle_ms(ctl.arg);
+            }
+            snprintf(buf, sizeof(buf), "settle: %lu ms after the host configures the keyboard again\r\n",
+                     static_cast<unsigned long>(keyboards_settle_ms()));
+            send_reply(buf);
+            break;
+
+        case ControlCommand::kUnicode: {
+            if (ctl.arg != kUnicodeQuery) {
+                payload_set_unicode_mode(static_cast<UnicodeMode>(ctl.arg));
+                // Macros and cached programs typed their characters the old way.
+                recompile_macros();
+                program_cache_clear();
+            }
+            const UnicodeModeName &mode = kUnicodeModeNames[static_cast<size_t>(payload_unicode_mode())];
+            snprintf(buf, sizeof(buf), "unicode: %s (%s)\r\n", mode.name, mode.how);
+            send_reply(buf);
+            break;
+        }
+
+        case ControlCommand::kScreen: {
+            if (ctl.arg != kScreenQuery) {
+                payload_set_screen(static_cast<uint16_t>(ctl.arg >> 16), static_cast<uint16_t>(ctl.arg));
+                // Macros and cached programs have their positions scaled to the old size.
+                recompile_macros();
+                program_cache_clear();
+            }
+            uint16_t width, height;
+            payload_screen(width, height);
+            snprintf(buf, sizeof(buf), "screen: %ux%u pixels\r\n", width, height);
+            send_reply(buf);
+            break;
+        }
+
+        case ControlCommand::kOs:
+            if (ctl.arg != kOsQuery) {
+                s_os_override = static_cast<host_os_t>(ctl.arg);
+                s_profile_os = HOST_OS_UNKNOWN;     // set the profile up again
+            }
+            reply_os();
+            break;
+
+        case ControlCommand::kJitter: {
+            PacerStats st;
+            pacer_stats(st);
+            if (st.rate == 0) {
+                send_reply("jitter: pacing off, see !pace\r\n");
+                break;
+            }
+            if (st.reports == 0) {
+                snprintf(buf, sizeof(buf), "jitter: no reports at %lu/s yet\r\n", static_cast<unsigned long>(st.rate));
+                send_reply(buf);
+                break;
+            }
+            snprintf(buf, sizeof(buf), "jitter: %lu reports at %lu/s, late min/avg/max %lu/%lu/%lu us, %lu slots skipped\r\n",
+                     static_cast<unsigned long>(st.reports), static_cast<unsigned long>(st.rate),
+                     static_cast<unsigned long>(st.late_min_us),
+                     static_cast<unsigned long>(st.late_total_us / st.reports),
+                     static_cast<unsigned long>(st.late_max_us), static_cast<unsigned long>(st.skipped));
+            send_reply(buf);
+            if (st.intervals > 0) {
+                snprintf(buf, sizeof(buf), "jitter: host spacing min/avg/max %lu/%lu/%lu us over %lu intervals\r\n",
+                         static_cast<unsigned long>(st.interval_min_us),
+                         static_cast<unsigned long>(st.interval_total_us / st.intervals),
+                         static_cast<unsigned long>(st.interval_max_us), static_cast<unsigned long>(st.intervals));
+                send_reply(buf);
+            }
+            break;
+        }
     }
+}
 
-    std::array<uint8_t, 6> keys{};
-    if (keycode) {
-        keys[0] = keycode;
+void poll_control() {
+    ControlMessage ctl;
+    while (queue_try_remove(&s_control_queue, &ctl)) {
+        handle_control(ctl);
     }
+}
 
-    tud_hid_keyboard_report(kReportId, modifier, keys.data());
+// Idle callback for every wait on the keyboards: a stalled or sleeping host
+// must not keep !abort from ending the line.
+bool poll_abort() {
+    poll_control();
+    return s_abort;
+}
 
-    while (!tud_hid_ready()) {
-        tud_task();
-        sleep_ms(2);
+// The release goes out on its own once the host has taken the press, while
+// the next key may already go down on another keyboard.
+KeyboardsResult send_combo(uint8_t modifier, uint8_t keycode) {
+    KeyboardsResult result = keyboards_press(modifier, keycode, poll_abort);
+    if (result == KeyboardsResult::kDone) {
+        boot_mark(BOOT_FIRST_REPORT);
+        s_stats.reports += 2;
     }
+    return result;
+}
 
-    tud_hid_keyboard_report(kReportId, 0, nullptr);
-    sleep_ms(5);
+// Media, volume and power keys travel in the same order and pacing as keys.
+KeyboardsResult send_control(uint8_t report_id, uint16_t usage) {
+    KeyboardsResult result = keyboards_press_control(report_id, usage, poll_abort);
+    if (result == KeyboardsResult::kDone) {
+        s_stats.reports += 2;
+    }
+    return result;
 }
 
-void send_key(char c) {
-    uint8_t keycode;
-    uint8_t modifier;
-    if (!char_to_key(c, keycode, modifier)) {
-        return;
+// Pointer reports share the keys' timeline, so a click lands between the
+// keys typed around it.
+KeyboardsResult send_pointer(uint8_t buttons, uint16_t x, uint16_t y) {
+    KeyboardsResult result = keyboards_pointer(buttons, x, y, poll_abort);
+    if (result == KeyboardsResult::kDone) {
+        s_stats.reports += buttons ? 2 : 1;
     }
-    send_combo(modifier, keycode);
+    return result;
 }
 
-void report_error(const char *fmt, const char *arg) {
-    ErrorMessage err{};
-    snprintf(err.text, sizeof(err.text), fmt, arg);
-    queue_try_add(&s_error_queue, &err);
+void sleep_keep_alive(uint32_t ms) {
+    // Sleep while keeping USB alive
+    uint32_t ms_remaining = ms;
+    const uint32_t chunk_ms = 100; // Check USB every 100ms
+
+    while (ms_remaining > 0 && !s_abort) {
+        uint32_t sleep_time = (ms_remaining > chunk_ms) ? chunk_ms : ms_remaining;
+        tud_task();
+        poll_control();
+        sleep_ms(sleep_time);
+        ms_remaining -= sleep_time;
+    }
 }
 
-bool strcasecmp_const(const char *a, const char *b) {
-    while (*a && *b) {
-        if (tolower(static_cast<unsigned char>(*a)) != tolower(static_cast<unsigned char>(*b))) {
-            return false;
+void report_error(PayloadError code, size_t offset, const char *fmt, const char *arg) {
+    if (s_line_result.error_count++ == 0) {
+        s_line_result.error = code;
+        s_line_result.error_offset = static_cast<uint16_t>(offset);
+    }
+
+    for (size_t i = 0; i < s_errors.count; ++i) {
+        wifi_repl_error_t &err = s_errors.line[i];
+        if (err.code == static_cast<uint8_t>(code)) {
+            if (err.repeats < UINT16_MAX) {
+                ++err.repeats;
+            }
+            return;
         }
-        ++a;
-        ++b;
     }
-    return *a == '\0' && *b == '\0';
+    if (s_errors.count == kErrorEventsPerLine) {
+        ++s_errors.left_out;
+        return;
+    }
+    wifi_repl_error_t &err = s_errors.line[s_errors.count++];
+    err = {};
+    err.fmt = fmt;
+    err.offset = static_cast<uint16_t>(offset);
+    err.code = static_cast<uint8_t>(code);
+    strncpy(err.arg, arg, sizeof(err.arg) - 1);
 }
 
-const char *lookup_macro(const char *name) {
-    for (size_t i = 0; i < kMacroCount; ++i) {
-        if (strcasecmp_const(name, macros[i].name)) {
-            return macros[i].expansion;
+// Sends the events collected while line id compiled, as far as the token
+// bucket and the queue allow.
+void flush_error_events(uint16_t id) {
+    absolute_time_t now = get_absolute_time();
+    uint32_t refill = static_cast<uint32_t>(absolute_time_diff_us(s_errors.refilled, now) / 1000) / kErrorEventIntervalMs;
+    if (refill > 0) {
+        s_errors.tokens = s_errors.tokens + refill < kErrorEventBurst ? s_errors.tokens + refill : kErrorEventBurst;
+        s_errors.refilled = now;
+    }
+
+    for (size_t i = 0; i < s_errors.count; ++i) {
+        wifi_repl_record_t rec{};
+        rec.kind = WIFI_REPL_RECORD_ERROR;
+        wifi_repl_error_t &err = rec.error;
+        err = s_errors.line[i];
+        err.line_id = id;
+        err.unreported = static_cast<uint16_t>(s_errors.unreported < UINT16_MAX ? s_errors.unreported : UINT16_MAX);
+        if (s_errors.tokens > 0 && queue_try_add(&s_record_queue, &rec)) {
+            --s_errors.tokens;
+            s_errors.unreported = 0;
+        } else {
+            s_errors.unreported += 1 + err.repeats;
+            s_stats.errors_suppressed += 1 + err.repeats;
         }
     }
-    return nullptr;
+    s_errors.unreported += s_errors.left_out;
+    s_stats.errors_suppressed += s_errors.left_out;
+    s_errors.count = 0;
+    s_errors.left_out = 0;
 }
 
-bool lookup_key_name(const char *name, uint8_t &keycode, uint8_t &modifier) {
-    for (size_t i = 0; i < kKeyNameCount; ++i) {
-        if (strcasecmp_const(name, key_names[i].name)) {
-            keycode = key_names[i].keycode;
-            modifier = key_names[i].modifier;
-            return true;
+void run_program(const Program &prog) {
+    PayloadCursor cur;
+    payload_start(cur, prog);
+    s_cursor = &cur;
+    s_abort = false;
+    ++s_stats.lines;
+
+    // Where typing picks up again if a bus reset loses a press: just before
+    // the last key the host has not acknowledged. Only one press is ever
+    // unacknowledged, so one saved cursor is enough.
+    PayloadCursor resume = cur;
+
+    Step step;
+    while (!s_abort) {
+        PayloadCursor before = cur;
+        bool more = payload_next(cur, step);
+        KeyboardsResult result;
+        if (!more) {
+            result = keyboards_flush(poll_abort);
+        } else if (step.kind == StepKind::kKey || step.kind == StepKind::kControl) {
+            // Once this press goes out, the one before it was acknowledged.
+            result = step.kind == StepKind::kKey ? send_combo(step.modifier, step.keycode)
+                                                 : send_control(step.report_id, step.usage);
+            if (result == KeyboardsResult::kDone) {
+                resume = before;
+            }
+        } else if (step.kind == StepKind::kPointer) {
+            result = send_pointer(step.buttons, step.x, step.y);
+            if (result == KeyboardsResult::kDone) {
+                resume = before;
+            }
+        } else if (step.kind == StepKind::kHold) {
+            result = keyboards_hold(step.modifier, poll_abort);
+            if (result == KeyboardsResult::kDone) {
+                resume = cur;
+            }
+        } else {
+            // The pause starts once every key is up.
+            result = keyboards_flush(poll_abort);
+            if (result == KeyboardsResult::kDone) {
+                sleep_keep_alive(step.sleep_ms);
+                resume = cur;
+            }
         }
+        if (result == KeyboardsResult::kAborted) {
+            break;
+        }
+        if (result == KeyboardsResult::kLost) {
+            cur = resume;
+            ++s_stats.resumes;
+            continue;
+        }
+        if (!more) {
+            break;
+        }
+        poll_control();
     }
 
-    // Single character key name (e.g. "a", "z", "5")
-    if (name[0] != '\0' && name[1] == '\0') {
-        return char_to_key(name[0], keycode, modifier);
+    if (s_abort) {
+        // Also lets go of a modifier held for a Unicode input sequence. This
+        // gives up at the first wait; keyboards_task() in the main loop sends
+        // the releases once the host takes them.
+        keyboards_hold(0, poll_abort);
     }
+    s_cursor = nullptr;
+}
 
-    return false;
+void send_text(const TextMessage &msg) {
+    static Program prog;
+
+    absolute_time_t start = get_absolute_time();
+    s_typing = true;
+    s_line_result = {};
+    post_line_event(msg.id, WIFI_REPL_LINE_STARTED, 0);
+
+    // Lines sent again skip the compile; see program_cache.h for what keeps
+    // a hit from going stale.
+    uint32_t generation = macro_table_generation();
+    if (const Program *cached = program_cache_find(msg.text, generation)) {
+        run_program(*cached);
+    } else {
+        bool fits = payload_compile(msg.text, prog, report_error);
+        flush_error_events(msg.id);
+        if (fits) {
+            if (s_line_result.error_count == 0) {
+                program_cache_store(msg.text, generation, prog);
+            }
+            run_program(prog);
+        }
+    }
+
+    uint32_t duration_ms = static_cast<uint32_t>(absolute_time_diff_us(start, get_absolute_time()) / 1000);
+    post_line_event(msg.id, s_abort ? WIFI_REPL_LINE_ABORTED : WIFI_REPL_LINE_DONE, duration_ms);
+    s_typing = false;
+}
+
+// Core 0's share of the counters in the metrics log.
+void publish_metrics() {
+    KeyboardsUsbStats usb;
+    keyboards_usb_stats(usb);
+    metrics_set(METRICS_LINES, s_stats.lines);
+    metrics_set(METRICS_REPORTS, s_stats.reports);
+    metrics_set(METRICS_ERRORS_SUPPRESSED, s_stats.errors_suppressed);
+    metrics_set(METRICS_USB_RESETS, usb.resets);
+    metrics_set(METRICS_PRESSES_LOST, usb.presses_lost);
+}
+
+// REPL command handlers run on core 1, inside the line callback.
+
+void post_control(ControlCommand command, uint32_t arg = 0) {
+    ControlMessage ctl{command, arg};
+    if (!queue_try_add(&s_control_queue, &ctl)) {
+        wifi_repl_write("busy: control queue full\r\n");
+    }
+}
+
+void cmd_abort(const char * /*args*/) {
+    post_control(ControlCommand::kAbort);
+}
+
+void cmd_status(const char * /*args*/) {
+    post_control(ControlCommand::kStatus);
+}
+
+void cmd_stats(const char * /*args*/) {
+    post_control(ControlCommand::kStats);
+}
+
+// !pace [<reports/s> | off]
+void cmd_pace(const char *args) {
+    if (*args == '\0') {
+        post_control(ControlCommand::kPace, kPaceQuery);
+        return;
+    }
+    if (strcmp(args, "off") == 0) {
+        post_control(ControlCommand::kPace, 0);
+        return;
+    }
+    char *endptr;
+    unsigned long rate = strtoul(args, &endptr, 10);
+    if (endptr == args || *endptr != '\0' || rate > kPaceMaxRate) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "usage: !pace [<0-%lu reports/s> | off]\r\n",
+                 static_cast<unsigned long>(kPaceMaxRate));
+        wifi_repl_write(buf);
+        return;
+    }
+    post_control(ControlCommand::kPace, static_cast<uint32_t>(rate));
+}
+
+void cmd_jitter(const char * /*args*/) {
+    post_control(ControlCommand::kJitter);
+}
+
+// !cache [clear]
+void cmd_cache(const char *args) {
+    bool clear = strcmp(args, "clear") == 0;
+    if (!clear && *args != '\0') {
+        wifi_repl_write("usage: !cache [clear]\r\n");
+        return;
+    }
+    post_control(ControlCommand::kCache, clear ? 1 : 0);
+}
+
+// Splits "<number> <text>" and validates both parts.
+bool parse_job_args(const char *args, uint64_t &number, const char *&text) {
+    char *endptr;
+    number = strtoull(args, &endptr, 10);
+    if (endptr == args || *endptr != ' ') {
+        return false;
+    }
+    text = endptr + 1;
+    return *text != '\0';
+}
+
+void schedule_job(uint64_t delay_ms, const char *text) {
+    char buf[64];
+    if (delay_ms > kMaxJobDelayMs) {
+        snprintf(buf, sizeof(buf), "schedule: delay too long (max %lu ms)\r\n",
+                 static_cast<unsigned long>(kMaxJobDelayMs));
+        wifi_repl_write(buf);
+        return;
+    }
+
+    uint32_t id = scheduler_add(static_cast<uint32_t>(delay_ms), text);
+    if (id == 0) {
+        wifi_repl_write("schedule: all job slots in use\r\n");
+        return;
+    }
+    snprintf(buf, sizeof(buf), "job %lu scheduled in %lu ms\r\n",
+             static_cast<unsigned long>(id), static_cast<unsigned long>(delay_ms));
+    wifi_repl_write(buf);
+}
+
+// !after <ms> <text>
+void cmd_after(const char *args) {
+    uint64_t delay_ms;
+    const char *text;
+    if (!parse_job_args(args, delay_ms, text)) {
+        wifi_repl_write("usage: !after <ms> <text>\r\n");
+        return;
+    }
+    schedule_job(delay_ms, text);
+}
+
+// !at <unix_ms> <text>
+void cmd_at(const char *args) {
+    uint64_t at_ms;
+    uint64_t now_ms;
+    const char *text;
+    if (!parse_job_args(args, at_ms, text)) {
+        wifi_repl_write("usage: !at <unix_ms> <text>\r\n");
+        return;
+    }
+    if (!scheduler_clock(now_ms)) {
+        wifi_repl_write("at: clock not set, use !clock <unix_ms> first\r\n");
+        return;
+    }
+    if (at_ms < now_ms) {
+        wifi_repl_write("at: time is in the past\r\n");
+        return;
+    }
+    schedule_job(at_ms - now_ms, text);
 }
 
-void send_tag(const char *tag) {
-    // Check for sleep command: <sleep:N>
-    if (strncmp(tag, "sleep:", 6) == 0) {
-        const char *seconds_str = tag + 6;
+// !clock [unix_ms]
+void cmd_clock(const char *args) {
+    char buf[64];
+    if (*args != '\0') {
         char *endptr;
-        long seconds = strtol(seconds_str, &endptr, 10);
-        
-        // Validate the number
-        if (endptr == seconds_str || *endptr != '\0') {
-            report_error("invalid sleep duration: %s\r\n", seconds_str);
-            return;
-        }
-        
-        if (seconds < 0 || seconds > 3600) {
-            char buf[32];
-            snprintf(buf, sizeof(buf), "%ld", seconds);
-            report_error("sleep duration out of range (0-3600): %s\r\n", buf);
+        uint64_t unix_ms = strtoull(args, &endptr, 10);
+        if (endptr == args || *endptr != '\0') {
+            wifi_repl_write("usage: !clock [unix_ms]\r\n");
             return;
         }
-        
-        // Sleep while keeping USB alive
-        long ms_remaining = seconds * 1000;
-        const long chunk_ms = 100; // Check USB every 100ms
-        
-        while (ms_remaining > 0) {
-            long sleep_time = (ms_remaining > chunk_ms) ? chunk_ms : ms_remaining;
-            tud_task();
-            sleep_ms(sleep_time);
-            ms_remaining -= sleep_time;
+        scheduler_set_clock(unix_ms);
+    }
+
+    uint64_t now_ms;
+    if (!scheduler_clock(now_ms)) {
+        wifi_repl_write("clock: not set\r\n");
+        return;
+    }
+    snprintf(buf, sizeof(buf), "clock: %llu\r\n", static_cast<unsigned long long>(now_ms));
+    wifi_repl_write(buf);
+}
+
+void list_job(const JobInfo &job, void *count) {
+    char buf[WIFI_REPL_LINE_MAX + 48];
+    snprintf(buf, sizeof(buf), "job %lu in %lu ms: %s\r\n",
+             static_cast<unsigned long>(job.id), static_cast<unsigned long>(job.remaining_ms), job.text);
+    wifi_repl_write(buf);
+    ++*static_cast<unsigned *>(count);
+}
+
+void cmd_jobs(const char * /*args*/) {
+    unsigned count = 0;
+    scheduler_list(list_job, &count);
+    if (count == 0) {
+        wifi_repl_write("no jobs scheduled\r\n");
+    }
+}
+
+// !cancel <id>
+void cmd_cancel(const char *args) {
+    char *endptr;
+    unsigned long id = strtoul(args, &endptr, 10);
+    if (endptr == args || *endptr != '\0') {
+        wifi_repl_write("usage: !cancel <id>\r\n");
+        return;
+    }
+    wifi_repl_write(scheduler_cancel(static_cast<uint32_t>(id)) ? "job cancelled\r\n" : "cancel: no such job\r\n");
+}
+
+void write_boot_log(void (*write)(const char *text)) {
+    char buf[64];
+    for (int i = 0; i < BOOT_PHASE_COUNT; ++i) {
+        boot_phase_t phase = static_cast<boot_phase_t>(i);
+        uint32_t us = boot_phase_us(phase);
+        if (us == 0) {
+            snprintf(buf, sizeof(buf), "boot: %-15s        -\r\n", boot_phase_name(phase));
+        } else {
+            snprintf(buf, sizeof(buf), "boot: %-15s %8.3f ms\r\n", boot_phase_name(phase), us / 1000.0);
         }
-        
+        write(buf);
+    }
+}
+
+void cmd_boot(const char * /*args*/) {
+    write_boot_log(wifi_repl_write);
+}
+
+constexpr size_t kLogShowDefault = 20;
+constexpr size_t kLogShowMax = 50;  // what fits into the TCP send buffer
+
+// !log [<n> | clear]
+void cmd_log(const char *args) {
+    if (strcmp(args, "clear") == 0) {
+        wifi_repl_write(metrics_log_clear() ? "log cleared\r\n" : "log: flash write failed\r\n");
         return;
     }
-    
-    // Parse tag content: split on '+', accumulate modifiers, last non-modifier is the key
-    char buf[kTagMaxLen];
-    strncpy(buf, tag, kTagMaxLen - 1);
-    buf[kTagMaxLen - 1] = '\0';
-
-    uint8_t combined_modifier = 0;
-    uint8_t final_keycode = 0;
-    bool has_keycode = false;
-
-    char *saveptr = nullptr;
-    char *token = strtok_r(buf, "+", &saveptr);
-    while (token) {
-        // Trim leading/trailing whitespace
-        while (*token == ' ') ++token;
-        char *end = token + strlen(token) - 1;
-        while (end > token && *end == ' ') { *end = '\0'; --end; }
-
-        uint8_t kc, mod;
-        if (!lookup_key_name(token, kc, mod)) {
-            report_error("unknown key: %s\r\n", token);
+    size_t count = kLogShowDefault;
+    if (*args != '\0') {
+        char *endptr;
+        unsigned long n = strtoul(args, &endptr, 10);
+        if (endptr == args || *endptr != '\0' || n == 0 || n > kLogShowMax) {
+            char buf[64];
+            snprintf(buf, sizeof(buf), "usage: !log [<1-%u> | clear]\r\n", static_cast<unsigned>(kLogShowMax));
+            wifi_repl_write(buf);
             return;
         }
+        count = n;
+    }
+    metrics_log_dump(count, wifi_repl_write);
+}
 
-        if (kc == 0 && mod != 0) {
-            // Pure modifier
-            combined_modifier |= mod;
-        } else {
-            if (has_keycode) {
-                report_error("multiple non-modifier keys in combo: %s\r\n", tag);
-                return;
-            }
-            combined_modifier |= mod;
-            final_keycode = kc;
-            has_keycode = true;
+// Worst-case stack use so far, to check headroom before growing the macro
+// library or nesting.
+void cmd_diag(const char * /*args*/) {
+    char buf[64];
+    for (unsigned core = 0; core < 2; ++core) {
+        snprintf(buf, sizeof(buf), "diag: core%u stack %u/%u bytes peak\r\n", core,
+                 static_cast<unsigned>(stack_watch_peak(core)), static_cast<unsigned>(stack_watch_size(core)));
+        wifi_repl_write(buf);
+    }
+    snprintf(buf, sizeof(buf), "diag: macro nesting %u/%u peak\r\n",
+             static_cast<unsigned>(payload_macro_depth_peak()), static_cast<unsigned>(kMacroMaxDepth));
+    wifi_repl_write(buf);
+}
+
+// !autorun [<text> | clear]
+void cmd_autorun(const char *args) {
+    if (strcmp(args, "clear") == 0) {
+        wifi_repl_write(flash_store_erase(FLASH_STORE_AUTORUN) ? "autorun cleared\r\n" : "autorun: flash write failed\r\n");
+        return;
+    }
+
+    if (*args != '\0') {
+        bool ok = flash_store_write(FLASH_STORE_AUTORUN, args, strlen(args));
+        wifi_repl_write(ok ? "autorun stored\r\n" : "autorun: flash write failed\r\n");
+        return;
+    }
+
+    char buf[WIFI_REPL_LINE_MAX + 16];
+    char text[WIFI_REPL_LINE_MAX];
+    int len = flash_store_read(FLASH_STORE_AUTORUN, text, sizeof(text) - 1);
+    if (len < 0) {
+        wifi_repl_write("autorun: none\r\n");
+        return;
+    }
+    text[len] = '\0';
+    snprintf(buf, sizeof(buf), "autorun: %s\r\n", text);
+    wifi_repl_write(buf);
+}
+
+static uint32_t s_def_errors = 0;
+
+void report_def_error(PayloadError /*code*/, size_t offset, const char *fmt, const char *arg) {
+    char msg[WIFI_REPL_LINE_MAX];
+    char buf[WIFI_REPL_LINE_MAX + 32];
+    snprintf(msg, sizeof(msg), fmt, arg);
+    snprintf(buf, sizeof(buf), "def: at %u: %s", static_cast<unsigned>(offset), msg);
+    wifi_repl_write(buf);
+    ++s_def_errors;
+}
+
+// !def <name> <body>: the body is compiled right away and only stored if it
+// compiles cleanly.
+void cmd_def(const char *args) {
+    const char *body = strchr(args, ' ');
+    size_t name_len = body ? static_cast<size_t>(body - args) : 0;
+    if (!body || name_len >= kMacroNameMax || body[1] == '\0') {
+        wifi_repl_write("usage: !def <name> <body>\r\n");
+        return;
+    }
+    char name[kMacroNameMax];
+    memcpy(name, args, name_len);
+    name[name_len] = '\0';
+    ++body;
+
+    static Program prog;
+    s_def_errors = 0;
+    bool fits = payload_compile(body, prog, report_def_error);
+    if (!fits || s_def_errors > 0) {
+        wifi_repl_write("def: not defined\r\n");
+        return;
+    }
+
+    char buf[64 + kMacroNameMax];
+    switch (macro_table_define(name, body, prog.code, prog.len)) {
+        case MacroDefineResult::kOk:
+            snprintf(buf, sizeof(buf), "macro %s defined, %u bytes of code\r\n", name, static_cast<unsigned>(prog.len));
+            break;
+        case MacroDefineResult::kBadName:
+            snprintf(buf, sizeof(buf), "def: invalid name: %s\r\n", name);
+            break;
+        case MacroDefineResult::kTableFull:
+            snprintf(buf, sizeof(buf), "def: all %u macro slots in use\r\n", static_cast<unsigned>(kMacroSlots));
+            break;
+        case MacroDefineResult::kNoSpace:
+            snprintf(buf, sizeof(buf), "def: out of macro memory (%u/%u bytes used)\r\n",
+                     static_cast<unsigned>(macro_table_pool_used()), static_cast<unsigned>(kMacroPoolSize));
+            break;
+    }
+    wifi_repl_write(buf);
+}
+
+static uint32_t s_dry_errors = 0;
+
+void report_dry_error(PayloadError code, size_t offset, const char *fmt, const char *arg) {
+    char msg[WIFI_REPL_LINE_MAX];
+    char buf[WIFI_REPL_LINE_MAX + 32];
+    snprintf(msg, sizeof(msg), fmt, arg);
+    snprintf(buf, sizeof(buf), "dry: err %u@%u: %s", static_cast<unsigned>(code), static_cast<unsigned>(offset), msg);
+    wifi_repl_write(buf);
+    ++s_dry_errors;
+}
+
+// !dry <text>: compiles the line like core 0 would, including macros and
+// repeats, and reports what typing it would cost instead of typing it.
+void cmd_dry(const char *args) {
+    if (*args == '\0') {
+        wifi_repl_write("usage: !dry <text>\r\n");
+        return;
+    }
+
+    static Program prog;
+    s_dry_errors = 0;
+    if (!payload_compile(args, prog, report_dry_error)) {
+        wifi_repl_write("dry: does not fit into one program\r\n");
+        return;
+    }
+    PayloadCost cost;
+    payload_cost(prog, cost);
+
+    // Every report needs a poll of some keyboard's endpoint, and under !pace
+    // a slot as well. Keys that have to wait on each other across keyboards
+    // make the real run slower than this.
+    PacerStats pace;
+    pacer_stats(pace);
+    uint64_t report_us = HID_POLL_INTERVAL_MS * 1000u / kKeyboardCount;
+    if (pace.rate != 0 && 1000000u / pace.rate > report_us) {
+        report_us = 1000000u / pace.rate;
+    }
+    uint64_t reports = cost.keys * 2 + cost.moves;
+    uint64_t estimate_ms = reports * report_us / 1000 + cost.sleep_ms;
+
+    char buf[128];
+    snprintf(buf, sizeof(buf), "dry: %llu reports, %llu ms of sleep, about %llu ms to type, %lu error(s)\r\n",
+             static_cast<unsigned long long>(reports), static_cast<unsigned long long>(cost.sleep_ms),
+             static_cast<unsigned long long>(estimate_ms), static_cast<unsigned long>(s_dry_errors));
+    wifi_repl_write(buf);
+}
+
+void cmd_undef(const char *args) {
+    wifi_repl_write(macro_table_remove(args) ? "macro removed\r\n" : "undef: no such macro\r\n");
+}
+
+void list_macro(const MacroInfo &macro, void * /*ctx*/) {
+    char buf[WIFI_REPL_LINE_MAX + kMacroNameMax + 32];
+    snprintf(buf, sizeof(buf), "macro %s (%u bytes): %.*s\r\n", macro.name, macro.code_len,
+             static_cast<int>(macro.source_len), macro.source);
+    wifi_repl_write(buf);
+}
+
+void cmd_macros(const char * /*args*/) {
+    macro_table_list(list_macro, nullptr);
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%u/%u macros, %u/%u bytes\r\n", static_cast<unsigned>(macro_table_count()),
+             static_cast<unsigned>(kMacroSlots), static_cast<unsigned>(macro_table_pool_used()),
+             static_cast<unsigned>(kMacroPoolSize));
+    wifi_repl_write(buf);
+}
+
+void cmd_save(const char * /*args*/) {
+    wifi_repl_write(macro_table_save() ? "macros saved\r\n" : "save: flash write failed\r\n");
+}
+
+// !settle [<ms>]
+void cmd_settle(const char *args) {
+    if (*args == '\0') {
+        post_control(ControlCommand::kSettle, kSettleQuery);
+        return;
+    }
+    char *endptr;
+    unsigned long ms = strtoul(args, &endptr, 10);
+    if (endptr == args || *endptr != '\0' || ms > kSettleMaxMs) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "usage: !settle [<0-%lu ms>]\r\n", static_cast<unsigned long>(kSettleMaxMs));
+        wifi_repl_write(buf);
+        return;
+    }
+    post_control(ControlCommand::kSettle, static_cast<uint32_t>(ms));
+}
+
+// !wake [on | off]
+void cmd_wake(const char *args) {
+    if (*args == '\0') {
+        post_control(ControlCommand::kWake, kWakeQuery);
+    } else if (strcmp(args, "on") == 0 || strcmp(args, "off") == 0) {
+        post_control(ControlCommand::kWake, strcmp(args, "on") == 0 ? 1 : 0);
+    } else {
+        wifi_repl_write("usage: !wake [on | off]\r\n");
+    }
+}
+
+// !unicode [off | linux | windows | mac]
+void cmd_unicode(const char *args) {
+    if (*args == '\0') {
+        post_control(ControlCommand::kUnicode, kUnicodeQuery);
+        return;
+    }
+    for (size_t i = 0; i < kUnicodeModeCount; ++i) {
+        if (strcmp(args, kUnicodeModeNames[i].name) == 0) {
+            post_control(ControlCommand::kUnicode, static_cast<uint32_t>(i));
+            return;
         }
+    }
+    wifi_repl_write("usage: !unicode [off | linux | windows | mac]\r\n");
+}
 
-        token = strtok_r(nullptr, "+", &saveptr);
+// !screen [<width>x<height>]
+void cmd_screen(const char *args) {
+    if (*args == '\0') {
+        post_control(ControlCommand::kScreen, kScreenQuery);
+        return;
+    }
+    char *endptr;
+    unsigned long width = strtoul(args, &endptr, 10);
+    bool ok = endptr != args && *endptr == 'x';
+    const char *height_str = endptr + 1;
+    unsigned long height = ok ? strtoul(height_str, &endptr, 10) : 0;
+    if (!ok || endptr == height_str || *endptr != '\0' || width < 2 || height < 2 || width > kScreenMax ||
+        height > kScreenMax) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "usage: !screen [<width>x<height>, 2-%u pixels each]\r\n", kScreenMax);
+        wifi_repl_write(buf);
+        return;
     }
+    post_control(ControlCommand::kScreen, static_cast<uint32_t>((width << 16) | height));
+}
 
-    send_combo(combined_modifier, final_keycode);
+// !os [auto | windows | linux | macos]
+void cmd_os(const char *args) {
+    if (*args == '\0') {
+        post_control(ControlCommand::kOs, kOsQuery);
+        return;
+    }
+    if (strcmp(args, "auto") == 0) {
+        post_control(ControlCommand::kOs, HOST_OS_UNKNOWN);
+        return;
+    }
+    for (uint32_t os = HOST_OS_UNKNOWN + 1; os < HOST_OS_COUNT; ++os) {
+        if (strcmp(args, host_os_name(static_cast<host_os_t>(os))) == 0) {
+            post_control(ControlCommand::kOs, os);
+            return;
+        }
+    }
+    wifi_repl_write("usage: !os [auto | windows | linux | macos]\r\n");
 }
 
-void send_text(const char *text) {
-    const char *p = text;
-    while (*p != '\0') {
-        if (*p == '\\' && *(p + 1) == '<') {
-            // Escaped '<' — send literal '<'
-            send_key('<');
-            p += 2;
-        } else if (*p == '<' && *(p + 1) == '<') {
-            // Macro start — find closing '>>'
-            const char *start = p + 2;
-            const char *end = strstr(start, ">>");
-            if (!end) {
-                // No closing '>>' — send '<' literally and re-scan
-                send_key('<');
-                ++p;
-                continue;
-            }
-            size_t len = static_cast<size_t>(end - start);
-            if (len == 0 || len >= kTagMaxLen) {
-                report_error("invalid macro: <<%.*s>>\r\n", start);
-                p = end + 2;
-                continue;
-            }
-            char macro_name[kTagMaxLen];
-            memcpy(macro_name, start, len);
-            macro_name[len] = '\0';
-            const char *expansion = lookup_macro(macro_name);
-            if (!expansion) {
-                report_error("unknown macro: %s\r\n", macro_name);
-            } else {
-                send_text(expansion);
-            }
-            p = end + 2;
-        } else if (*p == '<') {
-            // Tag start — find closing '>'
-            const char *start = p + 1;
-            const char *end = strchr(start, '>');
-            if (!end) {
-                // No closing '>' — send '<' literally
-                send_key('<');
-                ++p;
-                continue;
-            }
-            size_t len = static_cast<size_t>(end - start);
-            if (len == 0 || len >= kTagMaxLen) {
-                report_error("invalid tag: <%.*s>\r\n", text);
-                p = end + 1;
-                continue;
-            }
-            char tag[kTagMaxLen];
-            memcpy(tag, start, len);
-            tag[len] = '\0';
-            send_tag(tag);
-            p = end + 1;
-        } else {
-            send_key(*p);
-            ++p;
+struct ReplCommand {
+    const char *name;
+    void (*handler)(const char *args);
+};
+
+static constexpr ReplCommand repl_commands[] = {
+    {"abort",  cmd_abort},
+    {"status", cmd_status},
+    {"stats",  cmd_stats},
+    {"pace",   cmd_pace},
+    {"jitter", cmd_jitter},
+    {"cache",  cmd_cache},
+    {"wake",   cmd_wake},
+    {"settle", cmd_settle},
+    {"unicode", cmd_unicode},
+    {"os",      cmd_os},
+    {"screen",  cmd_screen},
+    {"after",  cmd_after},
+    {"at",     cmd_at},
+    {"clock",  cmd_clock},
+    {"jobs",   cmd_jobs},
+    {"cancel", cmd_cancel},
+    {"boot",    cmd_boot},
+    {"log",     cmd_log},
+    {"diag",    cmd_diag},
+    {"dry",     cmd_dry},
+    {"def",     cmd_def},
+    {"undef",   cmd_undef},
+    {"macros",  cmd_macros},
+    {"save",    cmd_save},
+    {"autorun", cmd_autorun},
+};
+
+bool handle_command(const char *line) {
+    const char *args = strchr(line, ' ');
+    size_t name_len = args ? static_cast<size_t>(args - line) : strlen(line);
+    args = args ? args + 1 : "";
+
+    for (const ReplCommand &cmd : repl_commands) {
+        if (strlen(cmd.name) == name_len && strncmp(line, cmd.name, name_len) == 0) {
+            cmd.handler(args);
+            return true;
         }
     }
+    return false;
+}
+
+bool on_job_due(const char *text) {
+    // Runs under the scheduler's lock, mostly in its alarm interrupt on
+    // core 0; keep the message off the interrupt stack.
+    static TextMessage msg;
+    msg.id = 0;
+    strncpy(msg.text, text, WIFI_REPL_LINE_MAX - 1);
+    return queue_try_add(&s_text_queue, &msg);
 }
 
 void on_repl_line(const char *line, size_t /*len*/) {
+    // Lines starting with '!' are REPL commands, not text to type
+    if (line[0] == '!') {
+        if (!handle_command(line + 1)) {
+            char buf[WIFI_REPL_LINE_MAX + 32];
+            snprintf(buf, sizeof(buf), "unknown command: %s\r\n", line);
+            wifi_repl_write(buf);
+        }
+        return;
+    }
+
+    static uint16_t s_next_line_id = 0;
+    if (++s_next_line_id == 0) {
+        s_next_line_id = 1;
+    }
+
     TextMessage msg{};
+    msg.id = s_next_line_id;
     strncpy(msg.text, line, WIFI_REPL_LINE_MAX - 1);
-    queue_try_add(&s_text_queue, &msg);
+
+    wifi_repl_event_t ev{};
+    ev.id = msg.id;
+    if (queue_try_add(&s_text_queue, &msg)) {
+        ev.state = WIFI_REPL_LINE_QUEUED;
+    } else {
+        ev.state = WIFI_REPL_LINE_REJECTED;
+        ++s_lines_dropped;
+        metrics_add(METRICS_LINES_DROPPED, 1);
+    }
+    wifi_repl_write_event(&ev);
+}
+
+void print_stdout(const char *text) {
+    fputs(text, stdout);
 }
 
 void core1_entry() {
-    wifi_repl_init(on_repl_line, &s_error_queue);
+    stack_watch_paint();
+    flash_store_init();
+    metrics_log_init();
+    wifi_repl_init(on_repl_line, &s_reply_queue, &s_record_queue);
+    // UART output is slow, so the boot log is only printed once the radio is
+    // up, from this core.
+    write_boot_log(print_stdout);
     while (true) {
         wifi_repl_poll();
+        metrics_log_poll(!s_typing && queue_is_empty(&s_text_queue));
         sleep_ms(10);
     }
 }
 
+bool load_autorun(TextMessage &msg) {
+    int len = flash_store_read(FLASH_STORE_AUTORUN, msg.text, sizeof(msg.text) - 1);
+    if (len <= 0) {
+        return false;
+    }
+    msg.text[len] = '\0';
+    return true;
+}
+
 }  // namespace
 
 int main() {
+    boot_mark(BOOT_MAIN);
+    stack_watch_paint();
     stdio_init_all();
     board_init();
-    tusb_init();
 
     queue_init(&s_text_queue, sizeof(TextMessage), 8);
-    queue_init(&s_error_queue, sizeof(ErrorMessage), 8);
+    queue_init(&s_reply_queue, sizeof(ReplyMessage), 8);
+    queue_init(&s_control_queue, sizeof(ControlMessage), 4);
+    queue_init(&s_record_queue, sizeof(wifi_repl_record_t), 32);
 
+    // Before core 1 starts: from then on only the REPL defines and removes
+    // macros. The saved code may predate this firmware's settings.
+    macro_table_init();
+    macro_table_load();
+    recompile_macros();
+
+    // Start the radio bring-up first; it takes far longer than USB enumeration
+    // and nothing on this core depends on it.
     multicore_launch_core1(core1_entry);
+    boot_mark(BOOT_CORE1_LAUNCHED);
+
+    keyboards_init();
+    tusb_init();
+    boot_mark(BOOT_TUSB_INIT);
+
+    flash_store_init();
+    scheduler_init(on_job_due);
+    pacer_init();
+
+    static TextMessage autorun;
+    bool has_autorun = load_autorun(autorun);
 
+    // No sleeping here: every control transfer of the enumeration goes
+    // through tud_task().
     while (!tud_mounted()) {
         tud_task();
-        sleep_ms(10);
+        poll_control();
+    }
+    boot_mark(BOOT_USB_MOUNTED);
+
+    if (has_autorun && queue_try_add(&s_text_queue, &autorun)) {
+        boot_mark(BOOT_AUTORUN_QUEUED);
     }
 
     while (true) {
-        tud_task();
+        keyboards_task();
+        poll_control();
+
+        // Queued lines wait while the host is asleep; with !wake on, the
+        // first of them wakes it.
+        update_host_profile();
+        publish_metrics();
 
         TextMessage msg;
-        if (queue_try_remove(&s_text_queue, &msg)) {
-            send_text(msg.text);
+        if (!queue_is_empty(&s_text_queue) && keyboards_awake() &&
+            queue_try_remove(&s_text_queue, &msg)) {
+            send_text(msg);
         }
 
         sleep_ms(1);
@@ -412,8 +1282,38 @@ uint16_t tud_hid_get_report_cb(uint8_t /*instance*/, uint8_t /*report_id*/, hid_
     return 0;
 }
 
-void tud_hid_set_report_cb(uint8_t /*instance*/, uint8_t /*report_id*/, hid_report_type_t /*report_type*/, uint8_t const* /*buffer*/, uint16_t /*bufsize*/) {}
+void tud_hid_set_report_cb(uint8_t /*instance*/, uint8_t /*report_id*/, hid_report_type_t report_type, uint8_t const* /*buffer*/, uint16_t /*bufsize*/) {
+    fingerprint_record(FP_SET_REPORT, static_cast<uint8_t>(report_type));
+}
+
+bool tud_hid_set_idle_cb(uint8_t instance, uint8_t /*idle_rate*/) {
+    fingerprint_record(FP_SET_IDLE, instance);
+    return true;
+}
+
+void tud_hid_set_protocol_cb(uint8_t /*instance*/, uint8_t protocol) {
+    fingerprint_record(FP_SET_PROTOCOL, protocol);
+}
 
-void tud_hid_report_complete_cb(uint8_t /*instance*/, uint8_t const* /*report*/, uint16_t /*len*/) {}
+void tud_mount_cb(void) {
+    fingerprint_record(FP_MOUNT, 0);
+    keyboards_usb_mounted();
+}
+
+void tud_umount_cb(void) {
+    keyboards_usb_unmounted();
+}
+
+void tud_suspend_cb(bool remote_wakeup_en) {
+    keyboards_usb_suspended(remote_wakeup_en);
+}
+
+void tud_resume_cb(void) {
+    keyboards_usb_resumed();
+}
+
+void tud_hid_report_complete_cb(uint8_t instance, uint8_t const* /*report*/, uint16_t /*len*/) {
+    keyboards_report_complete(instance);
+}
 
 }
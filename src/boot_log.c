@@ -0,0 +1,32 @@
+#include "boot_log.h"
+
+#include "pico/stdlib.h"
+
+static volatile uint32_t s_phase_us[BOOT_PHASE_COUNT];
+
+static const char *const s_phase_names[BOOT_PHASE_COUNT] = {
+    [BOOT_MAIN]            = "main",
+    [BOOT_CORE1_LAUNCHED]  = "core1 launched",
+    [BOOT_TUSB_INIT]       = "tusb init",
+    [BOOT_USB_MOUNTED]     = "usb mounted",
+    [BOOT_AUTORUN_QUEUED]  = "autorun queued",
+    [BOOT_FIRST_REPORT]    = "first report",
+    [BOOT_CYW43_INIT]      = "cyw43 init",
+    [BOOT_AP_UP]           = "ap up",
+    [BOOT_REPL_LISTENING]  = "repl listening",
+};
+
+void boot_mark(boot_phase_t phase) {
+    if (s_phase_us[phase] == 0) {
+        uint32_t now = time_us_32();
+        s_phase_us[phase] = now ? now : 1;
+    }
+}
+
+uint32_t boot_phase_us(boot_phase_t phase) {
+    return s_phase_us[phase];
+}
+
+const char *boot_phase_name(boot_phase_t phase) {
+    return s_phase_names[phase];
+}
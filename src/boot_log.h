@@ -0,0 +1,39 @@
+#ifndef BOOT_LOG_H
+#define BOOT_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Timestamps of the boot milestones on both cores, in microseconds since
+// reset. Recording is a single store, so it is safe on the hot path; the
+// table is only formatted on request.
+typedef enum {
+    BOOT_MAIN,
+    BOOT_CORE1_LAUNCHED,
+    BOOT_TUSB_INIT,
+    BOOT_USB_MOUNTED,
+    BOOT_AUTORUN_QUEUED,
+    BOOT_FIRST_REPORT,
+    BOOT_CYW43_INIT,
+    BOOT_AP_UP,
+    BOOT_REPL_LISTENING,
+    BOOT_PHASE_COUNT
+} boot_phase_t;
+
+// Records the first time a phase is reached; later calls are ignored.
+void boot_mark(boot_phase_t phase);
+
+// Returns 0 if the phase has not been reached yet.
+uint32_t boot_phase_us(boot_phase_t phase);
+
+const char *boot_phase_name(boot_phase_t phase);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
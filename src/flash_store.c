@@ -0,0 +1,107 @@
+#include "flash_store.h"
+
+#include <string.h>
+
+#include "hardware/flash.h"
+#include "hardware/regs/addressmap.h"
+#include "pico/flash.h"
+
+#define RECORD_MAGIC        0x314b5042u  // "BPK1"
+#define WRITE_TIMEOUT_MS    100
+
+typedef struct {
+    uint32_t magic;
+    uint16_t len;
+    uint16_t record;
+    uint32_t crc;
+} record_header_t;
+
+_Static_assert(sizeof(record_header_t) + FLASH_STORE_RECORD_MAX == FLASH_SECTOR_SIZE,
+               "FLASH_STORE_RECORD_MAX out of sync with the header");
+
+typedef struct {
+    uint32_t offset;
+    const record_header_t *header;
+    const uint8_t *data;
+} write_job_t;
+
+static uint32_t record_offset(flash_store_record_t record) {
+    return PICO_FLASH_SIZE_BYTES - (uint32_t)(record + 1) * FLASH_SECTOR_SIZE;
+}
+
+uint32_t flash_store_crc32(const void *data, size_t len) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint32_t crc = 0xffffffffu;
+    for (size_t i = 0; i < len; ++i) {
+        crc ^= bytes[i];
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0xedb88320u & -(crc & 1u));
+        }
+    }
+    return ~crc;
+}
+
+// Runs with the other core parked and interrupts off; flash is not readable.
+static void write_sector(void *param) {
+    const write_job_t *job = (const write_job_t *)param;
+    flash_range_erase(job->offset, FLASH_SECTOR_SIZE);
+    if (!job->header) {
+        return;
+    }
+
+    static uint8_t page[FLASH_PAGE_SIZE];
+    size_t total = sizeof(record_header_t) + job->header->len;
+    for (size_t pos = 0; pos < total; pos += FLASH_PAGE_SIZE) {
+        memset(page, 0xff, sizeof(page));
+        for (size_t i = 0; i < FLASH_PAGE_SIZE && pos + i < total; ++i) {
+            size_t at = pos + i;
+            page[i] = at < sizeof(record_header_t)
+                ? ((const uint8_t *)job->header)[at]
+                : job->data[at - sizeof(record_header_t)];
+        }
+        flash_range_program(job->offset + pos, page, FLASH_PAGE_SIZE);
+    }
+}
+
+void flash_store_init(void) {
+    flash_safe_execute_core_init();
+}
+
+int flash_store_read(flash_store_record_t record, void *data, size_t max_len) {
+    const uint8_t *sector = (const uint8_t *)(XIP_BASE + record_offset(record));
+    record_header_t header;
+    memcpy(&header, sector, sizeof(header));
+
+    if (header.magic != RECORD_MAGIC || header.record != record ||
+        header.len > FLASH_STORE_RECORD_MAX || header.len > max_len) {
+        return -1;
+    }
+
+    const uint8_t *payload = sector + sizeof(header);
+    if (flash_store_crc32(payload, header.len) != header.crc) {
+        return -1;
+    }
+
+    memcpy(data, payload, header.len);
+    return header.len;
+}
+
+bool flash_store_write(flash_store_record_t record, const void *data, size_t len) {
+    if (len > FLASH_STORE_RECORD_MAX) {
+        return false;
+    }
+
+    record_header_t header = {
+        .magic = RECORD_MAGIC,
+        .len = (uint16_t)len,
+        .record = (uint16_t)record,
+        .crc = flash_store_crc32(data, len),
+    };
+    write_job_t job = { record_offset(record), &header, (const uint8_t *)data };
+    return flash_safe_execute(write_sector, &job, WRITE_TIMEOUT_MS) == PICO_OK;
+}
+
+bool flash_store_erase(flash_store_record_t record) {
+    write_job_t job = { record_offset(record), NULL, NULL };
+    return flash_safe_execute(write_sector, &job, WRITE_TIMEOUT_MS) == PICO_OK;
+}
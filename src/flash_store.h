@@ -0,0 +1,43 @@
+#ifndef FLASH_STORE_H
+#define FLASH_STORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Small persistent records, one per flash sector, at the very end of flash.
+// Each record carries a magic, its length and a CRC, so an erased or
+// half-written sector simply reads back as "no record". The metrics log's
+// ring (metrics_log.h) sits right below them.
+typedef enum {
+    FLASH_STORE_AUTORUN,
+    FLASH_STORE_MACROS,
+    FLASH_STORE_RECORD_COUNT
+} flash_store_record_t;
+
+// Largest payload a record can hold (one sector minus the header).
+#define FLASH_STORE_RECORD_MAX (4096 - 12)
+
+// Must be called once on each core, so that either core can write while the
+// other is parked.
+void flash_store_init(void);
+
+// Copies the record into data and returns its length, or -1 if there is none.
+int flash_store_read(flash_store_record_t record, void *data, size_t max_len);
+
+bool flash_store_write(flash_store_record_t record, const void *data, size_t len);
+
+bool flash_store_erase(flash_store_record_t record);
+
+// The CRC-32 the records are checked with.
+uint32_t flash_store_crc32(const void *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
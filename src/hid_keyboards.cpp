@@ -0,0 +1,357 @@
+#include "hid_keyboards.h"
+
+#include "pico/stdlib.h"
+#include "tusb.h"
+
+#include "report_pacer.h"
+
+namespace {
+
+// A device may only signal remote wakeup once the bus has been idle for
+// 5 ms; a host that ignored the signal gets it again after a second.
+constexpr uint64_t kWakeupDelayUs = 5000;
+constexpr uint64_t kWakeupRetryUs = 1000000;
+
+enum class KeyState : uint8_t {
+    kIdle,
+    kPressSent,     // waiting for the host to take the press
+    kHeld,          // release not sent yet
+    kReleaseSent,
+};
+
+struct Keyboard {
+    KeyState state;
+    uint8_t report_id;
+    uint8_t modifier;
+    uint16_t usage;         // keycode for the keyboard report, buttons for the mouse
+    uint16_t x;             // mouse: absolute position, 0-32767
+    uint16_t y;
+};
+
+static Keyboard s_keyboards[kKeyboardCount];
+static bool s_press_pending = false;    // a press the host has not taken yet
+static size_t s_next = 0;               // round robin start
+
+// Modifiers kept down between keys (keyboards_hold), and those each keyboard
+// last told the host about.
+static uint8_t s_hold = 0;
+static uint8_t s_modifiers_down[kKeyboardCount];
+
+static KeyboardsUsbStats s_usb;
+static bool s_wakeup_enabled = false;   // !wake
+static uint64_t s_suspend_us = 0;
+static uint64_t s_wakeup_sent_us = 0;
+
+static bool s_configured = false;
+static bool s_press_lost = false;       // not yet told to the caller
+static uint64_t s_mount_us = 0;
+static uint32_t s_settle_ms = kSettleDefaultMs;
+
+// The host dropped every key with the configuration; completions for reports
+// in flight will never come.
+void drop_configuration() {
+    if (!s_configured) {
+        return;
+    }
+    s_configured = false;
+    ++s_usb.resets;
+    if (s_press_pending) {
+        s_press_lost = true;
+        ++s_usb.presses_lost;
+    }
+    for (size_t i = 0; i < kKeyboardCount; ++i) {
+        s_keyboards[i] = Keyboard{};
+        s_modifiers_down[i] = 0;
+    }
+    s_press_pending = false;
+}
+
+bool boot_protocol(size_t i) {
+    return tud_hid_n_get_protocol(static_cast<uint8_t>(i)) == HID_PROTOCOL_BOOT;
+}
+
+// A press, or with usage 0 the release, of one key. In boot protocol the
+// keyboard report goes out without a report ID. The mouse report carries
+// the pointer position either way.
+bool send_report(size_t i, uint8_t report_id, uint8_t modifier, uint16_t usage, uint16_t x = 0, uint16_t y = 0) {
+    uint8_t instance = static_cast<uint8_t>(i);
+    switch (report_id) {
+        case HID_REPORT_ID_KEYBOARD: {
+            uint8_t keys[6] = {static_cast<uint8_t>(usage)};
+            if (!tud_hid_n_keyboard_report(instance, boot_protocol(i) ? 0 : HID_REPORT_ID_KEYBOARD, modifier, keys)) {
+                return false;
+            }
+            s_modifiers_down[i] = modifier;
+            return true;
+        }
+        case HID_REPORT_ID_CONSUMER: {
+            const uint8_t report[] = {static_cast<uint8_t>(usage), static_cast<uint8_t>(usage >> 8)};
+            return tud_hid_n_report(instance, report_id, report, sizeof(report));
+        }
+        case HID_REPORT_ID_SYSTEM: {
+            const uint8_t report[] = {static_cast<uint8_t>(usage)};
+            return tud_hid_n_report(instance, report_id, report, sizeof(report));
+        }
+        case HID_REPORT_ID_MOUSE:
+            return tud_hid_n_abs_mouse_report(instance, report_id, static_cast<uint8_t>(usage), static_cast<int16_t>(x),
+                                              static_cast<int16_t>(y), 0, 0);
+        default:
+            return false;
+    }
+}
+
+// Only the first configuration is trusted right away; after a reset the
+// host may still be loading its keyboard driver.
+bool settled() {
+    return s_usb.resets == 0 || time_us_64() - s_mount_us >= static_cast<uint64_t>(s_settle_ms) * 1000;
+}
+
+// Reports the lost press once.
+bool take_press_lost() {
+    bool lost = s_press_lost;
+    s_press_lost = false;
+    return lost;
+}
+
+// Only called with work waiting, so waking the host is always for a reason.
+void request_wakeup() {
+    if (!s_wakeup_enabled || !s_usb.host_allows_wakeup) {
+        return;
+    }
+    uint64_t now = time_us_64();
+    if (now - s_suspend_us < kWakeupDelayUs ||
+        (s_wakeup_sent_us != 0 && now - s_wakeup_sent_us < kWakeupRetryUs)) {
+        return;
+    }
+    if (tud_remote_wakeup()) {
+        s_wakeup_sent_us = now;
+        ++s_usb.wakeups;
+    }
+}
+
+// Sends pending releases and runs the USB stack, which reports completions.
+void service() {
+    tud_task();
+    if (!tud_mounted()) {
+        drop_configuration();
+        return;
+    }
+    if (tud_suspended()) {
+        // Everything stays as it is; reports already handed to an endpoint
+        // go out on the first poll after the resume.
+        request_wakeup();
+        return;
+    }
+    for (size_t i = 0; i < kKeyboardCount; ++i) {
+        Keyboard &kb = s_keyboards[i];
+        if (kb.state == KeyState::kHeld && tud_hid_n_ready(static_cast<uint8_t>(i)) && pacer_take() &&
+            send_report(i, kb.report_id, s_hold, 0, kb.x, kb.y)) {
+            kb.state = KeyState::kReleaseSent;
+        } else if (kb.state == KeyState::kIdle && s_modifiers_down[i] != s_hold && !s_press_pending &&
+                   tud_hid_n_ready(static_cast<uint8_t>(i)) && pacer_take() &&
+                   send_report(i, HID_REPORT_ID_KEYBOARD, s_hold, 0)) {
+            // The hold changed since this keyboard's last report, or the
+            // host forgot it in a bus reset.
+            kb = {KeyState::kReleaseSent, HID_REPORT_ID_KEYBOARD, s_hold, 0, 0, 0};
+        }
+    }
+}
+
+// Mouse reports never overlap anything: a click lands where the keys before
+// it left the focus, and the keys after it go where the click put it.
+bool conflicts(const Keyboard &held, uint8_t report_id, uint8_t modifier, uint16_t usage) {
+    if (held.state == KeyState::kIdle) {
+        return false;
+    }
+    return held.report_id != report_id || report_id == HID_REPORT_ID_MOUSE || held.modifier != modifier || held.usage == usage;
+}
+
+// An idle keyboard the press can go to right now, or -1.
+int pick(uint8_t report_id, uint8_t modifier, uint16_t usage) {
+    if (s_press_pending || !settled()) {
+        return -1;
+    }
+    int found = -1;
+    for (size_t n = 0; n < kKeyboardCount; ++n) {
+        size_t i = (s_next + n) % kKeyboardCount;
+        const Keyboard &kb = s_keyboards[i];
+        if (kb.state != KeyState::kIdle) {
+            if (conflicts(kb, report_id, modifier, usage)) {
+                return -1;
+            }
+        } else if (found < 0 && tud_hid_n_ready(static_cast<uint8_t>(i)) &&
+                   (report_id == HID_REPORT_ID_KEYBOARD || !boot_protocol(i))) {
+            found = static_cast<int>(i);
+        }
+    }
+    return found;
+}
+
+KeyboardsResult press(uint8_t report_id, uint8_t modifier, uint16_t usage, keyboards_idle_fn_t idle,
+                      uint16_t x = 0, uint16_t y = 0) {
+    while (true) {
+        service();
+        if (take_press_lost()) {
+            return KeyboardsResult::kLost;
+        }
+        int i = pick(report_id, modifier, usage);
+        if (i >= 0 && pacer_take() && send_report(static_cast<size_t>(i), report_id, modifier, usage, x, y)) {
+            s_keyboards[i] = {KeyState::kPressSent, report_id, modifier, usage, x, y};
+            s_press_pending = true;
+            s_next = static_cast<size_t>(i) + 1;
+            return KeyboardsResult::kDone;
+        }
+        if (idle()) {
+            return KeyboardsResult::kAborted;
+        }
+        pacer_wait();
+    }
+}
+
+// Only the keyboard report exists in boot protocol.
+bool any_report_protocol() {
+    for (size_t i = 0; i < kKeyboardCount; ++i) {
+        if (!boot_protocol(i)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}  // namespace
+
+void keyboards_init() {
+    for (size_t i = 0; i < kKeyboardCount; ++i) {
+        s_keyboards[i] = Keyboard{};
+        s_modifiers_down[i] = 0;
+    }
+    s_press_pending = false;
+    s_next = 0;
+    s_hold = 0;
+}
+
+void keyboards_task() {
+    service();
+}
+
+KeyboardsResult keyboards_press(uint8_t modifier, uint8_t keycode, keyboards_idle_fn_t idle) {
+    return press(HID_REPORT_ID_KEYBOARD, modifier, keycode, idle);
+}
+
+KeyboardsResult keyboards_press_control(uint8_t report_id, uint16_t usage, keyboards_idle_fn_t idle) {
+    if (!any_report_protocol()) {
+        ++s_usb.controls_dropped;
+        return KeyboardsResult::kDone;
+    }
+    return press(report_id, 0, usage, idle);
+}
+
+KeyboardsResult keyboards_pointer(uint8_t buttons, uint16_t x, uint16_t y, keyboards_idle_fn_t idle) {
+    if (!any_report_protocol()) {
+        ++s_usb.controls_dropped;
+        return KeyboardsResult::kDone;
+    }
+    return press(HID_REPORT_ID_MOUSE, 0, buttons, idle, x, y);
+}
+
+KeyboardsResult keyboards_flush(keyboards_idle_fn_t idle) {
+    while (true) {
+        service();
+        if (take_press_lost()) {
+            return KeyboardsResult::kLost;
+        }
+        bool busy = false;
+        for (size_t i = 0; i < kKeyboardCount; ++i) {
+            busy |= s_keyboards[i].state != KeyState::kIdle || s_modifiers_down[i] != s_hold;
+        }
+        if (!busy) {
+            return KeyboardsResult::kDone;
+        }
+        if (idle()) {
+            return KeyboardsResult::kAborted;
+        }
+        pacer_wait();
+    }
+}
+
+KeyboardsResult keyboards_hold(uint8_t modifier, keyboards_idle_fn_t idle) {
+    // Keys still going out keep the old modifiers, or the host could see the
+    // new ones before a press that is still on its way.
+    KeyboardsResult result = keyboards_flush(idle);
+    if (result == KeyboardsResult::kLost) {
+        return result;
+    }
+    // Given up on: the releases still waiting go out with the new hold.
+    s_hold = modifier;
+    return result == KeyboardsResult::kAborted ? result : keyboards_flush(idle);
+}
+
+bool keyboards_awake() {
+    if (!tud_suspended()) {
+        return true;
+    }
+    request_wakeup();
+    return false;
+}
+
+void keyboards_usb_suspended(bool remote_wakeup_allowed) {
+    s_usb.suspended = true;
+    s_usb.host_allows_wakeup = remote_wakeup_allowed;
+    ++s_usb.suspends;
+    s_suspend_us = time_us_64();
+    s_wakeup_sent_us = 0;
+}
+
+void keyboards_usb_resumed() {
+    s_usb.suspended = false;
+}
+
+void keyboards_usb_mounted() {
+    // A reset and the new configuration can both happen within one
+    // tud_task(), before service() sees tud_mounted() go false.
+    drop_configuration();
+    s_configured = true;
+    s_mount_us = time_us_64();
+}
+
+void keyboards_usb_unmounted() {
+    drop_configuration();
+}
+
+void keyboards_set_settle_ms(uint32_t ms) {
+    s_settle_ms = ms > kSettleMaxMs ? kSettleMaxMs : ms;
+}
+
+uint32_t keyboards_settle_ms() {
+    return s_settle_ms;
+}
+
+void keyboards_set_remote_wakeup(bool enabled) {
+    s_wakeup_enabled = enabled;
+}
+
+bool keyboards_remote_wakeup() {
+    return s_wakeup_enabled;
+}
+
+void keyboards_usb_stats(KeyboardsUsbStats &stats) {
+    stats = s_usb;
+}
+
+void keyboards_report_complete(uint8_t instance) {
+    if (instance >= kKeyboardCount) {
+        return;
+    }
+    pacer_report_complete();
+    Keyboard &kb = s_keyboards[instance];
+    if (kb.state == KeyState::kPressSent) {
+        if (kb.report_id == HID_REPORT_ID_MOUSE && kb.usage == 0) {
+            kb = Keyboard{};    // a pointer move has no release
+        } else {
+            kb.state = KeyState::kHeld;
+        }
+        s_press_pending = false;
+    } else if (kb.state == KeyState::kReleaseSent) {
+        kb = Keyboard{};
+    }
+}
@@ -0,0 +1,121 @@
+#ifndef HID_KEYBOARDS_H
+#define HID_KEYBOARDS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tusb_config.h"
+
+// Keystrokes spread over HID_KEYBOARD_COUNT keyboard interfaces. Each
+// interface has its own IN endpoint, so while one keyboard still has to send
+// its release, the next key can already go down on another one. Consumer and
+// system control keys (see tusb_config.h for the report IDs) go through the
+// same queue of presses as keyboard keys, on whichever interface is free,
+// and so does the absolute mouse: keys, controls and pointer reports are
+// all put on one timeline, in the order they were typed.
+//
+// Typed order is kept by two rules:
+// - A press is only handed to an endpoint after the host has taken the
+//   previous press, so presses reach the host in the order they were typed.
+// - A press may only overlap keys still held on other keyboards if it is of
+//   the same report, the modifiers are the same and the key differs. The
+//   host merges the state of all keyboards, so a held shift on one would
+//   change a key on another, and a key held elsewhere would not register as
+//   a new press. Mouse reports overlap nothing, so a click lands after the
+//   keys before it and before the keys after it.
+// Anything else waits until the other keyboards are released.
+//
+// Every report, press or release, also waits for its slot in report_pacer.h.
+//
+// When the host loses the configuration (bus reset, re-enumeration, unplug),
+// a press it had not acknowledged yet never arrived; keyboards_press and
+// keyboards_flush return kLost once, so the caller can type that key again.
+// After the host configures the device again, nothing is sent until the
+// settle delay has passed, giving it time to attach its keyboard driver.
+
+constexpr size_t kKeyboardCount = HID_KEYBOARD_COUNT;
+
+constexpr uint32_t kSettleDefaultMs = 500;
+constexpr uint32_t kSettleMaxMs = 60000;
+
+// Runs in every wait of the calls below; returns true to give up waiting.
+typedef bool (*keyboards_idle_fn_t)();
+
+enum class KeyboardsResult : uint8_t {
+    kDone,
+    kLost,      // the previous press was lost to a bus reset; nothing was sent
+    kAborted,   // idle gave up; nothing was sent
+};
+
+void keyboards_init();
+
+// Sends releases that are due and runs the USB stack, without waiting. For
+// the main loop, so keys given up on still go up once the host lets them.
+void keyboards_task();
+
+// Issues a press now and its release as soon as the endpoint is free again.
+// Blocks until the press can go out, the previous press turns out lost to a
+// bus reset, or idle gives up.
+KeyboardsResult keyboards_press(uint8_t modifier, uint8_t keycode, keyboards_idle_fn_t idle);
+
+// The same for a consumer or system control key. While the host has every
+// interface in boot protocol, which has no such reports, the key is dropped.
+KeyboardsResult keyboards_press_control(uint8_t report_id, uint16_t usage, keyboards_idle_fn_t idle);
+
+// Moves the pointer to x, y (0-32767 across the screen). With buttons, those
+// go down there and are released there like a key; without, it is a move
+// alone, one report. Dropped like control keys in boot protocol.
+KeyboardsResult keyboards_pointer(uint8_t buttons, uint16_t x, uint16_t y, keyboards_idle_fn_t idle);
+
+// Waits until every keyboard has sent its release.
+KeyboardsResult keyboards_flush(keyboards_idle_fn_t idle);
+
+// Keeps modifier down from now on: releases report it, and keyboards that
+// last reported something else report it once. For input methods that read
+// several keys under one held modifier, such as Windows Alt codes; the keys
+// themselves must carry it too. Waits like keyboards_flush, so with 0 it
+// returns once the host has seen the modifiers go up everywhere. If idle
+// gives up, the new hold still applies to the releases yet to go out.
+KeyboardsResult keyboards_hold(uint8_t modifier, keyboards_idle_fn_t idle);
+
+// From tud_hid_report_complete_cb.
+void keyboards_report_complete(uint8_t instance);
+
+// USB suspend. While the host sleeps no report is sent and nothing that is
+// waiting to go out is lost; it continues on the first poll after the
+// resume. With remote wakeup on, and allowed by the host, a keystroke that
+// is waiting wakes the host up.
+
+struct KeyboardsUsbStats {
+    uint32_t suspends;
+    uint32_t wakeups;           // remote wakeups signalled
+    uint32_t resets;            // configurations lost
+    uint32_t presses_lost;      // presses the host never acknowledged
+    uint32_t controls_dropped;  // control keys and mouse reports while in boot protocol
+    bool suspended;
+    bool host_allows_wakeup;    // as of the last suspend
+};
+
+// False while the bus is suspended. The caller has work waiting, so with
+// remote wakeup on this also asks the host to wake up.
+bool keyboards_awake();
+
+// From tud_suspend_cb and tud_resume_cb.
+void keyboards_usb_suspended(bool remote_wakeup_allowed);
+void keyboards_usb_resumed();
+
+// From tud_mount_cb and tud_umount_cb. A bus reset does not always call
+// tud_umount_cb, so a lost configuration is also noticed from tud_mounted().
+void keyboards_usb_mounted();
+void keyboards_usb_unmounted();
+
+// Delay between the host configuring the device again and the next report.
+void keyboards_set_settle_ms(uint32_t ms);
+uint32_t keyboards_settle_ms();
+
+void keyboards_set_remote_wakeup(bool enabled);
+bool keyboards_remote_wakeup();
+
+void keyboards_usb_stats(KeyboardsUsbStats &stats);
+
+#endif
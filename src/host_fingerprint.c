@@ -0,0 +1,244 @@
+#include "host_fingerprint.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "tusb.h"
+
+typedef struct {
+    uint8_t event;
+    uint8_t arg;
+    uint16_t ms;        // since the first request of this enumeration
+} fp_entry_t;
+
+static fp_entry_t s_trace[FINGERPRINT_TRACE_MAX];
+static size_t s_count = 0;
+static uint64_t s_start_us = 0;
+static uint64_t s_mount_us = 0;         // 0: not configured yet
+static bool s_dirty = true;             // s_signals is out of date
+static uint32_t s_signals = 0;
+static bool s_signals_final = false;    // s_signals was worked out after the window
+
+// What a trace shows, one bit each. The weights below come from how the
+// hosts are known to enumerate a boot keyboard; no single request decides,
+// and a host that matches none of them clearly stays unknown.
+typedef enum {
+    SIG_MS_OS,              // string 0xEE: Windows looking for MS OS descriptors
+    SIG_QUALIFIER,          // device qualifier of a USB 2.0 full-speed device
+    SIG_SERIAL_FIRST,       // serial number before any other string
+    SIG_PRODUCT_ORDER,      // product, manufacturer, serial in that order
+    SIG_SET_IDLE,
+    SIG_OUTPUT_REPORT,      // keyboard LEDs set right after configuration
+    SIG_QUIET,              // window closed with neither of the two above
+    SIG_COUNT
+} fp_signal_t;
+
+typedef struct {
+    const char *name;
+    int8_t weight[HOST_OS_COUNT];
+} fp_rule_t;
+
+static const fp_rule_t s_rules[SIG_COUNT] = {
+    [SIG_MS_OS]          = {"ms-os-string",  {[HOST_OS_WINDOWS] = 4}},
+    [SIG_QUALIFIER]      = {"qualifier",     {[HOST_OS_WINDOWS] = 1}},
+    [SIG_SERIAL_FIRST]   = {"serial-first",  {[HOST_OS_WINDOWS] = 1}},
+    [SIG_PRODUCT_ORDER]  = {"product-order", {[HOST_OS_LINUX] = 2}},
+    [SIG_SET_IDLE]       = {"set-idle",      {[HOST_OS_WINDOWS] = 1, [HOST_OS_LINUX] = 1}},
+    [SIG_OUTPUT_REPORT]  = {"led-report",    {[HOST_OS_WINDOWS] = 1, [HOST_OS_LINUX] = 1}},
+    [SIG_QUIET]          = {"quiet",         {[HOST_OS_MACOS] = 3}},
+};
+
+// A guess needs this score and this lead over the runner-up.
+#define GUESS_MIN_SCORE 3
+#define GUESS_MIN_LEAD 2
+
+static const char *const s_os_names[HOST_OS_COUNT] = {
+    [HOST_OS_UNKNOWN] = "unknown",
+    [HOST_OS_WINDOWS] = "windows",
+    [HOST_OS_LINUX]   = "linux",
+    [HOST_OS_MACOS]   = "macos",
+};
+
+bool fingerprint_final(void) {
+    return s_mount_us != 0 && time_us_64() - s_mount_us >= (uint64_t)FINGERPRINT_WINDOW_MS * 1000;
+}
+
+void fingerprint_record(fp_event_t event, uint8_t arg) {
+    uint64_t now = time_us_64();
+    if (event == FP_DEVICE && s_mount_us != 0) {
+        // A new enumeration: bus reset, re-plug or another host
+        s_count = 0;
+        s_mount_us = 0;
+    }
+    if (fingerprint_final()) {
+        return;
+    }
+    if (s_count == 0) {
+        s_start_us = now;
+    }
+    if (event == FP_MOUNT) {
+        s_mount_us = now;
+    }
+    if (s_count < FINGERPRINT_TRACE_MAX) {
+        uint64_t ms = (now - s_start_us) / 1000;
+        s_trace[s_count++] = (fp_entry_t){(uint8_t)event, arg, (uint16_t)(ms > UINT16_MAX ? UINT16_MAX : ms)};
+    }
+    s_dirty = true;
+}
+
+static uint32_t find_signals(bool final) {
+    uint32_t signals = 0;
+    uint8_t strings[3];         // the first strings other than 0 and 0xEE
+    size_t string_count = 0;
+    bool mounted = false;
+    for (size_t i = 0; i < s_count; ++i) {
+        const fp_entry_t *e = &s_trace[i];
+        switch (e->event) {
+            case FP_STRING:
+                if (e->arg == FP_STRING_MS_OS) {
+                    signals |= 1u << SIG_MS_OS;
+                } else if (e->arg != 0 && !mounted && string_count < sizeof(strings)) {
+                    strings[string_count++] = e->arg;
+                }
+                break;
+            case FP_QUALIFIER:
+                signals |= 1u << SIG_QUALIFIER;
+                break;
+            case FP_MOUNT:
+                mounted = true;
+                break;
+            case FP_SET_IDLE:
+                signals |= 1u << SIG_SET_IDLE;
+                break;
+            case FP_SET_REPORT:
+                if (e->arg == HID_REPORT_TYPE_OUTPUT) {
+                    signals |= 1u << SIG_OUTPUT_REPORT;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    if (string_count > 0 && strings[0] == USB_STRING_SERIAL) {
+        signals |= 1u << SIG_SERIAL_FIRST;
+    }
+    if (string_count == 3 && strings[0] == USB_STRING_PRODUCT && strings[1] == USB_STRING_MANUFACTURER &&
+        strings[2] == USB_STRING_SERIAL) {
+        signals |= 1u << SIG_PRODUCT_ORDER;
+    }
+    if (final && !(signals & ((1u << SIG_SET_IDLE) | (1u << SIG_OUTPUT_REPORT)))) {
+        signals |= 1u << SIG_QUIET;
+    }
+    return signals;
+}
+
+static uint32_t current_signals(void) {
+    bool final = fingerprint_final();
+    if (s_dirty || final != s_signals_final) {
+        s_signals = find_signals(final);
+        s_signals_final = final;
+        s_dirty = false;
+    }
+    return s_signals;
+}
+
+host_os_t fingerprint_guess(int scores[HOST_OS_COUNT]) {
+    int score[HOST_OS_COUNT] = {0};
+    uint32_t signals = current_signals();
+    for (size_t sig = 0; sig < SIG_COUNT; ++sig) {
+        if (signals & (1u << sig)) {
+            for (size_t os = 0; os < HOST_OS_COUNT; ++os) {
+                score[os] += s_rules[sig].weight[os];
+            }
+        }
+    }
+    if (scores) {
+        memcpy(scores, score, sizeof(score));
+    }
+
+    host_os_t best = HOST_OS_WINDOWS;
+    for (size_t os = HOST_OS_WINDOWS; os < HOST_OS_COUNT; ++os) {
+        if (score[os] > score[best]) {
+            best = (host_os_t)os;
+        }
+    }
+    int second = 0;
+    for (size_t os = HOST_OS_WINDOWS; os < HOST_OS_COUNT; ++os) {
+        if (os != best && score[os] > second) {
+            second = score[os];
+        }
+    }
+    if (score[best] < GUESS_MIN_SCORE || score[best] - second < GUESS_MIN_LEAD) {
+        return HOST_OS_UNKNOWN;
+    }
+    return best;
+}
+
+void fingerprint_format_rules(char *buf, size_t len) {
+    uint32_t signals = current_signals();
+    size_t pos = 0;
+    buf[0] = '\0';
+    for (size_t sig = 0; sig < SIG_COUNT && pos < len; ++sig) {
+        if (signals & (1u << sig)) {
+            int n = snprintf(buf + pos, len - pos, "%s%s", pos ? ", " : "", s_rules[sig].name);
+            pos += n > 0 ? (size_t)n : 0;
+        }
+    }
+    if (pos == 0) {
+        snprintf(buf, len, "none");
+    }
+}
+
+void fingerprint_format_trace(char *buf, size_t len) {
+    static const char s_tokens[] = {
+        [FP_DEVICE] = 'D', [FP_CONFIG] = 'C', [FP_STRING] = 'S', [FP_QUALIFIER] = 'Q',
+        [FP_REPORT_DESC] = 'R', [FP_MOUNT] = 'M', [FP_SET_IDLE] = 'I', [FP_SET_PROTOCOL] = 'P',
+        [FP_SET_REPORT] = 'O',
+    };
+    size_t pos = 0;
+    bool output_seen = false;
+    buf[0] = '\0';
+    for (size_t i = 0; i < s_count && pos < len; ++i) {
+        const fp_entry_t *e = &s_trace[i];
+        char token[16];
+        switch (e->event) {
+            case FP_DEVICE:
+            case FP_CONFIG:
+            case FP_QUALIFIER:
+                snprintf(token, sizeof(token), "%c", s_tokens[e->event]);
+                break;
+            case FP_MOUNT:
+                snprintf(token, sizeof(token), "M@%u", e->ms);
+                break;
+            case FP_SET_REPORT:
+                if (e->arg != HID_REPORT_TYPE_OUTPUT) {
+                    snprintf(token, sizeof(token), "X%u", e->arg);
+                } else if (!output_seen) {
+                    output_seen = true;
+                    snprintf(token, sizeof(token), "O@%u", e->ms);
+                } else {
+                    snprintf(token, sizeof(token), "O");
+                }
+                break;
+            case FP_STRING:
+                if (e->arg == FP_STRING_MS_OS) {
+                    snprintf(token, sizeof(token), "Sms");
+                    break;
+                }
+                // fall through
+            default:
+                snprintf(token, sizeof(token), "%c%u", s_tokens[e->event], e->arg);
+                break;
+        }
+        int n = snprintf(buf + pos, len - pos, "%s%s", pos ? " " : "", token);
+        pos += n > 0 ? (size_t)n : 0;
+    }
+    if (s_count == FINGERPRINT_TRACE_MAX && pos < len) {
+        snprintf(buf + pos, len - pos, " ...");
+    }
+}
+
+const char *host_os_name(host_os_t os) {
+    return os < HOST_OS_COUNT ? s_os_names[os] : "?";
+}
@@ -0,0 +1,74 @@
+#ifndef HOST_FINGERPRINT_H
+#define HOST_FINGERPRINT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Guesses the host's operating system from how it enumerates the keyboard:
+// which descriptors it asks for and in what order, and which HID class
+// requests follow SET_CONFIGURATION. TinyUSB answers GET_DESCRIPTOR itself
+// and does not pass wLength on, so a host that reads a descriptor's header
+// before the whole of it shows up as two requests rather than two lengths.
+//
+// Each enumeration starts a new trace at the first device descriptor
+// request after a mount. Requests are recorded until FINGERPRINT_WINDOW_MS
+// after SET_CONFIGURATION; the guess is final from then on.
+//
+// Core 0 only: everything is recorded from TinyUSB callbacks.
+
+#define FINGERPRINT_TRACE_MAX 48
+#define FINGERPRINT_WINDOW_MS 1000
+
+typedef enum {
+    HOST_OS_UNKNOWN,
+    HOST_OS_WINDOWS,
+    HOST_OS_LINUX,
+    HOST_OS_MACOS,
+    HOST_OS_COUNT
+} host_os_t;
+
+typedef enum {
+    FP_DEVICE,          // GET_DESCRIPTOR(device)
+    FP_CONFIG,          // GET_DESCRIPTOR(configuration)
+    FP_STRING,          // GET_DESCRIPTOR(string), arg: index
+    FP_QUALIFIER,       // GET_DESCRIPTOR(device qualifier)
+    FP_REPORT_DESC,     // GET_DESCRIPTOR(HID report), arg: interface
+    FP_MOUNT,           // SET_CONFIGURATION
+    FP_SET_IDLE,        // arg: interface
+    FP_SET_PROTOCOL,    // arg: protocol
+    FP_SET_REPORT,      // arg: report type
+} fp_event_t;
+
+// String index Windows asks for to find Microsoft OS descriptors
+#define FP_STRING_MS_OS 0xEE
+
+void fingerprint_record(fp_event_t event, uint8_t arg);
+
+// The best guess so far, HOST_OS_UNKNOWN if no OS is clearly ahead.
+// scores, if not NULL, gets each OS's score.
+host_os_t fingerprint_guess(int scores[HOST_OS_COUNT]);
+
+// True once the window after SET_CONFIGURATION has closed.
+bool fingerprint_final(void);
+
+// The rules that matched, comma separated.
+void fingerprint_format_rules(char *buf, size_t len);
+
+// The recorded requests, e.g. "D D C C S0 S2 S1 S3 M@38 I0 R0 O@52": one
+// letter per event type, then the index, interface or protocol. SET_REPORT
+// is O for an output report and X<type> otherwise. SET_CONFIGURATION and
+// the first output report carry their time in ms since the first request.
+void fingerprint_format_trace(char *buf, size_t len);
+
+const char *host_os_name(host_os_t os);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
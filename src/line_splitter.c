@@ -0,0 +1,73 @@
+#include "line_splitter.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define ONES    0x01010101u
+#define HIGHS   0x80808080u
+#define NEWLINES 0x0a0a0a0au
+
+void line_splitter_init(line_splitter_t *s, char *buf, size_t cap) {
+    s->buf = buf;
+    s->cap = cap;
+    s->len = 0;
+}
+
+const char *line_splitter_find(const char *data, size_t len) {
+    const char *p = data;
+    const char *end = data + len;
+
+    while (p < end && ((uintptr_t)p & 3) != 0) {
+        if (*p == '\n') {
+            return p;
+        }
+        ++p;
+    }
+    // A byte of w ^ NEWLINES is zero where w has a '\n'; (x - ONES) & ~x
+    // sets the high bit of at least the first zero byte.
+    while (end - p >= 4) {
+        uint32_t w;
+        memcpy(&w, p, sizeof(w));   // aligned, so a single load
+        uint32_t x = w ^ NEWLINES;
+        if (((x - ONES) & ~x & HIGHS) != 0) {
+            break;
+        }
+        p += 4;
+    }
+    while (p < end) {
+        if (*p == '\n') {
+            return p;
+        }
+        ++p;
+    }
+    return NULL;
+}
+
+// Appends as much of data as fits, leaving out '\r'.
+static void append(line_splitter_t *s, const char *data, size_t len) {
+    while (len > 0 && s->len < s->cap - 1) {
+        size_t room = s->cap - 1 - s->len;
+        size_t n = len < room ? len : room;
+        const char *cr = memchr(data, '\r', n);
+        size_t run = cr ? (size_t)(cr - data) : n;
+        memcpy(s->buf + s->len, data, run);
+        s->len += run;
+        if (cr) {
+            ++run;
+        }
+        data += run;
+        len -= run;
+    }
+}
+
+size_t line_splitter_feed(line_splitter_t *s, const char *data, size_t len, bool *line_done) {
+    const char *nl = line_splitter_find(data, len);
+    size_t run = nl ? (size_t)(nl - data) : len;
+    append(s, data, run);
+    *line_done = nl != NULL;
+    if (nl) {
+        s->buf[s->len] = '\0';
+        return run + 1;
+    }
+    return len;
+}
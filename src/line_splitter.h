@@ -0,0 +1,37 @@
+#ifndef LINE_SPLITTER_H
+#define LINE_SPLITTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Splits a byte stream into lines at '\n' and drops every '\r'. Input may
+// arrive in pieces of any size. The search for '\n' reads a 32-bit word at a
+// time, and each run of bytes up to it is copied with memcpy, instead of
+// testing and appending every byte on its own. A line longer than cap - 1
+// bytes is cut there; the rest of it is dropped.
+
+typedef struct line_splitter {
+    char *buf;      // the line so far; terminated by line_splitter_feed
+    size_t cap;
+    size_t len;
+} line_splitter_t;
+
+void line_splitter_init(line_splitter_t *s, char *buf, size_t cap);
+
+// Takes bytes up to and including the first '\n'. Returns how many it took;
+// *line_done tells whether that ended a line, which is then in s->buf with
+// s->len bytes and a terminator. The caller resets s->len to start the next.
+size_t line_splitter_feed(line_splitter_t *s, const char *data, size_t len, bool *line_done);
+
+// The first '\n' in data, or NULL.
+const char *line_splitter_find(const char *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -5,12 +5,40 @@
 #define LWIP_SOCKET                 0
 #define LWIP_NETCONN                0
 
+// Buffer profiles, picked with -DLWIP_PROFILE=<name> at configure time.
+// Use "!bench" to compare them: pbuf pool errors mean the pool is too small
+// for the window, a low slowest-second rate means the window is too small.
+//   0 balanced    the long-standing defaults
+//   1 lowmem      half the window, for builds that need the RAM elsewhere
+//   2 throughput  twice the window and a pool that can hold all of it
+#define LWIP_PROFILE_BALANCED       0
+#define LWIP_PROFILE_LOWMEM         1
+#define LWIP_PROFILE_THROUGHPUT     2
+
+#ifndef LWIP_PROFILE
+#define LWIP_PROFILE                LWIP_PROFILE_BALANCED
+#endif
+
 #define MEM_LIBC_MALLOC             0
 #define MEM_ALIGNMENT               4
+#define MEMP_NUM_ARP_QUEUE          10
+
+#if LWIP_PROFILE == LWIP_PROFILE_LOWMEM
+#define MEM_SIZE                    2000
+#define MEMP_NUM_TCP_SEG            16
+#define PBUF_POOL_SIZE              12
+#define TCP_WND_SEGS                2
+#elif LWIP_PROFILE == LWIP_PROFILE_THROUGHPUT
+#define MEM_SIZE                    16000
+#define MEMP_NUM_TCP_SEG            64
+#define PBUF_POOL_SIZE              48
+#define TCP_WND_SEGS                8
+#else
 #define MEM_SIZE                    4000
 #define MEMP_NUM_TCP_SEG            32
-#define MEMP_NUM_ARP_QUEUE          10
 #define PBUF_POOL_SIZE              24
+#define TCP_WND_SEGS                4
+#endif
 
 #define LWIP_ARP                    1
 #define LWIP_ETHERNET               1
@@ -24,8 +52,8 @@
 
 #define LWIP_TCP                    1
 #define TCP_MSS                     1460
-#define TCP_WND                     (4 * TCP_MSS)
-#define TCP_SND_BUF                 (4 * TCP_MSS)
+#define TCP_WND                     (TCP_WND_SEGS * TCP_MSS)
+#define TCP_SND_BUF                 (TCP_WND_SEGS * TCP_MSS)
 #define TCP_SND_QUEUELEN            ((4 * (TCP_SND_BUF) + (TCP_MSS - 1)) / (TCP_MSS))
 
 #define LWIP_UDP                    1
@@ -33,7 +61,18 @@
 #define LWIP_NETIF_STATUS_CALLBACK  1
 #define LWIP_NETIF_LINK_CALLBACK    1
 
-#define LWIP_STATS                  0
+// Only the counters "!bench" reads; the rest of the stats cost RAM for nothing.
+#define LWIP_STATS                  1
+#define MEMP_STATS                  1
+#define TCP_STATS                   1
+#define LINK_STATS                  0
+#define ETHARP_STATS                0
+#define IP_STATS                    0
+#define IPFRAG_STATS                0
+#define ICMP_STATS                  0
+#define UDP_STATS                   0
+#define MEM_STATS                   0
+#define SYS_STATS                   0
 #define LWIP_CHKSUM_ALGORITHM       3
 
 #define DHCP_DOES_ARP_CHECK         0
@@ -41,7 +80,6 @@
 
 #ifndef NDEBUG
 #define LWIP_DEBUG                  0
-#define LWIP_STATS                  0
 #define LWIP_STATS_DISPLAY          0
 #endif
 
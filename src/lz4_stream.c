@@ -0,0 +1,136 @@
+#include "lz4_stream.h"
+
+#include <string.h>
+
+#define WINDOW_MASK (LZ4_STREAM_WINDOW - 1)
+#define MIN_MATCH   4
+
+enum {
+    ST_TOKEN,
+    ST_LIT_LEN,
+    ST_LITERALS,
+    ST_OFFSET_LO,
+    ST_OFFSET_HI,
+    ST_MATCH_LEN,
+};
+
+void lz4_stream_init(lz4_stream_t *s) {
+    s->state = ST_TOKEN;
+    s->token = 0;
+    s->offset = 0;
+    s->lit_len = 0;
+    s->match_len = 0;
+    s->total_out = 0;
+    s->pos = 0;
+}
+
+static void window_append(lz4_stream_t *s, const uint8_t *data, size_t len) {
+    while (len > 0) {
+        size_t n = LZ4_STREAM_WINDOW - s->pos;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(&s->window[s->pos], data, n);
+        s->pos = (uint16_t)((s->pos + n) & WINDOW_MASK);
+        data += n;
+        len -= n;
+    }
+}
+
+// Expands the pending match into the window, handing out each contiguous run.
+static void copy_match(lz4_stream_t *s, lz4_stream_out_t out, void *ctx) {
+    uint32_t remaining = s->match_len;
+    while (remaining > 0) {
+        uint16_t run_start = s->pos;
+        do {
+            s->window[s->pos] = s->window[(s->pos - s->offset) & WINDOW_MASK];
+            s->pos = (uint16_t)((s->pos + 1) & WINDOW_MASK);
+            --remaining;
+        } while (remaining > 0 && s->pos != 0);
+
+        size_t run_len = (s->pos == 0 ? LZ4_STREAM_WINDOW : s->pos) - run_start;
+        out(ctx, (const char *)&s->window[run_start], run_len);
+    }
+    s->total_out += s->match_len;
+    s->match_len = 0;
+}
+
+lz4_stream_result_t lz4_stream_feed(lz4_stream_t *s, const uint8_t *in, size_t len,
+                                    lz4_stream_out_t out, void *ctx) {
+    const uint8_t *end = in + len;
+    while (in < end) {
+        switch (s->state) {
+            case ST_TOKEN:
+                s->token = *in++;
+                s->lit_len = s->token >> 4;
+                s->state = s->lit_len == 15 ? ST_LIT_LEN : ST_LITERALS;
+                break;
+
+            case ST_LIT_LEN: {
+                uint8_t b = *in++;
+                s->lit_len += b;
+                if (b != 255) {
+                    s->state = ST_LITERALS;
+                }
+                break;
+            }
+
+            case ST_LITERALS: {
+                size_t n = (size_t)(end - in);
+                if (n > s->lit_len) {
+                    n = s->lit_len;
+                }
+                if (n > 0) {
+                    out(ctx, (const char *)in, n);
+                    window_append(s, in, n);
+                    s->total_out += (uint32_t)n;
+                    s->lit_len -= (uint32_t)n;
+                    in += n;
+                }
+                if (s->lit_len == 0) {
+                    s->state = ST_OFFSET_LO;
+                }
+                break;
+            }
+
+            case ST_OFFSET_LO:
+                s->offset = *in++;
+                s->state = ST_OFFSET_HI;
+                break;
+
+            case ST_OFFSET_HI:
+                s->offset |= (uint16_t)(*in++ << 8);
+                if (s->offset == 0 || s->offset > LZ4_STREAM_WINDOW || s->offset > s->total_out) {
+                    return LZ4_STREAM_ERR_OFFSET;
+                }
+                s->match_len = (s->token & 15u) + MIN_MATCH;
+                if ((s->token & 15u) == 15) {
+                    s->state = ST_MATCH_LEN;
+                } else {
+                    copy_match(s, out, ctx);
+                    s->state = ST_TOKEN;
+                }
+                break;
+
+            case ST_MATCH_LEN: {
+                uint8_t b = *in++;
+                s->match_len += b;
+                if (b != 255) {
+                    copy_match(s, out, ctx);
+                    s->state = ST_TOKEN;
+                }
+                break;
+            }
+        }
+    }
+
+    // A zero-length literal run is already complete without further input.
+    if (s->state == ST_LITERALS && s->lit_len == 0) {
+        s->state = ST_OFFSET_LO;
+    }
+    return LZ4_STREAM_OK;
+}
+
+bool lz4_stream_complete(const lz4_stream_t *s) {
+    return s->state == ST_OFFSET_LO;
+}
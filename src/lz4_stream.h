@@ -0,0 +1,54 @@
+#ifndef LZ4_STREAM_H
+#define LZ4_STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Incremental decoder for the LZ4 block format. Input may arrive in pieces of
+// any size; history is kept in a fixed ring, so match offsets are limited to
+// LZ4_STREAM_WINDOW bytes instead of LZ4's usual 64 KiB.
+#ifndef LZ4_STREAM_WINDOW
+#define LZ4_STREAM_WINDOW 1024
+#endif
+
+#if (LZ4_STREAM_WINDOW & (LZ4_STREAM_WINDOW - 1)) != 0
+#error "LZ4_STREAM_WINDOW must be a power of two"
+#endif
+
+typedef enum {
+    LZ4_STREAM_OK = 0,
+    LZ4_STREAM_ERR_OFFSET,     // match reaches before the start or beyond the window
+} lz4_stream_result_t;
+
+typedef void (*lz4_stream_out_t)(void *ctx, const char *data, size_t len);
+
+typedef struct lz4_stream {
+    uint8_t state;
+    uint8_t token;
+    uint16_t offset;
+    uint32_t lit_len;
+    uint32_t match_len;
+    uint32_t total_out;
+    uint16_t pos;
+    uint8_t window[LZ4_STREAM_WINDOW];
+} lz4_stream_t;
+
+void lz4_stream_init(lz4_stream_t *s);
+
+// Decodes len input bytes, passing decompressed output to out as it is produced.
+lz4_stream_result_t lz4_stream_feed(lz4_stream_t *s, const uint8_t *in, size_t len,
+                                    lz4_stream_out_t out, void *ctx);
+
+// True if the input so far forms a complete block (ends after a literal run).
+bool lz4_stream_complete(const lz4_stream_t *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,358 @@
+#include "macro_table.h"
+
+#include <cctype>
+#include <cstring>
+
+#include "flash_store.h"
+#include "pico/critical_section.h"
+
+namespace {
+
+constexpr uint8_t kBlobVersion = 1;
+
+enum class SlotState : uint8_t {
+    kEmpty,
+    kUsed,
+    kDeleted,   // keeps probe chains intact
+};
+
+struct Slot {
+    SlotState state;
+    char name[kMacroNameMax];
+    uint16_t offset;        // source, then code, in s_pool
+    uint16_t source_len;
+    uint16_t code_len;
+};
+
+// Saved as: version, count, then per macro: name length, name, source length
+// (u16 LE), source, code length (u16 LE), code.
+constexpr size_t kBlobMax = 2 + kMacroSlots * (1 + kMacroNameMax + 4) + kMacroPoolSize;
+static_assert(kBlobMax <= FLASH_STORE_RECORD_MAX, "macro table does not fit into a flash record");
+
+static Slot s_slots[kMacroSlots];
+static uint8_t s_pool[kMacroPoolSize];
+static size_t s_pool_used = 0;
+static size_t s_count = 0;
+static volatile uint32_t s_generation = 0;
+static critical_section_t s_lock;
+static uint8_t s_blob[kBlobMax];
+
+uint32_t hash_name(const char *name, size_t len) {
+    // FNV-1a over the lower-cased name
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= static_cast<uint8_t>(tolower(static_cast<unsigned char>(name[i])));
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// stored is terminated, name is len bytes
+bool names_equal(const char *stored, const char *name, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        if (stored[i] == '\0' ||
+            tolower(static_cast<unsigned char>(stored[i])) != tolower(static_cast<unsigned char>(name[i]))) {
+            return false;
+        }
+    }
+    return stored[len] == '\0';
+}
+
+bool valid_name(const char *name) {
+    size_t len = strlen(name);
+    if (len == 0 || len >= kMacroNameMax) {
+        return false;
+    }
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char ch = static_cast<unsigned char>(name[i]);
+        if (!isgraph(ch) || ch == '<' || ch == '>') {
+            return false;
+        }
+    }
+    return true;
+}
+
+Slot *find(const char *name, size_t len) {
+    size_t i = hash_name(name, len) & (kMacroSlots - 1);
+    for (size_t n = 0; n < kMacroSlots; ++n, i = (i + 1) & (kMacroSlots - 1)) {
+        Slot &slot = s_slots[i];
+        if (slot.state == SlotState::kEmpty) {
+            return nullptr;
+        }
+        if (slot.state == SlotState::kUsed && names_equal(slot.name, name, len)) {
+            return &slot;
+        }
+    }
+    return nullptr;
+}
+
+// First free slot on the name's probe chain; the name must not be present.
+Slot *find_free(const char *name) {
+    size_t i = hash_name(name, strlen(name)) & (kMacroSlots - 1);
+    for (size_t n = 0; n < kMacroSlots; ++n, i = (i + 1) & (kMacroSlots - 1)) {
+        if (s_slots[i].state != SlotState::kUsed) {
+            return &s_slots[i];
+        }
+    }
+    return nullptr;
+}
+
+// Frees a slot and closes the gap its bytes leave in the pool. Caller holds
+// the lock.
+void remove_slot(Slot &slot) {
+    size_t start = slot.offset;
+    size_t len = static_cast<size_t>(slot.source_len) + slot.code_len;
+    memmove(s_pool + start, s_pool + start + len, s_pool_used - start - len);
+    s_pool_used -= len;
+    for (Slot &other : s_slots) {
+        if (other.state == SlotState::kUsed && other.offset > start) {
+            other.offset = static_cast<uint16_t>(other.offset - len);
+        }
+    }
+    slot.state = SlotState::kDeleted;
+    --s_count;
+}
+
+// Replaces a slot's code, moving the bytes after it. Caller holds the lock.
+bool replace_code(Slot &slot, const uint8_t *code, size_t code_len) {
+    if (s_pool_used - slot.code_len + code_len > kMacroPoolSize) {
+        return false;
+    }
+    size_t start = slot.offset + slot.source_len;
+    size_t old_end = start + slot.code_len;
+    memmove(s_pool + start + code_len, s_pool + old_end, s_pool_used - old_end);
+    for (Slot &other : s_slots) {
+        if (other.state == SlotState::kUsed && other.offset > slot.offset) {
+            other.offset = static_cast<uint16_t>(other.offset - slot.code_len + code_len);
+        }
+    }
+    memcpy(s_pool + start, code, code_len);
+    s_pool_used = s_pool_used - slot.code_len + code_len;
+    slot.code_len = static_cast<uint16_t>(code_len);
+    return true;
+}
+
+MacroDefineResult define(const char *name, const char *source, size_t source_len, const uint8_t *code, size_t code_len) {
+    if (!valid_name(name)) {
+        return MacroDefineResult::kBadName;
+    }
+
+    // Under the lock, as a recompile on core 0 may be resizing code.
+    critical_section_enter_blocking(&s_lock);
+    Slot *old = find(name, strlen(name));
+    size_t reclaim = old ? static_cast<size_t>(old->source_len) + old->code_len : 0;
+    if (s_pool_used - reclaim + source_len + code_len > kMacroPoolSize) {
+        critical_section_exit(&s_lock);
+        return MacroDefineResult::kNoSpace;
+    }
+    if (!old && s_count == kMacroSlots) {
+        critical_section_exit(&s_lock);
+        return MacroDefineResult::kTableFull;
+    }
+
+    if (old) {
+        remove_slot(*old);
+    }
+    Slot &slot = *find_free(name);
+    slot.state = SlotState::kUsed;
+    strcpy(slot.name, name);
+    slot.offset = static_cast<uint16_t>(s_pool_used);
+    slot.source_len = static_cast<uint16_t>(source_len);
+    slot.code_len = static_cast<uint16_t>(code_len);
+    memcpy(s_pool + s_pool_used, source, source_len);
+    memcpy(s_pool + s_pool_used + source_len, code, code_len);
+    s_pool_used += source_len + code_len;
+    ++s_count;
+    ++s_generation;
+    critical_section_exit(&s_lock);
+    return MacroDefineResult::kOk;
+}
+
+void put_u16(uint8_t *p, size_t v) {
+    p[0] = static_cast<uint8_t>(v);
+    p[1] = static_cast<uint8_t>(v >> 8);
+}
+
+uint16_t get_u16(const uint8_t *p) {
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+}  // namespace
+
+void macro_table_init() {
+    critical_section_init(&s_lock);
+}
+
+MacroDefineResult macro_table_define(const char *name, const char *source, const uint8_t *code, size_t code_len) {
+    return define(name, source, strlen(source), code, code_len);
+}
+
+bool macro_table_remove(const char *name) {
+    Slot *slot = find(name, strlen(name));
+    if (!slot) {
+        return false;
+    }
+    critical_section_enter_blocking(&s_lock);
+    remove_slot(*slot);
+    ++s_generation;
+    critical_section_exit(&s_lock);
+    return true;
+}
+
+int macro_table_copy(const char *name, size_t name_len, uint8_t *dst, size_t max) {
+    int len = -1;
+    critical_section_enter_blocking(&s_lock);
+    if (const Slot *slot = find(name, name_len)) {
+        len = slot->code_len;
+        if (slot->code_len <= max) {
+            memcpy(dst, s_pool + slot->offset + slot->source_len, slot->code_len);
+        }
+    }
+    critical_section_exit(&s_lock);
+    return len;
+}
+
+void macro_table_list(macro_list_fn_t fn, void *ctx) {
+    for (const Slot &slot : s_slots) {
+        char name[kMacroNameMax];
+        char source[kMacroSourceMax];
+        critical_section_enter_blocking(&s_lock);
+        bool used = slot.state == SlotState::kUsed;
+        MacroInfo info = {name, source, slot.source_len < kMacroSourceMax ? slot.source_len : uint16_t{kMacroSourceMax},
+                          slot.code_len};
+        if (used) {
+            strcpy(name, slot.name);
+            memcpy(source, s_pool + slot.offset, info.source_len);
+        }
+        critical_section_exit(&s_lock);
+        if (used) {
+            fn(info, ctx);
+        }
+    }
+}
+
+size_t macro_table_recompile(macro_compile_fn_t compile) {
+    static char source[kMacroSourceMax + 1];
+    size_t failed = 0;
+    for (size_t pass = 0; pass < kMacroSlots; ++pass) {
+        bool changed = false;
+        failed = 0;
+        for (Slot &slot : s_slots) {
+            critical_section_enter_blocking(&s_lock);
+            size_t source_len = slot.source_len;
+            bool used = slot.state == SlotState::kUsed && source_len <= kMacroSourceMax;
+            if (used) {
+                memcpy(source, s_pool + slot.offset, source_len);
+            }
+            critical_section_exit(&s_lock);
+            if (!used) {
+                continue;
+            }
+
+            // Compiling copies other macros out under the lock, so it runs
+            // without it.
+            source[source_len] = '\0';
+            size_t code_len = 0;
+            const uint8_t *code = compile(source, code_len);
+            if (!code) {
+                ++failed;
+                continue;
+            }
+
+            critical_section_enter_blocking(&s_lock);
+            // A macro core 1 redefined or removed meanwhile is left alone.
+            const uint8_t *old = s_pool + slot.offset + slot.source_len;
+            if (slot.state == SlotState::kUsed && slot.source_len == source_len &&
+                memcmp(s_pool + slot.offset, source, source_len) == 0 &&
+                (slot.code_len != code_len || memcmp(old, code, code_len) != 0)) {
+                if (replace_code(slot, code, code_len)) {
+                    changed = true;
+                    ++s_generation;
+                } else {
+                    ++failed;
+                }
+            }
+            critical_section_exit(&s_lock);
+        }
+        if (!changed) {
+            break;
+        }
+    }
+    return failed;
+}
+
+uint32_t macro_table_generation() {
+    return s_generation;
+}
+
+size_t macro_table_count() {
+    return s_count;
+}
+
+size_t macro_table_pool_used() {
+    return s_pool_used;
+}
+
+bool macro_table_save() {
+    if (s_count == 0) {
+        return flash_store_erase(FLASH_STORE_MACROS);
+    }
+
+    critical_section_enter_blocking(&s_lock);
+    size_t n = 0;
+    s_blob[n++] = kBlobVersion;
+    s_blob[n++] = static_cast<uint8_t>(s_count);
+    for (const Slot &slot : s_slots) {
+        if (slot.state != SlotState::kUsed) {
+            continue;
+        }
+        size_t name_len = strlen(slot.name);
+        s_blob[n++] = static_cast<uint8_t>(name_len);
+        memcpy(s_blob + n, slot.name, name_len);
+        n += name_len;
+        put_u16(s_blob + n, slot.source_len);
+        memcpy(s_blob + n + 2, s_pool + slot.offset, slot.source_len);
+        n += 2 + slot.source_len;
+        put_u16(s_blob + n, slot.code_len);
+        memcpy(s_blob + n + 2, s_pool + slot.offset + slot.source_len, slot.code_len);
+        n += 2 + slot.code_len;
+    }
+    critical_section_exit(&s_lock);
+    return flash_store_write(FLASH_STORE_MACROS, s_blob, n);
+}
+
+// Takes the saved code as is, to be recompiled by the caller against the
+// current settings; a record from another opcode version is ignored.
+bool macro_table_load() {
+    int len = flash_store_read(FLASH_STORE_MACROS, s_blob, sizeof(s_blob));
+    if (len < 2 || s_blob[0] != kBlobVersion) {
+        return false;
+    }
+
+    size_t end = static_cast<size_t>(len);
+    size_t n = 2;
+    for (unsigned i = 0; i < s_blob[1]; ++i) {
+        char name[kMacroNameMax];
+        if (n >= end || s_blob[n] >= kMacroNameMax || n + 1 + s_blob[n] + 2 > end) {
+            return false;
+        }
+        size_t name_len = s_blob[n];
+        memcpy(name, s_blob + n + 1, name_len);
+        name[name_len] = '\0';
+        n += 1 + name_len;
+
+        size_t source_len = get_u16(s_blob + n);
+        const char *source = reinterpret_cast<const char *>(s_blob + n + 2);
+        n += 2 + source_len;
+        if (n + 2 > end) {
+            return false;
+        }
+        size_t code_len = get_u16(s_blob + n);
+        const uint8_t *code = s_blob + n + 2;
+        n += 2 + code_len;
+        if (n > end || define(name, source, source_len, code, code_len) != MacroDefineResult::kOk) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,74 @@
+#ifndef MACRO_TABLE_H
+#define MACRO_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Macros defined at runtime with !def. Bodies are compiled to opcodes when
+// they are defined, and again from their source whenever a setting the code
+// depends on changes; using one copies its code into the line's program
+// without parsing anything. Names are looked up through an open-addressing
+// hash table; source text and code share one byte pool.
+//
+// The table is loaded on core 0 before core 1 starts. After that core 1 (the
+// REPL) defines and removes macros, and core 0 copies code out and swaps in
+// recompiled code, all under the table's lock.
+
+constexpr size_t kMacroSlots = 32;      // power of two
+constexpr size_t kMacroNameMax = 24;    // including the terminator
+constexpr size_t kMacroPoolSize = 3072;
+constexpr size_t kMacroSourceMax = 255;     // a !def body is part of one REPL line
+
+enum class MacroDefineResult : uint8_t {
+    kOk,
+    kBadName,
+    kTableFull,
+    kNoSpace,
+};
+
+struct MacroInfo {
+    const char *name;
+    const char *source;     // not terminated
+    uint16_t source_len;
+    uint16_t code_len;
+};
+
+typedef void (*macro_list_fn_t)(const MacroInfo &macro, void *ctx);
+
+// Compiles a terminated body; returns its code, valid until the next call,
+// or nullptr if the body has errors.
+typedef const uint8_t *(*macro_compile_fn_t)(const char *source, size_t &code_len);
+
+void macro_table_init();
+
+// Replaces an existing macro of the same name (case-insensitive).
+MacroDefineResult macro_table_define(const char *name, const char *source, const uint8_t *code, size_t code_len);
+
+bool macro_table_remove(const char *name);
+
+// Copies the code of the macro named by the name_len bytes at name (not
+// terminated) to dst if it fits in max bytes. Returns the code length (also
+// when it did not fit), or -1 if there is no such macro.
+int macro_table_copy(const char *name, size_t name_len, uint8_t *dst, size_t max);
+
+// Core 1 only. fn gets a copy and runs outside the lock.
+void macro_table_list(macro_list_fn_t fn, void *ctx);
+
+// Compiles every macro again from its source and swaps in the new code,
+// repeating until a pass changes nothing, so that macros using other macros
+// get their new code too. A macro whose body no longer compiles keeps its
+// old code; returns how many did.
+size_t macro_table_recompile(macro_compile_fn_t compile);
+
+// Changes whenever a macro is defined, removed or recompiled, so anything
+// compiled against an older value may be stale.
+uint32_t macro_table_generation();
+
+size_t macro_table_count();
+size_t macro_table_pool_used();
+
+// The whole table as one flash record.
+bool macro_table_save();
+bool macro_table_load();
+
+#endif
@@ -0,0 +1,305 @@
+#include "metrics_log.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hardware/flash.h"
+#include "hardware/regs/addressmap.h"
+#include "hardware/watchdog.h"
+#include "pico/flash.h"
+#include "pico/stdlib.h"
+
+#include "boot_log.h"
+#include "flash_store.h"
+
+#define PAGE_MAGIC          0x314d5042u  // "BPM1"
+#define WRITE_TIMEOUT_MS    100
+#define PAGES_PER_SECTOR    (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)
+#define RING_PAGES          (METRICS_LOG_SECTORS * PAGES_PER_SECTOR)
+
+typedef enum {
+    EV_BOOT,        // arg: metrics_reset_t
+    EV_PHASE,       // arg: boot_phase_t, value: us since reset
+    EV_COUNTER,     // arg: metrics_counter_t, value: count since boot
+    EV_LOST,        // value: entries dropped while the page was full
+} entry_event_t;
+
+typedef struct {
+    uint32_t ms;        // since this boot
+    uint32_t value;
+    uint8_t event;      // entry_event_t
+    uint8_t arg;
+    uint16_t reserved;
+} entry_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;       // pages written before this one, to find the newest
+    uint16_t boot;      // counts on from the newest page found at boot
+    uint8_t count;      // entries in use
+    uint8_t reserved;
+    uint32_t crc;       // of the entries in use
+} page_header_t;
+
+#define PAGE_ENTRIES ((FLASH_PAGE_SIZE - sizeof(page_header_t)) / sizeof(entry_t))
+
+typedef struct {
+    page_header_t header;
+    entry_t entries[PAGE_ENTRIES];
+} page_t;
+
+_Static_assert(sizeof(page_t) == FLASH_PAGE_SIZE, "a log page must fill a flash page");
+
+typedef struct {
+    uint32_t page;
+    const page_t *data;
+} write_job_t;
+
+static volatile uint32_t s_counters[METRICS_COUNTER_COUNT];
+static uint32_t s_logged[METRICS_COUNTER_COUNT];   // values as last logged
+
+static const bool s_urgent[METRICS_COUNTER_COUNT] = {
+    [METRICS_USB_RESETS]   = true,
+    [METRICS_PRESSES_LOST] = true,
+};
+
+static const char *const s_counter_names[METRICS_COUNTER_COUNT] = {
+    [METRICS_LINES]             = "lines",
+    [METRICS_REPORTS]           = "reports",
+    [METRICS_RX_BYTES]          = "rx bytes",
+    [METRICS_LINES_DROPPED]     = "lines dropped",
+    [METRICS_QUEUE_OVERFLOWS]   = "queue overflows",
+    [METRICS_ERRORS_SUPPRESSED] = "errors suppressed",
+    [METRICS_USB_RESETS]        = "usb resets",
+    [METRICS_PRESSES_LOST]      = "presses lost",
+};
+
+static const char *const s_reset_names[METRICS_RESET_COUNT] = {
+    [METRICS_RESET_POWER_ON] = "power-on",
+    [METRICS_RESET_REBOOT]   = "reboot",
+};
+
+// Core 1 state
+static page_t s_page;               // being filled
+static uint32_t s_page_since_ms;    // when its first entry came in
+static uint32_t s_lost = 0;
+static uint32_t s_next = 0;         // ring page to write next
+static uint32_t s_seq = 0;
+static uint16_t s_boot = 1;
+static uint32_t s_phases_logged = 0;
+static uint32_t s_sampled_ms = 0;
+
+void metrics_set(metrics_counter_t counter, uint32_t value) {
+    s_counters[counter] = value;
+}
+
+void metrics_add(metrics_counter_t counter, uint32_t n) {
+    s_counters[counter] += n;
+}
+
+static uint32_t now_ms(void) {
+    return to_ms_since_boot(get_absolute_time());
+}
+
+static uint32_t ring_offset(uint32_t page) {
+    return PICO_FLASH_SIZE_BYTES - (FLASH_STORE_RECORD_COUNT + METRICS_LOG_SECTORS) * FLASH_SECTOR_SIZE +
+           page * FLASH_PAGE_SIZE;
+}
+
+static const page_t *ring_page(uint32_t page) {
+    return (const page_t *)(XIP_BASE + ring_offset(page));
+}
+
+static bool page_valid(const page_t *p) {
+    return p->header.magic == PAGE_MAGIC && p->header.count <= PAGE_ENTRIES &&
+           flash_store_crc32(p->entries, p->header.count * sizeof(entry_t)) == p->header.crc;
+}
+
+static bool page_blank(const page_t *p) {
+    const uint32_t *words = (const uint32_t *)p;
+    for (size_t i = 0; i < FLASH_PAGE_SIZE / sizeof(uint32_t); ++i) {
+        if (words[i] != 0xffffffffu) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Runs with the other core parked and interrupts off; flash is not readable.
+// The first page of a sector erases it, dropping the oldest pages.
+static void write_page(void *param) {
+    const write_job_t *job = (const write_job_t *)param;
+    if (job->page % PAGES_PER_SECTOR == 0) {
+        flash_range_erase(ring_offset(job->page), FLASH_SECTOR_SIZE);
+    }
+    flash_range_program(ring_offset(job->page), (const uint8_t *)job->data, FLASH_PAGE_SIZE);
+}
+
+static void erase_ring(void *param) {
+    (void)param;
+    flash_range_erase(ring_offset(0), METRICS_LOG_SECTORS * FLASH_SECTOR_SIZE);
+}
+
+static void record(entry_event_t event, uint8_t arg, uint32_t value) {
+    if (s_page.header.count == PAGE_ENTRIES) {
+        ++s_lost;
+        return;
+    }
+    uint32_t ms = now_ms();
+    if (s_page.header.count == 0) {
+        s_page_since_ms = ms;
+    }
+    s_page.entries[s_page.header.count++] = (entry_t){ms, value, (uint8_t)event, arg, 0};
+}
+
+static void flush(void) {
+    s_page.header.magic = PAGE_MAGIC;
+    s_page.header.seq = s_seq;
+    s_page.header.boot = s_boot;
+    s_page.header.crc = flash_store_crc32(s_page.entries, s_page.header.count * sizeof(entry_t));
+    write_job_t job = {s_next, &s_page};
+    if (flash_safe_execute(write_page, &job, WRITE_TIMEOUT_MS) != PICO_OK) {
+        return;     // nothing was written; try again on a later poll
+    }
+    s_next = (s_next + 1) % RING_PAGES;
+    ++s_seq;
+    s_page.header.count = 0;
+    if (s_lost > 0) {
+        uint32_t lost = s_lost;
+        s_lost = 0;
+        record(EV_LOST, 0, lost);
+    }
+}
+
+void metrics_log_init(void) {
+    memset(&s_page, 0xff, sizeof(s_page));
+    s_page.header.count = 0;
+
+    const page_t *newest = NULL;
+    for (uint32_t i = 0; i < RING_PAGES; ++i) {
+        const page_t *p = ring_page(i);
+        if (page_valid(p) && (!newest || p->header.seq > newest->header.seq)) {
+            newest = p;
+            s_next = (i + 1) % RING_PAGES;
+        }
+    }
+    if (newest) {
+        s_seq = newest->header.seq + 1;
+        s_boot = (uint16_t)(newest->header.boot + 1);
+    }
+    // A page cut short by a reset may be neither valid nor blank; rather than
+    // program over it, go on to the next sector, which gets erased first.
+    while (s_next % PAGES_PER_SECTOR != 0 && !page_blank(ring_page(s_next))) {
+        s_next = (s_next + 1) % RING_PAGES;
+    }
+
+    metrics_reset_t reset = watchdog_caused_reboot() ? METRICS_RESET_REBOOT : METRICS_RESET_POWER_ON;
+    record(EV_BOOT, (uint8_t)reset, s_boot);
+}
+
+void metrics_log_poll(bool idle) {
+    for (int i = 0; i < BOOT_PHASE_COUNT; ++i) {
+        uint32_t us = boot_phase_us((boot_phase_t)i);
+        if (us != 0 && !(s_phases_logged & (1u << i))) {
+            s_phases_logged |= 1u << i;
+            record(EV_PHASE, (uint8_t)i, us);
+        }
+    }
+
+    uint32_t now = now_ms();
+    bool sample = now - s_sampled_ms >= METRICS_SAMPLE_MS;
+    if (sample) {
+        s_sampled_ms = now;
+    }
+    for (int i = 0; i < METRICS_COUNTER_COUNT; ++i) {
+        uint32_t value = s_counters[i];
+        if (value != s_logged[i] && (sample || s_urgent[i])) {
+            s_logged[i] = value;
+            record(EV_COUNTER, (uint8_t)i, value);
+        }
+    }
+
+    if (idle && s_page.header.count > 0 &&
+        (s_page.header.count == PAGE_ENTRIES || now - s_page_since_ms >= METRICS_FLUSH_MS)) {
+        flush();
+    }
+}
+
+// "log: <boot> <seconds since boot>s <what>"
+static void write_entry(const entry_t *e, uint16_t boot, void (*write)(const char *text)) {
+    char buf[96];
+    int n = snprintf(buf, sizeof(buf), "log: %5u %10.3fs ", boot, e->ms / 1000.0);
+    switch (e->event) {
+        case EV_BOOT:
+            snprintf(buf + n, sizeof(buf) - (size_t)n, "boot, %s\r\n",
+                     e->arg < METRICS_RESET_COUNT && s_reset_names[e->arg] ? s_reset_names[e->arg] : "?");
+            break;
+        case EV_PHASE:
+            snprintf(buf + n, sizeof(buf) - (size_t)n, "%s at %.3f ms\r\n",
+                     e->arg < BOOT_PHASE_COUNT ? boot_phase_name((boot_phase_t)e->arg) : "?", e->value / 1000.0);
+            break;
+        case EV_COUNTER:
+            snprintf(buf + n, sizeof(buf) - (size_t)n, "%s %lu\r\n",
+                     e->arg < METRICS_COUNTER_COUNT ? s_counter_names[e->arg] : "?", (unsigned long)e->value);
+            break;
+        case EV_LOST:
+            snprintf(buf + n, sizeof(buf) - (size_t)n, "%lu entries lost\r\n", (unsigned long)e->value);
+            break;
+        default:
+            snprintf(buf + n, sizeof(buf) - (size_t)n, "event %u\r\n", e->event);
+            break;
+    }
+    write(buf);
+}
+
+void metrics_log_dump(size_t max, void (*write)(const char *text)) {
+    // Walk back from the newest page until there are enough entries.
+    size_t in_ram = s_page.header.count;
+    size_t want = max > in_ram ? max - in_ram : 0;
+    uint32_t first = s_next;
+    size_t pages = 0;
+    size_t found = 0;
+    while (pages < RING_PAGES && found < want) {
+        uint32_t prev = (first + RING_PAGES - 1) % RING_PAGES;
+        const page_t *p = ring_page(prev);
+        if (!page_valid(p) || (pages > 0 && p->header.seq >= ring_page(first)->header.seq)) {
+            break;
+        }
+        first = prev;
+        found += p->header.count;
+        ++pages;
+    }
+
+    size_t skip = found > want ? found - want : 0;
+    for (size_t i = 0; i < pages; ++i) {
+        const page_t *p = ring_page((first + (uint32_t)i) % RING_PAGES);
+        for (size_t j = 0; j < p->header.count; ++j) {
+            if (skip > 0) {
+                --skip;
+            } else {
+                write_entry(&p->entries[j], p->header.boot, write);
+            }
+        }
+    }
+    for (size_t j = in_ram > max ? in_ram - max : 0; j < in_ram; ++j) {
+        write_entry(&s_page.entries[j], s_boot, write);
+    }
+
+    size_t used = 0;
+    for (uint32_t i = 0; i < RING_PAGES; ++i) {
+        used += page_valid(ring_page(i));
+    }
+    char buf[96];
+    snprintf(buf, sizeof(buf), "log: boot %u, %u/%u pages in flash, %u entries not written yet\r\n", s_boot,
+             (unsigned)used, (unsigned)RING_PAGES, (unsigned)in_ram);
+    write(buf);
+}
+
+bool metrics_log_clear(void) {
+    if (flash_safe_execute(erase_ring, NULL, WRITE_TIMEOUT_MS) != PICO_OK) {
+        return false;
+    }
+    s_next = 0;
+    s_seq = 0;
+    return true;
+}
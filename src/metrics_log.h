@@ -0,0 +1,76 @@
+#ifndef METRICS_LOG_H
+#define METRICS_LOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// What the firmware did, kept in flash so that it can be looked at after a
+// crash or a power cut: why and when each boot happened, how long the boot
+// phases took, and samples of the counters below.
+//
+// Entries are collected in RAM and written a flash page at a time into a
+// ring of METRICS_LOG_SECTORS sectors, right below the flash_store records.
+// The ring is written in order and a sector is only erased when the ring
+// comes round to it again, so every sector wears at the same rate. Writes
+// only happen while the caller says it is idle, never in the middle of a
+// line; if RAM fills up meanwhile, further entries are counted and dropped.
+//
+// Counters are plain words, each written from one core only. Everything
+// else runs on core 1.
+
+#define METRICS_LOG_SECTORS 8
+
+// Sample interval for the counters; those marked urgent are logged as soon
+// as they change.
+#define METRICS_SAMPLE_MS   60000
+// How long an entry may wait in RAM for the rest of its page.
+#define METRICS_FLUSH_MS    10000
+
+typedef enum {
+    METRICS_LINES,              // core 0: lines typed
+    METRICS_REPORTS,            // core 0: HID reports sent
+    METRICS_RX_BYTES,           // core 1: bytes received from REPL clients
+    METRICS_LINES_DROPPED,      // core 1: text queue full
+    METRICS_QUEUE_OVERFLOWS,    // core 0: replies and result records lost to a full queue
+    METRICS_ERRORS_SUPPRESSED,  // core 0: compile errors not sent to the client
+    METRICS_USB_RESETS,         // core 0, urgent
+    METRICS_PRESSES_LOST,       // core 0, urgent
+    METRICS_COUNTER_COUNT
+} metrics_counter_t;
+
+typedef enum {
+    METRICS_RESET_POWER_ON,     // power-on or the RUN pin
+    // The firmware never arms the watchdog, so a timeout is not a reason of
+    // its own; 1 stays unused so that older log entries read the same.
+    METRICS_RESET_REBOOT = 2,   // a reset through the watchdog, e.g. a reboot request
+    METRICS_RESET_COUNT
+} metrics_reset_t;
+
+void metrics_set(metrics_counter_t counter, uint32_t value);
+void metrics_add(metrics_counter_t counter, uint32_t n);
+
+// Finds where the ring left off and logs this boot. After flash_store_init.
+void metrics_log_init(void);
+
+// Logs boot phases as they are reached and counters as they are due, and
+// writes a page once one is full or has waited METRICS_FLUSH_MS. Call it
+// often; it only touches flash when idle is true.
+void metrics_log_poll(bool idle);
+
+// Writes the last max entries, oldest first, one line each, followed by a
+// summary line.
+void metrics_log_dump(size_t max, void (*write)(const char *text));
+
+// Erases the ring, and with it everything from before this boot.
+bool metrics_log_clear(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1050 @@
+#include "payload.h"
+
+#include <cctype>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "macro_table.h"
+#include "tusb.h"
+
+namespace {
+
+constexpr size_t kTagMaxLen = 64;
+
+struct KeyName {
+    const char *name;
+    uint8_t keycode;
+    uint8_t modifier;
+};
+
+static constexpr KeyName key_names[] = {
+    // Modifiers (keycode 0 = modifier-only)
+    {"ctrl",        0, KEYBOARD_MODIFIER_LEFTCTRL},
+    {"control",     0, KEYBOARD_MODIFIER_LEFTCTRL},
+    {"alt",         0, KEYBOARD_MODIFIER_LEFTALT},
+    {"shift",       0, KEYBOARD_MODIFIER_LEFTSHIFT},
+    {"super",       0, KEYBOARD_MODIFIER_LEFTGUI},
+    {"win",         0, KEYBOARD_MODIFIER_LEFTGUI},
+    {"gui",         0, KEYBOARD_MODIFIER_LEFTGUI},
+    {"cmd",         0, KEYBOARD_MODIFIER_LEFTGUI},
+
+    // Special keys
+    {"enter",       HID_KEY_ENTER,        0},
+    {"return",      HID_KEY_ENTER,        0},
+    {"tab",         HID_KEY_TAB,          0},
+    {"esc",         HID_KEY_ESCAPE,       0},
+    {"escape",      HID_KEY_ESCAPE,       0},
+    {"backspace",   HID_KEY_BACKSPACE,    0},
+    {"delete",      HID_KEY_DELETE,       0},
+    {"del",         HID_KEY_DELETE,       0},
+    {"space",       HID_KEY_SPACE,        0},
+
+    // Arrow keys
+    {"up",          HID_KEY_ARROW_UP,     0},
+    {"down",        HID_KEY_ARROW_DOWN,   0},
+    {"left",        HID_KEY_ARROW_LEFT,   0},
+    {"right",       HID_KEY_ARROW_RIGHT,  0},
+
+    // Navigation
+    {"home",        HID_KEY_HOME,         0},
+    {"end",         HID_KEY_END,          0},
+    {"pageup",      HID_KEY_PAGE_UP,      0},
+    {"pagedown",    HID_KEY_PAGE_DOWN,    0},
+    {"insert",      HID_KEY_INSERT,       0},
+    {"capslock",    HID_KEY_CAPS_LOCK,    0},
+    {"printscreen", HID_KEY_PRINT_SCREEN, 0},
+
+    // Function keys
+    {"f1",  HID_KEY_F1,  0},
+    {"f2",  HID_KEY_F2,  0},
+    {"f3",  HID_KEY_F3,  0},
+    {"f4",  HID_KEY_F4,  0},
+    {"f5",  HID_KEY_F5,  0},
+    {"f6",  HID_KEY_F6,  0},
+    {"f7",  HID_KEY_F7,  0},
+    {"f8",  HID_KEY_F8,  0},
+    {"f9",  HID_KEY_F9,  0},
+    {"f10", HID_KEY_F10, 0},
+    {"f11", HID_KEY_F11, 0},
+    {"f12", HID_KEY_F12, 0},
+};
+
+static constexpr size_t kKeyNameCount = sizeof(key_names) / sizeof(key_names[0]);
+
+// Keys outside the keyboard usage page, sent as their own reports. They do
+// not combine with modifiers.
+struct ControlName {
+    const char *name;
+    uint8_t report_id;
+    uint16_t usage;
+};
+
+static constexpr ControlName control_names[] = {
+    {"mute",           HID_REPORT_ID_CONSUMER, HID_USAGE_CONSUMER_MUTE},
+    {"volumeup",       HID_REPORT_ID_CONSUMER, HID_USAGE_CONSUMER_VOLUME_INCREMENT},
+    {"volumedown",     HID_REPORT_ID_CONSUMER, HID_USAGE_CONSUMER_VOLUME_DECREMENT},
+    {"playpause",      HID_REPORT_ID_CONSUMER, HID_USAGE_CONSUMER_PLAY_PAUSE},
+    {"nexttrack",      HID_REPORT_ID_CONSUMER, HID_USAGE_CONSUMER_SCAN_NEXT},
+    {"prevtrack",      HID_REPORT_ID_CONSUMER, HID_USAGE_CONSUMER_SCAN_PREVIOUS},
+    {"stopmedia",      HID_REPORT_ID_CONSUMER, HID_USAGE_CONSUMER_STOP},
+    {"brightnessup",   HID_REPORT_ID_CONSUMER, HID_USAGE_CONSUMER_BRIGHTNESS_INCREMENT},
+    {"brightnessdown", HID_REPORT_ID_CONSUMER, HID_USAGE_CONSUMER_BRIGHTNESS_DECREMENT},
+
+    // System control reports carry 1-3 for these three usages
+    {"power",          HID_REPORT_ID_SYSTEM,   HID_USAGE_DESKTOP_SYSTEM_POWER_DOWN - 0x80},
+    {"systemsleep",    HID_REPORT_ID_SYSTEM,   HID_USAGE_DESKTOP_SYSTEM_SLEEP - 0x80},
+    {"systemwake",     HID_REPORT_ID_SYSTEM,   HID_USAGE_DESKTOP_SYSTEM_WAKE_UP - 0x80},
+};
+
+struct Macro {
+    const char *name;
+    const char *expansion;
+};
+
+static constexpr Macro macros[] = {
+    {"selectall",    "<primary+a>"},
+    {"copyall",      "<primary+a><primary+c>"},
+    {"paste",        "<primary+v>"},
+    {"hello",        "Hello, World!<enter>"},
+    {"slack",        "<cmd+space>slack<sleep:1><enter>"},
+    {"s:vie",        "<cmd+k>office-vie<enter>"},
+    {"s:general",    "<cmd+k>general<enter>"},
+    {"s:cake",       "CAKE! I'll bring cake for everyone! @cakekeepersvie<ctrl+enter><enter>"},
+    {"autocake",     "<<slack>><<s:vie>><<s:cake>><<s:general>>"},
+};
+
+static constexpr size_t kMacroCount = sizeof(macros) / sizeof(macros[0]);
+
+// A keyboard layout: the key, and shift or not, for every ASCII character it
+// can type. Indexed by the character, so plain text costs one lookup per byte.
+struct LayoutKey {
+    uint8_t keycode;    // 0: no key for this character
+    uint8_t modifier;
+};
+
+struct AsciiLayout {
+    LayoutKey keys[128];
+};
+
+constexpr AsciiLayout us_layout() {
+    AsciiLayout l{};
+    constexpr uint8_t kShift = KEYBOARD_MODIFIER_LEFTSHIFT;
+    for (int i = 0; i < 26; ++i) {
+        l.keys['a' + i] = {static_cast<uint8_t>(HID_KEY_A + i), 0};
+        l.keys['A' + i] = {static_cast<uint8_t>(HID_KEY_A + i), kShift};
+    }
+    // HID orders the digit row 1..9, 0
+    const char digits[] = "1234567890";
+    const char shifted_digits[] = "!@#$%^&*()";
+    for (int i = 0; i < 10; ++i) {
+        l.keys[static_cast<uint8_t>(digits[i])] = {static_cast<uint8_t>(HID_KEY_1 + i), 0};
+        l.keys[static_cast<uint8_t>(shifted_digits[i])] = {static_cast<uint8_t>(HID_KEY_1 + i), kShift};
+    }
+    struct Pair {
+        char plain;
+        char shifted;
+        uint8_t keycode;
+    };
+    const Pair punctuation[] = {
+        {'-', '_', HID_KEY_MINUS},         {'=', '+', HID_KEY_EQUAL},
+        {'[', '{', HID_KEY_BRACKET_LEFT},  {']', '}', HID_KEY_BRACKET_RIGHT},
+        {'\\', '|', HID_KEY_BACKSLASH},    {';', ':', HID_KEY_SEMICOLON},
+        {'\'', '"', HID_KEY_APOSTROPHE},   {'`', '~', HID_KEY_GRAVE},
+        {',', '<', HID_KEY_COMMA},         {'.', '>', HID_KEY_PERIOD},
+        {'/', '?', HID_KEY_SLASH},
+    };
+    for (const Pair &p : punctuation) {
+        l.keys[static_cast<uint8_t>(p.plain)] = {p.keycode, 0};
+        l.keys[static_cast<uint8_t>(p.shifted)] = {p.keycode, kShift};
+    }
+    l.keys[' '] = {HID_KEY_SPACE, 0};
+    l.keys['\t'] = {HID_KEY_TAB, 0};
+    l.keys['\n'] = {HID_KEY_ENTER, 0};
+    return l;
+}
+
+static constexpr AsciiLayout kUsLayout = us_layout();
+
+bool char_to_key(char c, uint8_t &keycode, uint8_t &modifier) {
+    unsigned char u = static_cast<unsigned char>(c);
+    if (u >= 128 || kUsLayout.keys[u].keycode == 0) {
+        return false;
+    }
+    keycode = kUsLayout.keys[u].keycode;
+    modifier = kUsLayout.keys[u].modifier;
+    return true;
+}
+
+// How a character without a key is typed: the code point as digits, with a
+// key combo before and after them and optionally a modifier held over them.
+struct UnicodeStrategy {
+    uint8_t prefix_modifier;
+    uint8_t prefix_key;         // 0: none
+    uint8_t hold;               // held over the digits, 0: none
+    uint8_t base;               // 0: no strategy
+    uint8_t min_digits;         // padded with leading zeros
+    bool keypad;                // digits from the keypad
+    bool utf16;                 // above U+FFFF as a surrogate pair
+    uint32_t max;               // highest code point it can enter
+    uint8_t suffix_key;         // 0: none
+};
+
+// Indexed by UnicodeMode.
+static constexpr UnicodeStrategy kUnicodeStrategies[kUnicodeModeCount] = {
+    // kNone
+    {0, 0, 0, 0, 0, false, false, 0, 0},
+    // kLinux: up to six hex digits, committed by Space
+    {KEYBOARD_MODIFIER_LEFTCTRL | KEYBOARD_MODIFIER_LEFTSHIFT, HID_KEY_U, 0,
+     16, 1, false, false, 0x10FFFF, HID_KEY_SPACE},
+    // kWindows: committed when Alt goes up. The leading zero makes codes
+    // below 256 Windows-1252, which is Latin-1 from U+00A0 on, rather than
+    // the OEM code page.
+    {0, 0, KEYBOARD_MODIFIER_LEFTALT, 10, 4, true, false, 0xFFFF, 0},
+    // kMac: four hex digits per UTF-16 unit, committed when Option goes up
+    {0, 0, KEYBOARD_MODIFIER_LEFTALT, 16, 4, false, true, 0x10FFFF, 0},
+};
+
+// Set by core 0 from !unicode and !os, read by compiles on both cores
+static volatile UnicodeMode s_unicode_mode = UnicodeMode::kNone;
+static volatile uint8_t s_primary_modifier = KEYBOARD_MODIFIER_LEFTCTRL;
+// Width in the high half, height in the low one, so a compile on core 1
+// never sees half of a change.
+static volatile uint32_t s_screen = (static_cast<uint32_t>(kScreenDefaultWidth) << 16) | kScreenDefaultHeight;
+
+// Decodes the UTF-8 sequence at p, which starts with a byte >= 0x80, and
+// returns its length. An ill-formed sequence gives cp = UINT32_MAX and the
+// length of its longest valid-looking prefix, at least 1, so decoding picks
+// up at the next byte that can start a character.
+size_t decode_utf8(const char *p, uint32_t &cp) {
+    const unsigned char *s = reinterpret_cast<const unsigned char *>(p);
+    cp = UINT32_MAX;
+    size_t len;
+    uint32_t value;
+    unsigned char lo = 0x80;    // allowed range of the second byte
+    unsigned char hi = 0xBF;
+    if (s[0] >= 0xC2 && s[0] <= 0xDF) {
+        len = 2;
+        value = s[0] & 0x1F;
+    } else if (s[0] >= 0xE0 && s[0] <= 0xEF) {
+        len = 3;
+        value = s[0] & 0x0F;
+        lo = s[0] == 0xE0 ? 0xA0 : 0x80;    // overlong
+        hi = s[0] == 0xED ? 0x9F : 0xBF;    // surrogates
+    } else if (s[0] >= 0xF0 && s[0] <= 0xF4) {
+        len = 4;
+        value = s[0] & 0x07;
+        lo = s[0] == 0xF0 ? 0x90 : 0x80;    // overlong
+        hi = s[0] == 0xF4 ? 0x8F : 0xBF;    // above U+10FFFF
+    } else {
+        return 1;
+    }
+    if (s[1] < lo || s[1] > hi) {
+        return 1;
+    }
+    for (size_t i = 1; i < len; ++i) {
+        if ((s[i] & 0xC0) != 0x80) {
+            return i;   // also stops at the terminator
+        }
+        value = (value << 6) | (s[i] & 0x3F);
+    }
+    cp = value;
+    return len;
+}
+
+// Part of the text being compiled, looked at in place: tags, names and
+// numbers are never copied out or terminated.
+struct Span {
+    const char *p;
+    size_t len;
+};
+
+bool span_equals(Span s, const char *name) {
+    for (size_t i = 0; i < s.len; ++i) {
+        if (name[i] == '\0' ||
+            tolower(static_cast<unsigned char>(s.p[i])) != tolower(static_cast<unsigned char>(name[i]))) {
+            return false;
+        }
+    }
+    return name[s.len] == '\0';
+}
+
+bool span_starts_with(Span s, const char *prefix) {
+    size_t len = strlen(prefix);
+    return s.len >= len && memcmp(s.p, prefix, len) == 0;
+}
+
+Span span_from(Span s, size_t pos) {
+    return {s.p + pos, s.len - pos};
+}
+
+const char *lookup_macro(Span name) {
+    for (size_t i = 0; i < kMacroCount; ++i) {
+        if (span_equals(name, macros[i].name)) {
+            return macros[i].expansion;
+        }
+    }
+    return nullptr;
+}
+
+const ControlName *lookup_control(Span name) {
+    for (const ControlName &control : control_names) {
+        if (span_equals(name, control.name)) {
+            return &control;
+        }
+    }
+    return nullptr;
+}
+
+bool lookup_key_name(Span name, uint8_t &keycode, uint8_t &modifier) {
+    if (span_equals(name, "primary")) {
+        keycode = 0;
+        modifier = s_primary_modifier;
+        return true;
+    }
+
+    for (size_t i = 0; i < kKeyNameCount; ++i) {
+        if (span_equals(name, key_names[i].name)) {
+            keycode = key_names[i].keycode;
+            modifier = key_names[i].modifier;
+            return true;
+        }
+    }
+
+    // Single character key name (e.g. "a", "z", "5")
+    if (name.len == 1) {
+        return char_to_key(name.p[0], keycode, modifier);
+    }
+
+    return false;
+}
+
+struct Compiler {
+    Program &prog;
+    payload_error_fn_t report_error;
+    const char *line;
+    size_t offset;
+    size_t repeat_pc[kRepeatMaxDepth];
+    size_t repeat_depth;
+    bool overflow;
+    const UnicodeStrategy &unicode;
+    uint16_t screen_width;
+    uint16_t screen_height;
+};
+
+void fail(Compiler &c, PayloadError code, const char *fmt, const char *arg) {
+    c.report_error(code, c.offset, fmt, arg);
+}
+
+// Only an error message needs the span as a string of its own.
+void fail_span(Compiler &c, PayloadError code, const char *fmt, Span arg) {
+    char buf[kTagMaxLen];
+    size_t len = arg.len < sizeof(buf) - 1 ? arg.len : sizeof(buf) - 1;
+    memcpy(buf, arg.p, len);
+    buf[len] = '\0';
+    fail(c, code, fmt, buf);
+}
+
+void emit(Compiler &c, const uint8_t *bytes, size_t len) {
+    if (c.overflow) {
+        return;
+    }
+    if (c.prog.len + len > kProgramMax) {
+        c.overflow = true;
+        fail(c, PayloadError::kTooLong, "%s\r\n", "payload too long");
+        return;
+    }
+    memcpy(c.prog.code + c.prog.len, bytes, len);
+    c.prog.len += len;
+}
+
+void emit_key(Compiler &c, uint8_t modifier, uint8_t keycode) {
+    const uint8_t op[] = {kOpKey, modifier, keycode};
+    emit(c, op, sizeof(op));
+}
+
+void emit_char(Compiler &c, char ch) {
+    uint8_t keycode;
+    uint8_t modifier;
+    if (!char_to_key(ch, keycode, modifier)) {
+        return;
+    }
+    emit_key(c, modifier, keycode);
+}
+
+void emit_hold(Compiler &c, uint8_t modifier) {
+    const uint8_t op[] = {kOpHold, modifier};
+    emit(c, op, sizeof(op));
+}
+
+// value in the strategy's base, most significant digit first
+void emit_code_digits(Compiler &c, uint32_t value) {
+    const UnicodeStrategy &s = c.unicode;
+    uint8_t digits[12];
+    size_t n = 0;
+    do {
+        digits[n++] = static_cast<uint8_t>(value % s.base);
+        value /= s.base;
+    } while (value > 0);
+    while (n < s.min_digits) {
+        digits[n++] = 0;
+    }
+    while (n > 0) {
+        uint8_t d = digits[--n];
+        uint8_t keycode;
+        if (d >= 10) {
+            keycode = static_cast<uint8_t>(HID_KEY_A + d - 10);
+        } else if (s.keypad) {
+            keycode = d == 0 ? HID_KEY_KEYPAD_0 : static_cast<uint8_t>(HID_KEY_KEYPAD_1 + d - 1);
+        } else {
+            keycode = d == 0 ? HID_KEY_0 : static_cast<uint8_t>(HID_KEY_1 + d - 1);
+        }
+        emit_key(c, s.hold, keycode);
+    }
+}
+
+// A character the layout has no key for, through the Unicode input method.
+void emit_code_point(Compiler &c, uint32_t cp) {
+    const UnicodeStrategy &s = c.unicode;
+    if (s.base == 0 || cp > s.max) {
+        char buf[48];
+        snprintf(buf, sizeof(buf), "U+%04lX%s", static_cast<unsigned long>(cp),
+                 s.base == 0 ? ", see !unicode" : " in this !unicode mode");
+        fail(c, PayloadError::kNoKeyForChar, "no key for %s\r\n", buf);
+        return;
+    }
+    if (s.prefix_key) {
+        emit_key(c, s.prefix_modifier, s.prefix_key);
+    }
+    if (s.hold) {
+        emit_hold(c, s.hold);
+    }
+    if (s.utf16 && cp > 0xFFFF) {
+        emit_code_digits(c, 0xD800 + ((cp - 0x10000) >> 10));
+        emit_code_digits(c, 0xDC00 + ((cp - 0x10000) & 0x3FF));
+    } else {
+        emit_code_digits(c, cp);
+    }
+    if (s.hold) {
+        emit_hold(c, 0);
+    }
+    if (s.suffix_key) {
+        emit_key(c, 0, s.suffix_key);
+    }
+}
+
+// Parses the value of a "name:N" tag, reporting range errors with the tag name.
+// Takes what strtol would: leading whitespace, a sign, then only digits.
+bool parse_tag_number(Compiler &c, const char *what, Span str, long min, long max, long &value) {
+    size_t i = 0;
+    while (i < str.len && isspace(static_cast<unsigned char>(str.p[i]))) {
+        ++i;
+    }
+    bool negative = i < str.len && str.p[i] == '-';
+    if (i < str.len && (str.p[i] == '-' || str.p[i] == '+')) {
+        ++i;
+    }
+    size_t digits = i;
+    value = 0;
+    for (; i < str.len && isdigit(static_cast<unsigned char>(str.p[i])); ++i) {
+        long d = str.p[i] - '0';
+        value = value > (LONG_MAX - d) / 10 ? LONG_MAX : value * 10 + d;
+    }
+    if (negative) {
+        value = -value;
+    }
+
+    if (i == digits || i != str.len) {
+        char buf[kTagMaxLen + 32];
+        snprintf(buf, sizeof(buf), "%s: %.*s", what, static_cast<int>(str.len), str.p);
+        fail(c, PayloadError::kInvalidNumber, "invalid %s\r\n", buf);
+        return false;
+    }
+
+    if (value < min || value > max) {
+        char buf[kTagMaxLen + 32];
+        snprintf(buf, sizeof(buf), "%s out of range (%ld-%ld): %ld", what, min, max, value);
+        fail(c, PayloadError::kOutOfRange, "%s\r\n", buf);
+        return false;
+    }
+
+    return true;
+}
+
+struct PointerTag {
+    const char *prefix;
+    uint8_t buttons;
+    uint8_t clicks;
+};
+
+static constexpr PointerTag kPointerTags[] = {
+    {"move:", 0, 1},
+    {"click:", MOUSE_BUTTON_LEFT, 1},
+    {"rclick:", MOUSE_BUTTON_RIGHT, 1},
+    {"mclick:", MOUSE_BUTTON_MIDDLE, 1},
+    {"dblclick:", MOUSE_BUTTON_LEFT, 2},
+};
+
+// Pixel to the mouse's 0-32767, so that the last pixel is the far edge.
+uint16_t scale_position(long pixel, uint16_t size) {
+    return static_cast<uint16_t>((pixel * 32767 + (size - 1) / 2) / (size - 1));
+}
+
+// <move:x,y>, <click:x,y> and the like; false if the tag is none of them.
+bool compile_pointer(Compiler &c, Span tag) {
+    for (const PointerTag &pointer : kPointerTags) {
+        if (!span_starts_with(tag, pointer.prefix)) {
+            continue;
+        }
+        Span args = span_from(tag, strlen(pointer.prefix));
+        const char *comma = static_cast<const char *>(memchr(args.p, ',', args.len));
+        if (!comma) {
+            fail_span(c, PayloadError::kInvalidNumber, "invalid position, want x,y: %s\r\n", args);
+            return true;
+        }
+        Span x_str = {args.p, static_cast<size_t>(comma - args.p)};
+        Span y_str = span_from(args, x_str.len + 1);
+        long x, y;
+        if (!parse_tag_number(c, "x", x_str, 0, c.screen_width - 1, x) ||
+            !parse_tag_number(c, "y", y_str, 0, c.screen_height - 1, y)) {
+            return true;
+        }
+        uint16_t mx = scale_position(x, c.screen_width);
+        uint16_t my = scale_position(y, c.screen_height);
+        const uint8_t op[] = {
+            kOpPointer, pointer.buttons,
+            static_cast<uint8_t>(mx), static_cast<uint8_t>(mx >> 8),
+            static_cast<uint8_t>(my), static_cast<uint8_t>(my >> 8),
+        };
+        for (uint8_t i = 0; i < pointer.clicks; ++i) {
+            emit(c, op, sizeof(op));
+        }
+        return true;
+    }
+    return false;
+}
+
+void open_repeat(Compiler &c, Span count_str) {
+    long count;
+    if (!parse_tag_number(c, "repeat count", count_str, 0, kRepeatMaxCount, count)) {
+        return;
+    }
+
+    if (c.repeat_depth >= kRepeatMaxDepth) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%zu", kRepeatMaxDepth);
+        fail(c, PayloadError::kRepeatTooDeep, "repeat nested deeper than %s\r\n", buf);
+        return;
+    }
+
+    c.repeat_pc[c.repeat_depth++] = c.prog.len;
+    const uint8_t op[] = {
+        kOpRepeat,
+        static_cast<uint8_t>(count), static_cast<uint8_t>(count >> 8),
+        0, 0,  // body length, patched by close_repeat()
+    };
+    emit(c, op, sizeof(op));
+}
+
+void close_repeat(Compiler &c) {
+    if (c.repeat_depth == 0) {
+        fail(c, PayloadError::kUnmatchedRepeat, "%s\r\n", "unmatched </repeat>");
+        return;
+    }
+
+    size_t op_pc = c.repeat_pc[--c.repeat_depth];
+    if (c.overflow) {
+        return;
+    }
+
+    size_t body_pc = op_pc + 5;
+    if (c.prog.len == body_pc) {
+        // Nothing to repeat; drop the loop rather than spin on it.
+        c.prog.len = op_pc;
+        return;
+    }
+
+    const uint8_t end = kOpEndRepeat;
+    emit(c, &end, 1);
+    if (c.overflow) {
+        return;
+    }
+
+    size_t body_len = c.prog.len - body_pc;
+    c.prog.code[op_pc + 3] = static_cast<uint8_t>(body_len);
+    c.prog.code[op_pc + 4] = static_cast<uint8_t>(body_len >> 8);
+}
+
+void compile_tag(Compiler &c, Span tag) {
+    // Check for sleep command: <sleep:N>
+    if (span_starts_with(tag, "sleep:")) {
+        long seconds;
+        if (!parse_tag_number(c, "sleep duration", span_from(tag, 6), 0, 3600, seconds)) {
+            return;
+        }
+        uint32_t ms = static_cast<uint32_t>(seconds) * 1000;
+        const uint8_t op[] = {
+            kOpSleep,
+            static_cast<uint8_t>(ms), static_cast<uint8_t>(ms >> 8),
+            static_cast<uint8_t>(ms >> 16), static_cast<uint8_t>(ms >> 24),
+        };
+        emit(c, op, sizeof(op));
+        return;
+    }
+
+    // Loop constructs: <repeat:N> ... </repeat>
+    if (span_starts_with(tag, "repeat:")) {
+        open_repeat(c, span_from(tag, 7));
+        return;
+    }
+    if (span_equals(tag, "/repeat")) {
+        close_repeat(c);
+        return;
+    }
+
+    if (compile_pointer(c, tag)) {
+        return;
+    }
+
+    if (const ControlName *control = lookup_control(tag)) {
+        const uint8_t op[] = {
+            kOpControl, control->report_id,
+            static_cast<uint8_t>(control->usage), static_cast<uint8_t>(control->usage >> 8),
+        };
+        emit(c, op, sizeof(op));
+        return;
+    }
+
+    // Parse tag content: split on '+', accumulate modifiers, last non-modifier is the key
+    uint8_t combined_modifier = 0;
+    uint8_t final_keycode = 0;
+    bool has_keycode = false;
+
+    const char *end = tag.p + tag.len;
+    for (const char *p = tag.p; p < end;) {
+        // Empty tokens, as in "ctrl++a", are skipped
+        if (*p == '+') {
+            ++p;
+            continue;
+        }
+        const char *token_end = p;
+        while (token_end < end && *token_end != '+') {
+            ++token_end;
+        }
+        Span token = {p, static_cast<size_t>(token_end - p)};
+        p = token_end;
+
+        // Trim leading/trailing whitespace
+        while (token.len > 0 && token.p[0] == ' ') {
+            ++token.p;
+            --token.len;
+        }
+        while (token.len > 0 && token.p[token.len - 1] == ' ') {
+            --token.len;
+        }
+
+        uint8_t kc, mod;
+        if (!lookup_key_name(token, kc, mod)) {
+            fail_span(c, PayloadError::kUnknownKey, "unknown key: %s\r\n", token);
+            return;
+        }
+
+        if (kc == 0 && mod != 0) {
+            // Pure modifier
+            combined_modifier |= mod;
+        } else {
+            if (has_keycode) {
+                fail_span(c, PayloadError::kMultipleKeys, "multiple non-modifier keys in combo: %s\r\n", tag);
+                return;
+            }
+            combined_modifier |= mod;
+            final_keycode = kc;
+            has_keycode = true;
+        }
+    }
+
+    emit_key(c, combined_modifier, final_keycode);
+}
+
+size_t op_size(uint8_t op) {
+    switch (op) {
+        case kOpKey:     return 3;
+        case kOpSleep:   return 5;
+        case kOpRepeat:  return 5;
+        case kOpControl: return 4;
+        case kOpHold:    return 2;
+        case kOpPointer: return 6;
+        default:         return 1;
+    }
+}
+
+// Deepest loop nesting in a piece of compiled code.
+size_t repeat_depth_of(const uint8_t *code, size_t len) {
+    size_t depth = 0;
+    size_t max_depth = 0;
+    for (size_t pc = 0; pc < len; pc += op_size(code[pc])) {
+        if (code[pc] == kOpRepeat && ++depth > max_depth) {
+            max_depth = depth;
+        } else if (code[pc] == kOpEndRepeat && depth > 0) {
+            --depth;
+        }
+    }
+    return max_depth;
+}
+
+// Appends a !def macro's code to the program; false if there is none by
+// that name.
+bool copy_runtime_macro(Compiler &c, Span name) {
+    if (c.overflow) {
+        return macro_table_copy(name.p, name.len, nullptr, 0) >= 0;
+    }
+    size_t room = kProgramMax - c.prog.len;
+    int len = macro_table_copy(name.p, name.len, c.prog.code + c.prog.len, room);
+    if (len < 0) {
+        return false;
+    }
+    if (static_cast<size_t>(len) > room) {
+        c.overflow = true;
+        fail(c, PayloadError::kTooLong, "%s\r\n", "payload too long");
+        return true;
+    }
+    // The body's loops nest inside the ones open here; the cursor has only
+    // kRepeatMaxDepth frames.
+    if (c.repeat_depth + repeat_depth_of(c.prog.code + c.prog.len, static_cast<size_t>(len)) > kRepeatMaxDepth) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%zu", kRepeatMaxDepth);
+        fail(c, PayloadError::kRepeatTooDeep, "repeat nested deeper than %s\r\n", buf);
+        return true;
+    }
+    c.prog.len += static_cast<size_t>(len);
+    return true;
+}
+
+// Where expansion stands in one piece of text: the line itself at the bottom
+// of the stack, one macro body per level above it.
+//
+// Each level also keeps the next '>' and ">>" it has found ahead of p, or
+// the terminator if there is none. The searches only ever continue from
+// where they stopped, so every byte is looked at a bounded number of times,
+// however many '<' are left open: "<<<<..." used to search to the end of the
+// line once per '<'.
+struct TextCursor {
+    const char *text;
+    const char *p;
+    const char *tag_end;
+    const char *macro_end;
+};
+
+TextCursor text_cursor(const char *text) {
+    return {text, text, text, text};
+}
+
+// The first '>' at or after from, or nullptr.
+const char *find_tag_end(TextCursor &cur, const char *from) {
+    if (cur.tag_end < from) {
+        const char *q = from;
+        while (*q != '\0' && *q != '>') {
+            ++q;
+        }
+        cur.tag_end = q;
+    }
+    return *cur.tag_end ? cur.tag_end : nullptr;
+}
+
+// The first ">>" at or after from, or nullptr.
+const char *find_macro_end(TextCursor &cur, const char *from) {
+    if (cur.macro_end < from) {
+        const char *q = from;
+        while (*q != '\0' && !(q[0] == '>' && q[1] == '>')) {
+            ++q;
+        }
+        cur.macro_end = q;
+    }
+    return *cur.macro_end ? cur.macro_end : nullptr;
+}
+
+// Written by core 0 while compiling, read by core 1 for !diag
+static volatile size_t s_macro_depth_peak = 0;
+
+void compile_text(Compiler &c, const char *line) {
+    TextCursor stack[kMacroMaxDepth + 1];
+    size_t depth = 0;
+    stack[depth++] = text_cursor(line);
+
+    while (depth > 0) {
+        TextCursor &cur = stack[depth - 1];
+        const char *p = cur.p;
+        if (*p == '\0') {
+            --depth;
+            continue;
+        }
+        // Errors inside a macro body point at the macro reference.
+        if (depth == 1) {
+            c.offset = static_cast<size_t>(p - line);
+        }
+
+        if (*p == '\\' && *(p + 1) == '<') {
+            // Escaped '<' — send literal '<'
+            emit_char(c, '<');
+            cur.p = p + 2;
+        } else if (*p == '<' && *(p + 1) == '<') {
+            // Macro start — find closing '>>'
+            const char *start = p + 2;
+            const char *end = find_macro_end(cur, start);
+            if (!end) {
+                // No closing '>>' — send '<' literally and go on after it
+                emit_char(c, '<');
+                cur.p = p + 1;
+                continue;
+            }
+            cur.p = end + 2;
+            Span name = {start, static_cast<size_t>(end - start)};
+            if (name.len == 0 || name.len >= kTagMaxLen) {
+                fail(c, PayloadError::kInvalidMacro, "invalid macro name length: %s\r\n", name.len == 0 ? "empty" : "too long");
+                continue;
+            }
+            // Runtime macros come precompiled and shadow the built-in ones.
+            if (copy_runtime_macro(c, name)) {
+                continue;
+            }
+            const char *expansion = lookup_macro(name);
+            if (!expansion) {
+                fail_span(c, PayloadError::kUnknownMacro, "unknown macro: %s\r\n", name);
+            } else if (depth > kMacroMaxDepth) {
+                fail_span(c, PayloadError::kMacroTooDeep, "macros nested too deep at: %s\r\n", name);
+            } else {
+                // cur is not used past this point; the push may overwrite it.
+                stack[depth++] = text_cursor(expansion);
+                if (depth - 1 > s_macro_depth_peak) {
+                    s_macro_depth_peak = depth - 1;
+                }
+            }
+        } else if (*p == '<') {
+            // Tag start — find closing '>'
+            const char *start = p + 1;
+            const char *end = find_tag_end(cur, start);
+            if (!end) {
+                // No closing '>' — send '<' literally
+                emit_char(c, '<');
+                cur.p = p + 1;
+                continue;
+            }
+            cur.p = end + 1;
+            Span tag = {start, static_cast<size_t>(end - start)};
+            if (tag.len == 0 || tag.len >= kTagMaxLen) {
+                fail(c, PayloadError::kInvalidTag, "invalid tag length: %s\r\n", tag.len == 0 ? "empty" : "too long");
+                continue;
+            }
+            compile_tag(c, tag);
+        } else if (static_cast<unsigned char>(*p) < 0x80) {
+            emit_char(c, *p);
+            cur.p = p + 1;
+        } else {
+            uint32_t cp;
+            cur.p = p + decode_utf8(p, cp);
+            if (cp == UINT32_MAX) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "0x%02X", static_cast<unsigned char>(*p));
+                fail(c, PayloadError::kInvalidUtf8, "invalid UTF-8 at byte %s\r\n", buf);
+            } else {
+                emit_code_point(c, cp);
+            }
+        }
+    }
+}
+
+uint16_t read_u16(const uint8_t *p) {
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+uint32_t read_u32(const uint8_t *p) {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+}  // namespace
+
+bool payload_compile(const char *text, Program &prog, payload_error_fn_t report_error) {
+    prog.len = 0;
+    uint32_t screen = s_screen;
+    Compiler c{prog, report_error, text, 0, {}, 0, false,
+               kUnicodeStrategies[static_cast<size_t>(s_unicode_mode)],
+               static_cast<uint16_t>(screen >> 16), static_cast<uint16_t>(screen)};
+
+    compile_text(c, text);
+
+    c.offset = strlen(text);
+    while (c.repeat_depth > 0) {
+        fail(c, PayloadError::kUnclosedRepeat, "%s\r\n", "unclosed <repeat>, closed at end of line");
+        close_repeat(c);
+    }
+
+    return !c.overflow;
+}
+
+void payload_set_unicode_mode(UnicodeMode mode) {
+    if (static_cast<size_t>(mode) < kUnicodeModeCount) {
+        s_unicode_mode = mode;
+    }
+}
+
+UnicodeMode payload_unicode_mode() {
+    return s_unicode_mode;
+}
+
+void payload_set_primary_modifier(uint8_t modifier) {
+    s_primary_modifier = modifier;
+}
+
+uint8_t payload_primary_modifier() {
+    return s_primary_modifier;
+}
+
+void payload_set_screen(uint16_t width, uint16_t height) {
+    if (width >= 2 && height >= 2 && width <= kScreenMax && height <= kScreenMax) {
+        s_screen = (static_cast<uint32_t>(width) << 16) | height;
+    }
+}
+
+void payload_screen(uint16_t &width, uint16_t &height) {
+    uint32_t screen = s_screen;
+    width = static_cast<uint16_t>(screen >> 16);
+    height = static_cast<uint16_t>(screen);
+}
+
+size_t payload_macro_depth_peak() {
+    return s_macro_depth_peak;
+}
+
+void payload_start(PayloadCursor &cur, const Program &prog) {
+    cur.prog = &prog;
+    cur.pc = 0;
+    cur.depth = 0;
+}
+
+void payload_cost(const Program &prog, PayloadCost &cost) {
+    cost = {};
+    uint64_t times[kRepeatMaxDepth + 1] = {1};  // how often the current body runs
+    size_t depth = 0;
+    size_t pc = 0;
+    while (pc < prog.len) {
+        const uint8_t *op = prog.code + pc;
+        switch (op[0]) {
+            case kOpKey:
+                cost.keys += times[depth];
+                pc += 3;
+                break;
+
+            case kOpControl:
+                cost.keys += times[depth];
+                pc += 4;
+                break;
+
+            case kOpPointer:
+                (op[1] ? cost.keys : cost.moves) += times[depth];
+                pc += 6;
+                break;
+
+            case kOpSleep:
+                cost.sleep_ms += times[depth] * read_u32(op + 1);
+                pc += 5;
+                break;
+
+            case kOpHold:
+                pc += 2;    // letting go may take a report per keyboard; not counted
+                break;
+
+            case kOpRepeat:
+                if (depth == kRepeatMaxDepth) {
+                    return;
+                }
+                times[depth + 1] = times[depth] * read_u16(op + 1);
+                ++depth;
+                pc += 5;
+                break;
+
+            case kOpEndRepeat:
+                if (depth == 0) {
+                    return;
+                }
+                --depth;
+                pc += 1;
+                break;
+
+            default:
+                return;     // corrupt program, as in payload_next
+        }
+    }
+}
+
+bool payload_next(PayloadCursor &cur, Step &step) {
+    const uint8_t *code = cur.prog->code;
+    while (cur.pc < cur.prog->len) {
+        const uint8_t *op = code + cur.pc;
+        switch (op[0]) {
+            case kOpKey:
+                step.kind = StepKind::kKey;
+                step.modifier = op[1];
+                step.keycode = op[2];
+                cur.pc += 3;
+                return true;
+
+            case kOpControl:
+                step.kind = StepKind::kControl;
+                step.report_id = op[1];
+                step.usage = read_u16(op + 2);
+                cur.pc += 4;
+                return true;
+
+            case kOpPointer:
+                step.kind = StepKind::kPointer;
+                step.buttons = op[1];
+                step.x = read_u16(op + 2);
+                step.y = read_u16(op + 4);
+                cur.pc += 6;
+                return true;
+
+            case kOpSleep:
+                step.kind = StepKind::kSleep;
+                step.sleep_ms = read_u32(op + 1);
+                cur.pc += 5;
+                return true;
+
+            case kOpHold:
+                step.kind = StepKind::kHold;
+                step.modifier = op[1];
+                cur.pc += 2;
+                return true;
+
+            case kOpRepeat: {
+                uint16_t count = read_u16(op + 1);
+                cur.pc += 5;
+                if (count == 0) {
+                    cur.pc += read_u16(op + 3);
+                } else {
+                    // The compiler bounds nesting, so there is always a free frame.
+                    cur.loops[cur.depth++] = {static_cast<uint16_t>(cur.pc), count};
+                }
+                break;
+            }
+
+            case kOpEndRepeat: {
+                LoopFrame &loop = cur.loops[cur.depth - 1];
+                if (--loop.remaining > 0) {
+                    cur.pc = loop.body_pc;
+                } else {
+                    --cur.depth;
+                    cur.pc += 1;
+                }
+                break;
+            }
+
+            default:
+                // Corrupt program; stop rather than type garbage.
+                cur.pc = cur.prog->len;
+                break;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,144 @@
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A REPL line is compiled once into a flat opcode stream and then walked
+// keystroke by keystroke. Repeats stay loops in the stream instead of being
+// unrolled, so <repeat:40><tab></repeat> costs a handful of bytes.
+
+constexpr size_t kProgramMax = 1024;
+constexpr size_t kRepeatMaxDepth = 4;
+constexpr long kRepeatMaxCount = 10000;
+
+// Macro bodies are expanded from a fixed stack of text cursors, so a deep or
+// self-referential macro costs an error instead of the core's stack.
+constexpr size_t kMacroMaxDepth = 8;
+
+enum Opcode : uint8_t {
+    kOpKey = 1,     // modifier, keycode
+    kOpSleep,       // duration in ms (u32 LE)
+    kOpRepeat,      // count (u16 LE), body length incl. kOpEndRepeat (u16 LE)
+    kOpEndRepeat,
+    kOpControl,     // report ID, usage (u16 LE): a consumer or system control key
+    kOpHold,        // modifiers kept down between the keys that follow, 0 to let go
+    kOpPointer,     // buttons, x (u16 LE), y (u16 LE): absolute mouse, 0-32767 per axis
+};
+
+struct Program {
+    uint8_t code[kProgramMax];
+    size_t len;
+};
+
+enum class PayloadError : uint8_t {
+    kNone = 0,
+    kUnknownKey,
+    kMultipleKeys,
+    kInvalidTag,
+    kUnknownMacro,
+    kInvalidMacro,
+    kInvalidNumber,
+    kOutOfRange,
+    kRepeatTooDeep,
+    kUnmatchedRepeat,
+    kUnclosedRepeat,
+    kTooLong,
+    kMacroTooDeep,
+    kInvalidUtf8,
+    kNoKeyForChar,
+};
+
+// offset is the position in the compiled line; errors inside a macro body
+// point at the macro reference. fmt is a string literal taking arg as its one
+// %s, so it may be kept and formatted later; arg is only valid for the call.
+typedef void (*payload_error_fn_t)(PayloadError code, size_t offset, const char *fmt, const char *arg);
+
+// Text is UTF-8. A character with a key on the layout (US) is typed with that
+// key; any other one is entered through the host's Unicode input method,
+// as set by payload_set_unicode_mode(). The keys it takes are worked out at
+// compile time like everything else.
+enum class UnicodeMode : uint8_t {
+    kNone,      // characters without a key are an error
+    kLinux,     // Ctrl+Shift+U, hex code, Space (GTK and IBus)
+    kWindows,   // decimal code on the keypad with Alt held
+    kMac,       // hex code with Option held ("Unicode Hex Input" source)
+};
+
+constexpr size_t kUnicodeModeCount = 4;
+
+// Set by core 0; applies to every compile after it, on either core.
+void payload_set_unicode_mode(UnicodeMode mode);
+UnicodeMode payload_unicode_mode();
+
+// The modifier <primary> stands for, the one shortcuts use on the host:
+// Ctrl, or Cmd on macOS. Set by core 0 like the Unicode mode.
+void payload_set_primary_modifier(uint8_t modifier);
+uint8_t payload_primary_modifier();
+
+// The screen the absolute mouse spans, in pixels: <click:x,y> and the other
+// pointer tags take pixels, and are scaled to the mouse's 0-32767 when they
+// are compiled. Set by core 0 like the Unicode mode.
+constexpr uint16_t kScreenDefaultWidth = 1920;
+constexpr uint16_t kScreenDefaultHeight = 1080;
+constexpr uint16_t kScreenMax = 16384;
+
+void payload_set_screen(uint16_t width, uint16_t height);
+void payload_screen(uint16_t &width, uint16_t &height);
+
+// Compiles one line of REPL syntax. Bad tags and macros are reported through
+// report_error and skipped, like before; returns false only if the result
+// does not fit into a Program.
+bool payload_compile(const char *text, Program &prog, payload_error_fn_t report_error);
+
+// Deepest macro nesting any compile has reached since boot.
+size_t payload_macro_depth_peak();
+
+enum class StepKind : uint8_t {
+    kKey,
+    kControl,
+    kSleep,
+    kHold,      // modifier: what stays down until the next kHold
+    kPointer,   // buttons at x, y; no buttons is a move
+};
+
+struct Step {
+    StepKind kind;
+    uint8_t modifier;
+    uint8_t keycode;
+    uint8_t report_id;      // kControl: HID_REPORT_ID_CONSUMER or _SYSTEM
+    uint16_t usage;
+    uint32_t sleep_ms;
+    uint8_t buttons;        // kPointer: MOUSE_BUTTON_* bits
+    uint16_t x;             // kPointer: 0-32767
+    uint16_t y;
+};
+
+struct LoopFrame {
+    uint16_t body_pc;
+    uint16_t remaining;
+};
+
+struct PayloadCursor {
+    const Program *prog;
+    size_t pc;
+    LoopFrame loops[kRepeatMaxDepth];
+    size_t depth;
+};
+
+void payload_start(PayloadCursor &cur, const Program &prog);
+
+// What running a program costs, worked out from the opcodes without walking
+// the loops, so nested repeats cost no more than the stream is long.
+struct PayloadCost {
+    uint64_t keys;          // each one a press and a release report, control keys and clicks included
+    uint64_t moves;         // pointer moves, one report each
+    uint64_t sleep_ms;
+};
+
+void payload_cost(const Program &prog, PayloadCost &cost);
+
+// Advances to the next keystroke or sleep; returns false when the program ends.
+bool payload_next(PayloadCursor &cur, Step &step);
+
+#endif
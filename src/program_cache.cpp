@@ -0,0 +1,144 @@
+#include "program_cache.h"
+
+#include <cstring>
+
+#include "wifi_repl.h"
+
+namespace {
+
+struct Entry {
+    bool used;
+    uint32_t hash;
+    uint32_t generation;
+    uint32_t last_used;     // s_clock at the last hit or store
+    char text[WIFI_REPL_LINE_MAX];
+    Program prog;
+};
+
+static Entry s_entries[kProgramCacheEntries];
+static uint32_t s_clock = 0;
+static ProgramCacheStats s_stats;
+
+constexpr uint32_t kPrime1 = 0x9E3779B1u;
+constexpr uint32_t kPrime2 = 0x85EBCA77u;
+constexpr uint32_t kPrime3 = 0xC2B2AE3Du;
+constexpr uint32_t kPrime4 = 0x27D4EB2Fu;
+constexpr uint32_t kPrime5 = 0x165667B1u;
+
+uint32_t rotl(uint32_t x, unsigned r) {
+    return (x << r) | (x >> (32 - r));
+}
+
+uint32_t read_u32(const uint8_t *p) {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+uint32_t xxh_round(uint32_t acc, uint32_t input) {
+    return rotl(acc + input * kPrime2, 13) * kPrime1;
+}
+
+uint32_t hash_text(const char *text) {
+    return xxhash32(text, strlen(text), 0);
+}
+
+}  // namespace
+
+uint32_t xxhash32(const void *data, size_t len, uint32_t seed) {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    const uint8_t *end = p + len;
+    uint32_t h;
+
+    if (len >= 16) {
+        uint32_t v1 = seed + kPrime1 + kPrime2;
+        uint32_t v2 = seed + kPrime2;
+        uint32_t v3 = seed;
+        uint32_t v4 = seed - kPrime1;
+        const uint8_t *limit = end - 16;
+        do {
+            v1 = xxh_round(v1, read_u32(p));
+            v2 = xxh_round(v2, read_u32(p + 4));
+            v3 = xxh_round(v3, read_u32(p + 8));
+            v4 = xxh_round(v4, read_u32(p + 12));
+            p += 16;
+        } while (p <= limit);
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    } else {
+        h = seed + kPrime5;
+    }
+    h += static_cast<uint32_t>(len);
+
+    for (; p + 4 <= end; p += 4) {
+        h = rotl(h + read_u32(p) * kPrime3, 17) * kPrime4;
+    }
+    for (; p < end; ++p) {
+        h = rotl(h + *p * kPrime5, 11) * kPrime1;
+    }
+
+    h ^= h >> 15;
+    h *= kPrime2;
+    h ^= h >> 13;
+    h *= kPrime3;
+    h ^= h >> 16;
+    return h;
+}
+
+const Program *program_cache_find(const char *text, uint32_t generation) {
+    uint32_t hash = hash_text(text);
+    for (Entry &e : s_entries) {
+        if (e.used && e.hash == hash && e.generation == generation && strcmp(e.text, text) == 0) {
+            e.last_used = ++s_clock;
+            ++s_stats.hits;
+            return &e.prog;
+        }
+    }
+    ++s_stats.misses;
+    return nullptr;
+}
+
+void program_cache_store(const char *text, uint32_t generation, const Program &prog) {
+    if (strlen(text) >= sizeof(s_entries[0].text)) {
+        return;
+    }
+    uint32_t hash = hash_text(text);
+
+    // A stale entry for the same text is replaced in place; otherwise a free
+    // entry or the least recently used one.
+    Entry *victim = nullptr;
+    bool same = false;
+    for (Entry &e : s_entries) {
+        if (e.used && e.hash == hash && strcmp(e.text, text) == 0) {
+            victim = &e;
+            same = true;
+            break;
+        }
+        if (!victim || (victim->used && (!e.used || e.last_used < victim->last_used))) {
+            victim = &e;
+        }
+    }
+    if (victim->used && !same) {
+        ++s_stats.evictions;
+    }
+
+    victim->used = true;
+    victim->hash = hash;
+    victim->generation = generation;
+    victim->last_used = ++s_clock;
+    strcpy(victim->text, text);
+    memcpy(victim->prog.code, prog.code, prog.len);
+    victim->prog.len = prog.len;
+}
+
+void program_cache_clear() {
+    for (Entry &e : s_entries) {
+        e.used = false;
+    }
+}
+
+void program_cache_stats(ProgramCacheStats &stats) {
+    stats = s_stats;
+    stats.used = 0;
+    for (const Entry &e : s_entries) {
+        stats.used += e.used ? 1 : 0;
+    }
+}
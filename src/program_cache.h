@@ -0,0 +1,41 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "payload.h"
+
+// Compiled programs of recently typed lines, so a line sent again is not
+// parsed again. Entries are found by the xxHash32 of the line text, checked
+// against the full text, and evicted least recently used first.
+//
+// Only lines that compiled without errors are cached, so a hit never hides
+// an error message. Each entry remembers the runtime macro generation it was
+// compiled against; after !def or !undef it no longer matches.
+//
+// Core 0 only.
+
+constexpr size_t kProgramCacheEntries = 8;
+
+struct ProgramCacheStats {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    size_t used;
+};
+
+// The cached program for text, or nullptr. It stays valid until the next
+// program_cache_store().
+const Program *program_cache_find(const char *text, uint32_t generation);
+
+void program_cache_store(const char *text, uint32_t generation, const Program &prog);
+
+void program_cache_clear();
+
+void program_cache_stats(ProgramCacheStats &stats);
+
+// xxHash32 of len bytes
+uint32_t xxhash32(const void *data, size_t len, uint32_t seed);
+
+#endif
@@ -0,0 +1,114 @@
+#include "report_pacer.h"
+
+#include "hardware/timer.h"
+#include "pico/critical_section.h"
+#include "pico/stdlib.h"
+
+namespace {
+
+static critical_section_t s_lock;
+static uint s_alarm;
+static uint32_t s_period_us = 0;        // 0: unpaced
+static uint64_t s_next_slot_us = 0;
+static uint64_t s_slot_us = 0;          // when the open slot opened
+static bool s_slot_open = false;
+static uint64_t s_last_complete_us = 0;
+static PacerStats s_stats;
+
+void on_alarm(uint alarm_num) {
+    critical_section_enter_blocking(&s_lock);
+    if (s_period_us != 0) {
+        s_slot_us = s_next_slot_us;
+        s_slot_open = true;
+        s_next_slot_us += s_period_us;
+        // Stay on the grid: if this interrupt came too late for the next
+        // slot as well, that slot is dropped rather than sent early.
+        while (hardware_alarm_set_target(alarm_num, from_us_since_boot(s_next_slot_us))) {
+            s_next_slot_us += s_period_us;
+            ++s_stats.skipped;
+        }
+    }
+    critical_section_exit(&s_lock);
+}
+
+}  // namespace
+
+void pacer_init() {
+    critical_section_init(&s_lock);
+    s_alarm = static_cast<uint>(hardware_alarm_claim_unused(true));
+    hardware_alarm_set_callback(s_alarm, on_alarm);
+}
+
+void pacer_set_rate(uint32_t reports_per_s) {
+    if (reports_per_s > kPaceMaxRate) {
+        reports_per_s = kPaceMaxRate;
+    }
+
+    critical_section_enter_blocking(&s_lock);
+    hardware_alarm_cancel(s_alarm);
+    s_period_us = reports_per_s ? 1000000u / reports_per_s : 0;
+    s_slot_open = false;
+    s_last_complete_us = 0;
+    s_stats = {};
+    s_stats.rate = reports_per_s;
+    s_stats.late_min_us = UINT32_MAX;
+    s_stats.interval_min_us = UINT32_MAX;
+    if (s_period_us != 0) {
+        s_next_slot_us = time_us_64() + s_period_us;
+        hardware_alarm_set_target(s_alarm, from_us_since_boot(s_next_slot_us));
+    }
+    critical_section_exit(&s_lock);
+}
+
+bool pacer_take() {
+    if (s_period_us == 0) {
+        return true;
+    }
+
+    critical_section_enter_blocking(&s_lock);
+    bool open = s_slot_open;
+    if (open) {
+        s_slot_open = false;
+        uint32_t late = static_cast<uint32_t>(time_us_64() - s_slot_us);
+        ++s_stats.reports;
+        s_stats.late_total_us += late;
+        s_stats.late_min_us = late < s_stats.late_min_us ? late : s_stats.late_min_us;
+        s_stats.late_max_us = late > s_stats.late_max_us ? late : s_stats.late_max_us;
+    }
+    critical_section_exit(&s_lock);
+    return open;
+}
+
+void pacer_wait() {
+    if (s_period_us == 0) {
+        sleep_ms(1);
+        return;
+    }
+    // The alarm interrupt ends the wait as soon as the slot opens.
+    best_effort_wfe_or_timeout(make_timeout_time_ms(1));
+}
+
+void pacer_report_complete() {
+    if (s_period_us == 0) {
+        return;
+    }
+    uint64_t now = time_us_64();
+    // Only reports sent back to back say anything about the spacing; a gap
+    // between lines or keys waiting on each other is not jitter.
+    if (s_last_complete_us != 0 && now - s_last_complete_us < 2u * s_period_us) {
+        uint32_t interval = static_cast<uint32_t>(now - s_last_complete_us);
+        critical_section_enter_blocking(&s_lock);
+        ++s_stats.intervals;
+        s_stats.interval_total_us += interval;
+        s_stats.interval_min_us = interval < s_stats.interval_min_us ? interval : s_stats.interval_min_us;
+        s_stats.interval_max_us = interval > s_stats.interval_max_us ? interval : s_stats.interval_max_us;
+        critical_section_exit(&s_lock);
+    }
+    s_last_complete_us = now;
+}
+
+void pacer_stats(PacerStats &stats) {
+    critical_section_enter_blocking(&s_lock);
+    stats = s_stats;
+    critical_section_exit(&s_lock);
+}
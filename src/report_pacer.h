@@ -0,0 +1,49 @@
+#ifndef REPORT_PACER_H
+#define REPORT_PACER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Optional fixed-rate pacing of HID reports. A hardware alarm opens one send
+// slot per period on an absolute time grid, so the rate does not drift with
+// whatever else the core is doing; each report waits for a slot. Slots are
+// not banked: a slot nobody used is gone, so reports never come in bursts.
+//
+// How late each report left after its slot opened, and the spacing at which
+// the host took back-to-back reports, are kept as jitter statistics.
+
+constexpr uint32_t kPaceMaxRate = 1000;     // one report per USB frame
+
+struct PacerStats {
+    uint32_t rate;              // reports/s, 0 when unpaced
+    uint32_t reports;           // sent in a slot since the rate was set
+    uint32_t late_min_us;       // slot opened -> report handed to the endpoint
+    uint32_t late_max_us;
+    uint64_t late_total_us;
+    uint32_t intervals;         // host-side spacing of back-to-back reports
+    uint32_t interval_min_us;
+    uint32_t interval_max_us;
+    uint64_t interval_total_us;
+    uint32_t skipped;           // slots the alarm itself fired too late for
+};
+
+// Claims a hardware alarm; its interrupt runs on the calling core, which is
+// the one that sends reports. Starts unpaced.
+void pacer_init();
+
+// 0 turns pacing off. Resets the statistics.
+void pacer_set_rate(uint32_t reports_per_s);
+
+// True if a report may go out now, taking the open slot. Always true when
+// unpaced.
+bool pacer_take();
+
+// Sleeps until the next slot opens, or any other interrupt, or 1 ms.
+void pacer_wait();
+
+// From the HID report completion callback.
+void pacer_report_complete();
+
+void pacer_stats(PacerStats &stats);
+
+#endif
@@ -0,0 +1,152 @@
+#include "scheduler.h"
+
+#include <cstring>
+
+#include "hardware/timer.h"
+#include "pico/critical_section.h"
+#include "pico/stdlib.h"
+
+namespace {
+
+struct Job {
+    TimerNode node;     // first member, so a TimerNode& converts back to its Job
+    uint32_t id;        // 0 while the slot is free
+    char text[WIFI_REPL_LINE_MAX];
+};
+
+static Job s_jobs[kMaxJobs];
+static TimerWheel s_wheel;
+static critical_section_t s_lock;
+static scheduler_due_fn_t s_due = nullptr;
+static uint32_t s_next_seq = 1;
+static uint s_alarm;
+
+static bool s_clock_set = false;
+static int64_t s_clock_offset_ms = 0;
+
+uint32_t now_ms() {
+    return to_ms_since_boot(get_absolute_time());
+}
+
+void on_expired(TimerNode &node, void * /*ctx*/) {
+    Job &job = *reinterpret_cast<Job *>(&node);
+    if (s_due(job.text)) {
+        job.id = 0;
+    } else {
+        // Text queue full; try again on the next tick.
+        timer_wheel_insert(s_wheel, node, s_wheel.now + 1);
+    }
+}
+
+// Arms the alarm for the wheel's next tick with work, or leaves it off when
+// there are no jobs. Called with the lock held.
+void arm_alarm(uint32_t now) {
+    uint32_t ticks;
+    if (!timer_wheel_next(s_wheel, ticks)) {
+        hardware_alarm_cancel(s_alarm);
+        return;
+    }
+    int32_t delay_ms = static_cast<int32_t>(s_wheel.now + ticks - now);
+    // At least one tick ahead, so the target cannot have passed already.
+    uint32_t ms = delay_ms > 1 ? static_cast<uint32_t>(delay_ms) : 1;
+    while (hardware_alarm_set_target(s_alarm, make_timeout_time_ms(ms))) {
+        ms = 1;
+    }
+}
+
+void on_alarm(uint /*alarm_num*/) {
+    critical_section_enter_blocking(&s_lock);
+    uint32_t now = now_ms();
+    timer_wheel_advance(s_wheel, now, on_expired, nullptr);
+    arm_alarm(now);
+    critical_section_exit(&s_lock);
+}
+
+}  // namespace
+
+void scheduler_init(scheduler_due_fn_t due) {
+    s_due = due;
+    critical_section_init(&s_lock);
+    timer_wheel_init(s_wheel, now_ms());
+
+    // Armed by scheduler_add, and only while there are jobs.
+    s_alarm = static_cast<uint>(hardware_alarm_claim_unused(true));
+    hardware_alarm_set_callback(s_alarm, on_alarm);
+}
+
+uint32_t scheduler_add(uint32_t delay_ms, const char *text) {
+    if (delay_ms > kMaxJobDelayMs) {
+        return 0;
+    }
+
+    uint32_t id = 0;
+    critical_section_enter_blocking(&s_lock);
+    uint32_t now = now_ms();
+    // Delays count from the wheel's time; bring it up to now first.
+    timer_wheel_advance(s_wheel, now, on_expired, nullptr);
+    for (size_t i = 0; i < kMaxJobs; ++i) {
+        Job &job = s_jobs[i];
+        if (job.id != 0) {
+            continue;
+        }
+        // The slot index is encoded in the id, so cancel needs no search.
+        id = s_next_seq++ * kMaxJobs + static_cast<uint32_t>(i);
+        job.id = id;
+        strncpy(job.text, text, sizeof(job.text) - 1);
+        job.text[sizeof(job.text) - 1] = '\0';
+        timer_wheel_insert(s_wheel, job.node, now + delay_ms);
+        arm_alarm(now);
+        break;
+    }
+    critical_section_exit(&s_lock);
+    return id;
+}
+
+bool scheduler_cancel(uint32_t id) {
+    Job &job = s_jobs[id % kMaxJobs];
+    bool found = false;
+
+    critical_section_enter_blocking(&s_lock);
+    if (id != 0 && job.id == id) {
+        timer_wheel_cancel(s_wheel, job.node);
+        job.id = 0;
+        found = true;
+        arm_alarm(now_ms());
+    }
+    critical_section_exit(&s_lock);
+    return found;
+}
+
+void scheduler_list(scheduler_list_fn_t fn, void *ctx) {
+    JobInfo pending[kMaxJobs];
+    size_t count = 0;
+
+    critical_section_enter_blocking(&s_lock);
+    uint32_t now = now_ms();
+    for (Job &job : s_jobs) {
+        if (job.id == 0) {
+            continue;
+        }
+        int32_t remaining = static_cast<int32_t>(job.node.expires - now);
+        pending[count++] = {job.id, remaining > 0 ? static_cast<uint32_t>(remaining) : 0u, job.text};
+    }
+    critical_section_exit(&s_lock);
+
+    // Report outside the lock; the alarm interrupt must not wait on the network.
+    for (size_t i = 0; i < count; ++i) {
+        fn(pending[i], ctx);
+    }
+}
+
+void scheduler_set_clock(uint64_t unix_ms) {
+    s_clock_offset_ms = static_cast<int64_t>(unix_ms) - static_cast<int64_t>(time_us_64() / 1000);
+    s_clock_set = true;
+}
+
+bool scheduler_clock(uint64_t &unix_ms) {
+    if (!s_clock_set) {
+        return false;
+    }
+    unix_ms = static_cast<uint64_t>(static_cast<int64_t>(time_us_64() / 1000) + s_clock_offset_ms);
+    return true;
+}
@@ -0,0 +1,46 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "timer_wheel.h"
+#include "wifi_repl.h"
+
+// Deferred payloads, kept on a 1 ms timer wheel that a hardware alarm
+// advances in interrupt context. The alarm is only armed while there are
+// jobs, for the next tick on which the wheel has work: a job coming due or
+// a coarse slot cascading. No job list is ever scanned. When a job comes
+// due its text is handed to the due callback, which feeds it into the
+// normal text queue.
+
+constexpr size_t kMaxJobs = 32;
+constexpr uint32_t kMaxJobDelayMs = kWheelMaxDelay;
+
+// Returns false if the job cannot be taken right now; it is retried 1 ms later.
+typedef bool (*scheduler_due_fn_t)(const char *text);
+
+struct JobInfo {
+    uint32_t id;
+    uint32_t remaining_ms;
+    const char *text;
+};
+
+typedef void (*scheduler_list_fn_t)(const JobInfo &job, void *ctx);
+
+// Claims a hardware alarm; its interrupt runs on the calling core.
+void scheduler_init(scheduler_due_fn_t due);
+
+// Returns the job id, or 0 if all job slots are taken.
+uint32_t scheduler_add(uint32_t delay_ms, const char *text);
+
+bool scheduler_cancel(uint32_t id);
+
+void scheduler_list(scheduler_list_fn_t fn, void *ctx);
+
+// Wall clock, for starting jobs at an absolute time. Unset until the first
+// scheduler_set_clock() call.
+void scheduler_set_clock(uint64_t unix_ms);
+bool scheduler_clock(uint64_t &unix_ms);
+
+#endif
@@ -0,0 +1,56 @@
+#include "stack_watch.h"
+
+#include "pico/multicore.h"
+
+#define STACK_PAINT 0x5aa5c33cu
+
+// Stack regions from the SDK's linker script: core 0 runs on the top of
+// SCRATCH_Y, core 1 on the .stack1 array multicore_launch_core1() places in
+// SCRATCH_X.
+extern uint32_t __StackBottom;
+extern uint32_t __StackTop;
+extern uint32_t __StackOneBottom;
+extern uint32_t __StackOneTop;
+
+static void stack_bounds(unsigned core, uint32_t **bottom, uint32_t **top) {
+    if (core == 0) {
+        *bottom = &__StackBottom;
+        *top = &__StackTop;
+    } else {
+        *bottom = &__StackOneBottom;
+        *top = &__StackOneTop;
+    }
+}
+
+void __attribute__((noinline)) stack_watch_paint(void) {
+    uint32_t *bottom;
+    uint32_t *top;
+    stack_bounds(get_core_num(), &bottom, &top);
+
+    // Keep clear of this function's own frame.
+    volatile uint32_t marker = 0;
+    uint32_t *limit = (uint32_t *)&marker - 32;
+    for (uint32_t *w = bottom; w < limit; ++w) {
+        *w = STACK_PAINT;
+    }
+    (void)marker;
+}
+
+size_t stack_watch_size(unsigned core) {
+    uint32_t *bottom;
+    uint32_t *top;
+    stack_bounds(core, &bottom, &top);
+    return (size_t)(top - bottom) * sizeof(uint32_t);
+}
+
+size_t stack_watch_peak(unsigned core) {
+    uint32_t *bottom;
+    uint32_t *top;
+    stack_bounds(core, &bottom, &top);
+
+    const uint32_t *w = bottom;
+    while (w < top && *w == STACK_PAINT) {
+        ++w;
+    }
+    return (size_t)(top - w) * sizeof(uint32_t);
+}
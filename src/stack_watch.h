@@ -0,0 +1,31 @@
+#ifndef STACK_WATCH_H
+#define STACK_WATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Stack high-water marks for both cores. Each core paints the unused part of
+// its stack with a pattern once at startup; the deepest word that no longer
+// holds the pattern is the worst case so far. Interrupt handlers run on the
+// same stacks, so they are included.
+
+// Paints the calling core's stack below the caller's frame. Call it first
+// thing on each core.
+void stack_watch_paint(void);
+
+// Size of a core's stack in bytes.
+size_t stack_watch_size(unsigned core);
+
+// Most bytes of a core's stack ever in use; equal to the size if the stack
+// has overflowed its region.
+size_t stack_watch_peak(unsigned core);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
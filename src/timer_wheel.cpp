@@ -0,0 +1,149 @@
+#include "timer_wheel.h"
+
+namespace {
+
+constexpr uint32_t kSlotMask = kWheelSlots - 1;
+
+void list_init(TimerNode &head) {
+    head.prev = &head;
+    head.next = &head;
+}
+
+void list_push(TimerNode &head, TimerNode &node) {
+    node.prev = head.prev;
+    node.next = &head;
+    head.prev->next = &node;
+    head.prev = &node;
+}
+
+uint64_t rotate_right(uint64_t bits, unsigned n) {
+    n &= kSlotMask;
+    return n == 0 ? bits : (bits >> n) | (bits << (kWheelSlots - n));
+}
+
+// Index of the lowest set bit; bits must not be 0.
+unsigned lowest_bit(uint64_t bits) {
+    return static_cast<unsigned>(__builtin_ctzll(bits));
+}
+
+void link(TimerWheel &wheel, TimerNode &node) {
+    // Signed distance, so timers that are already due land in the current slot.
+    uint32_t expires = node.expires;
+    int32_t delta = static_cast<int32_t>(expires - wheel.now);
+    if (delta < 0) {
+        expires = wheel.now;
+        delta = 0;
+    }
+
+    unsigned level = 0;
+    while (level + 1 < kWheelLevels && static_cast<uint32_t>(delta) >= (1u << (kWheelBits * (level + 1)))) {
+        ++level;
+    }
+    unsigned slot = (expires >> (kWheelBits * level)) & kSlotMask;
+    list_push(wheel.slots[level][slot], node);
+    wheel.occupied[level] |= uint64_t{1} << slot;
+}
+
+// Moves every timer in a coarse slot down to where it now belongs.
+void cascade(TimerWheel &wheel, unsigned level) {
+    unsigned slot = (wheel.now >> (kWheelBits * level)) & kSlotMask;
+    TimerNode &head = wheel.slots[level][slot];
+    TimerNode *node = head.next;
+    list_init(head);
+    wheel.occupied[level] &= ~(uint64_t{1} << slot);
+    while (node != &head) {
+        TimerNode *next = node->next;
+        link(wheel, *node);
+        node = next;
+    }
+}
+
+// Cascades due at wheel.now, then fires the timers of its level-0 slot.
+void run_tick(TimerWheel &wheel, timer_wheel_expired_fn_t expired, void *ctx) {
+    for (unsigned level = 1; level < kWheelLevels; ++level) {
+        if ((wheel.now & ((1u << (kWheelBits * level)) - 1)) != 0) {
+            break;
+        }
+        cascade(wheel, level);
+    }
+
+    TimerNode &head = wheel.slots[0][wheel.now & kSlotMask];
+    while (head.next != &head) {
+        TimerNode &node = *head.next;
+        timer_wheel_cancel(wheel, node);
+        expired(node, ctx);
+    }
+}
+
+}  // namespace
+
+void timer_wheel_init(TimerWheel &wheel, uint32_t now) {
+    wheel.now = now;
+    for (uint64_t &bits : wheel.occupied) {
+        bits = 0;
+    }
+    for (auto &level : wheel.slots) {
+        for (TimerNode &head : level) {
+            list_init(head);
+        }
+    }
+}
+
+void timer_wheel_insert(TimerWheel &wheel, TimerNode &node, uint32_t expires) {
+    node.expires = expires;
+    link(wheel, node);
+}
+
+void timer_wheel_cancel(TimerWheel &wheel, TimerNode &node) {
+    if (!node.next) {
+        return;
+    }
+    node.prev->next = node.next;
+    node.next->prev = node.prev;
+    // Only a slot's head is ever left alone in its list.
+    if (node.prev == node.next) {
+        size_t index = static_cast<size_t>(node.prev - &wheel.slots[0][0]);
+        wheel.occupied[index / kWheelSlots] &= ~(uint64_t{1} << (index % kWheelSlots));
+    }
+    node.prev = nullptr;
+    node.next = nullptr;
+}
+
+bool timer_wheel_pending(const TimerNode &node) {
+    return node.next != nullptr;
+}
+
+void timer_wheel_advance(TimerWheel &wheel, uint32_t now, timer_wheel_expired_fn_t expired, void *ctx) {
+    while (static_cast<int32_t>(now - wheel.now) >= 0) {
+        // Nothing happens on the ticks before the next one with work.
+        uint32_t ticks;
+        if (!timer_wheel_next(wheel, ticks) || ticks > now - wheel.now) {
+            wheel.now = now + 1;
+            return;
+        }
+        wheel.now += ticks;
+        run_tick(wheel, expired, ctx);
+        ++wheel.now;
+    }
+}
+
+bool timer_wheel_next(const TimerWheel &wheel, uint32_t &ticks) {
+    bool found = false;
+    for (unsigned level = 0; level < kWheelLevels; ++level) {
+        uint64_t bits = wheel.occupied[level];
+        if (bits == 0) {
+            continue;
+        }
+        // A slot is handled when the wheel reaches its first tick, so the
+        // search starts at the first slot boundary not yet passed.
+        unsigned shift = kWheelBits * level;
+        uint32_t first = (wheel.now + (1u << shift) - 1) >> shift;
+        uint32_t at = (first + lowest_bit(rotate_right(bits, first))) << shift;
+        uint32_t distance = at - wheel.now;
+        if (!found || distance < ticks) {
+            ticks = distance;
+            found = true;
+        }
+    }
+    return found;
+}
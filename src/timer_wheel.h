@@ -0,0 +1,55 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Hierarchical timer wheel: kWheelLevels levels of kWheelSlots slots each.
+// Timers far in the future sit in coarse slots and cascade down as time
+// passes, so insert and cancel are O(1). A bitmap per level records which
+// slots hold timers; advancing skips straight past empty slots, and the
+// tick of the next firing or cascade is found without visiting any timer.
+
+constexpr unsigned kWheelBits = 6;
+constexpr unsigned kWheelSlots = 1u << kWheelBits;
+constexpr unsigned kWheelLevels = 5;
+
+// Longest delay the wheel can hold, in ticks.
+constexpr uint32_t kWheelMaxDelay = (1u << (kWheelBits * kWheelLevels)) - 1;
+
+struct TimerNode {
+    TimerNode *prev;
+    TimerNode *next;
+    uint32_t expires;
+};
+
+struct TimerWheel {
+    uint32_t now;
+    uint64_t occupied[kWheelLevels];    // bit n: slots[level][n] is not empty
+    TimerNode slots[kWheelLevels][kWheelSlots];
+};
+
+static_assert(kWheelSlots == 64, "one occupancy word per level");
+
+typedef void (*timer_wheel_expired_fn_t)(TimerNode &node, void *ctx);
+
+void timer_wheel_init(TimerWheel &wheel, uint32_t now);
+
+// Schedules node to expire at tick `expires`; already-due timers fire on the next tick.
+void timer_wheel_insert(TimerWheel &wheel, TimerNode &node, uint32_t expires);
+
+void timer_wheel_cancel(TimerWheel &wheel, TimerNode &node);
+
+bool timer_wheel_pending(const TimerNode &node);
+
+// Processes every tick up to and including `now`, calling expired for each
+// timer that fires. The node is unlinked before the callback runs, so it may
+// be re-inserted from there. Ticks without work cost nothing.
+void timer_wheel_advance(TimerWheel &wheel, uint32_t now, timer_wheel_expired_fn_t expired, void *ctx);
+
+// Ticks from wheel.now until the wheel next has work, a timer firing or a
+// coarse slot cascading; 0 if that is the current tick. False if the wheel
+// is empty.
+bool timer_wheel_next(const TimerWheel &wheel, uint32_t &ticks);
+
+#endif
@@ -14,7 +14,31 @@ extern "C" {
 
 #define CFG_TUD_ENDPOINT0_SIZE 64
 
-#define CFG_TUD_HID 1
+// Keyboard interfaces to enumerate, see hid_keyboards.h. Set from CMake.
+#ifndef HID_KEYBOARD_COUNT
+#define HID_KEYBOARD_COUNT 1
+#endif
+#if HID_KEYBOARD_COUNT < 1 || HID_KEYBOARD_COUNT > 4
+#error "HID_KEYBOARD_COUNT must be between 1 and 4"
+#endif
+
+#define CFG_TUD_HID HID_KEYBOARD_COUNT
+
+// bInterval of every keyboard endpoint, in ms
+#define HID_POLL_INTERVAL_MS 10
+
+// Report IDs in the composite report descriptor every keyboard interface
+// has. In boot protocol only the keyboard report exists, without an ID.
+#define HID_REPORT_ID_KEYBOARD  1
+#define HID_REPORT_ID_CONSUMER  2
+#define HID_REPORT_ID_SYSTEM    3
+#define HID_REPORT_ID_MOUSE     4   // absolute pointer
+
+// String descriptor indices. host_fingerprint.c looks at the order a host
+// reads them in.
+#define USB_STRING_MANUFACTURER 1
+#define USB_STRING_PRODUCT      2
+#define USB_STRING_SERIAL       3
 #define CFG_TUD_HID_EP_BUFSIZE 16
 
 #ifdef __cplusplus
@@ -6,13 +6,15 @@
 #include "bsp/board.h"
 #include "tusb.h"
 
-enum {
-    ITF_NUM_HID,
-    ITF_NUM_TOTAL
-};
+#include "host_fingerprint.h"
+
+// One interface and IN endpoint per keyboard: interfaces 0..n-1 use
+// endpoints 0x81..0x80+n.
+#define ITF_NUM_HID 0
+#define ITF_NUM_TOTAL HID_KEYBOARD_COUNT
 
 #define EPNUM_HID 0x81
-#define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN)
+#define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + HID_KEYBOARD_COUNT * TUD_HID_DESC_LEN)
 
 // Device descriptor describes general information about the device.
 static tusb_desc_device_t const desc_device = {
@@ -28,24 +30,37 @@ static tusb_desc_device_t const desc_device = {
     .idProduct = 0x4000,
     .bcdDevice = 0x0100,
 
-    .iManufacturer = 0x01,
-    .iProduct = 0x02,
-    .iSerialNumber = 0x03,
+    .iManufacturer = USB_STRING_MANUFACTURER,
+    .iProduct = USB_STRING_PRODUCT,
+    .iSerialNumber = USB_STRING_SERIAL,
 
     .bNumConfigurations = 0x01,
 };
 
 uint8_t const *tud_descriptor_device_cb(void) {
+    fingerprint_record(FP_DEVICE, 0);
     return (uint8_t const *)&desc_device;
 }
 
-// HID report descriptor defines the keyboard report structure.
+// A full-speed-only device has no device qualifier; the request stalls.
+// Which hosts ask for it anyway is part of the fingerprint.
+uint8_t const *tud_descriptor_device_qualifier_cb(void) {
+    fingerprint_record(FP_QUALIFIER, 0);
+    return NULL;
+}
+
+// HID report descriptor: the keyboard report plus consumer control (media,
+// volume, brightness), system control (power, sleep, wake) and an absolute
+// mouse, told apart by report ID. All keyboard interfaces share it.
 static uint8_t const desc_hid_report[] = {
-    TUD_HID_REPORT_DESC_KEYBOARD()
+    TUD_HID_REPORT_DESC_KEYBOARD(HID_REPORT_ID(HID_REPORT_ID_KEYBOARD)),
+    TUD_HID_REPORT_DESC_CONSUMER(HID_REPORT_ID(HID_REPORT_ID_CONSUMER)),
+    TUD_HID_REPORT_DESC_SYSTEM_CONTROL(HID_REPORT_ID(HID_REPORT_ID_SYSTEM)),
+    TUD_HID_REPORT_DESC_ABSMOUSE(HID_REPORT_ID(HID_REPORT_ID_MOUSE))
 };
 
 uint8_t const *tud_hid_descriptor_report_cb(uint8_t instance) {
-    (void)instance;
+    fingerprint_record(FP_REPORT_DESC, instance);
     return desc_hid_report;
 }
 
@@ -55,11 +70,21 @@ static uint8_t const desc_configuration[] = {
     TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100),
 
     // Interface number, string index, protocol, report descriptor len, EP In address, size, polling interval
-    TUD_HID_DESCRIPTOR(ITF_NUM_HID, 0, HID_ITF_PROTOCOL_KEYBOARD, sizeof(desc_hid_report), EPNUM_HID, CFG_TUD_HID_EP_BUFSIZE, 10),
+    TUD_HID_DESCRIPTOR(ITF_NUM_HID, 0, HID_ITF_PROTOCOL_KEYBOARD, sizeof(desc_hid_report), EPNUM_HID, CFG_TUD_HID_EP_BUFSIZE, HID_POLL_INTERVAL_MS),
+#if HID_KEYBOARD_COUNT > 1
+    TUD_HID_DESCRIPTOR(ITF_NUM_HID + 1, 0, HID_ITF_PROTOCOL_KEYBOARD, sizeof(desc_hid_report), EPNUM_HID + 1, CFG_TUD_HID_EP_BUFSIZE, HID_POLL_INTERVAL_MS),
+#endif
+#if HID_KEYBOARD_COUNT > 2
+    TUD_HID_DESCRIPTOR(ITF_NUM_HID + 2, 0, HID_ITF_PROTOCOL_KEYBOARD, sizeof(desc_hid_report), EPNUM_HID + 2, CFG_TUD_HID_EP_BUFSIZE, HID_POLL_INTERVAL_MS),
+#endif
+#if HID_KEYBOARD_COUNT > 3
+    TUD_HID_DESCRIPTOR(ITF_NUM_HID + 3, 0, HID_ITF_PROTOCOL_KEYBOARD, sizeof(desc_hid_report), EPNUM_HID + 3, CFG_TUD_HID_EP_BUFSIZE, HID_POLL_INTERVAL_MS),
+#endif
 };
 
 uint8_t const *tud_descriptor_configuration_cb(uint8_t index) {
     (void)index;
+    fingerprint_record(FP_CONFIG, 0);
     return desc_configuration;
 }
 
@@ -75,6 +100,7 @@ static uint16_t _desc_str[32 + 1];
 
 uint16_t const *tud_descriptor_string_cb(uint8_t index, uint16_t langid) {
     (void)langid;
+    fingerprint_record(FP_STRING, index);
 
     size_t chr_count;
 
@@ -10,7 +10,12 @@
 #include "lwip/tcp.h"
 #include "lwip/ip4_addr.h"
 #include "lwip/err.h"
+#include "lwip/stats.h"
+#include "boot_log.h"
 #include "dhserver.h"
+#include "line_splitter.h"
+#include "lz4_stream.h"
+#include "metrics_log.h"
 
 #ifndef WIFI_SSID
 #define WIFI_SSID "BadPicoKB"
@@ -28,14 +33,40 @@
 #define AP_NETMASK      "255.255.255.0"
 #define AP_DHCP_START   "192.168.4.2"
 
+#define LZ4_CMD         "!lz4 "
+#define LZ4_BLOCK_MAX   (1024 * 1024)
+
+#define BENCH_CMD       "!bench "
+#define BENCH_MAX       (64u * 1024 * 1024)
+#define BENCH_WINDOW_US 1000000
+
+// What one poll sends at most: one TCP segment
+#define SEND_BATCH_MAX  1460
+
 typedef struct repl_client {
     struct tcp_pcb *pcb;
     char buf[WIFI_REPL_LINE_MAX];
-    size_t buf_len;
+    line_splitter_t lines;      // collects the line in buf
+    // Compressed bytes still expected for the current "!lz4 N" block
+    uint32_t lz4_remaining;
+    bool lz4_failed;
+    lz4_stream_t lz4;
+    // "!bench N": bytes still to be discarded, and what they took
+    uint32_t bench_remaining;
+    uint32_t bench_total;
+    uint64_t bench_start_us;
+    uint64_t bench_window_us;
+    uint32_t bench_window_bytes;
+    uint32_t bench_min_window_bps;  // slowest full one-second window
+    uint32_t bench_pool_err;        // counters at the start, to report deltas
+    uint32_t bench_tcp_drop;
+    uint32_t bench_tcp_memerr;
+    uint32_t bench_tcp_rexmit;
 } repl_client_t;
 
 static wifi_repl_line_cb_t s_line_cb = NULL;
-static queue_t *s_error_queue = NULL;
+static queue_t *s_reply_queue = NULL;
+static queue_t *s_record_queue = NULL;
 static struct tcp_pcb *s_active_pcb = NULL;
 
 // LED blinking state
@@ -85,6 +116,184 @@ static void repl_client_close(repl_client_t *client) {
     free(client);
 }
 
+static void repl_client_send(repl_client_t *client, const char *text) {
+    tcp_write(client->pcb, text, (u16_t)strlen(text), TCP_WRITE_FLAG_COPY);
+}
+
+// "!lz4 N": the next N bytes are an LZ4 block whose decompressed output is
+// read as if it had been typed into the REPL.
+static void repl_client_start_lz4(repl_client_t *client, const char *arg) {
+    char *endptr;
+    unsigned long len = strtoul(arg, &endptr, 10);
+    if (endptr == arg || *endptr != '\0' || len == 0 || len > LZ4_BLOCK_MAX) {
+        repl_client_send(client, "lz4: invalid block length\r\n> ");
+        return;
+    }
+    lz4_stream_init(&client->lz4);
+    client->lz4_remaining = (uint32_t)len;
+    client->lz4_failed = false;
+}
+
+// Snapshot of the lwIP counters that show the stack running out of buffers.
+// All zero when the stack is built without LWIP_STATS.
+typedef struct {
+    uint32_t pool_err;
+    uint32_t pool_used_max;
+    uint32_t pool_avail;
+    uint32_t tcp_drop;
+    uint32_t tcp_memerr;
+    uint32_t tcp_rexmit;
+} repl_net_stats_t;
+
+static void repl_net_stats(repl_net_stats_t *st) {
+    memset(st, 0, sizeof(*st));
+#if LWIP_STATS && MEMP_STATS
+    const struct stats_mem *pool = lwip_stats.memp[MEMP_PBUF_POOL];
+    st->pool_err = pool->err;
+    st->pool_used_max = pool->max;
+    st->pool_avail = pool->avail;
+#endif
+#if LWIP_STATS && TCP_STATS
+    st->tcp_drop = lwip_stats.tcp.drop;
+    st->tcp_memerr = lwip_stats.tcp.memerr;
+    st->tcp_rexmit = lwip_stats.tcp.rexmit;
+#endif
+}
+
+// "!bench N": the next N bytes are counted and thrown away, then the
+// throughput and buffer trouble during the transfer are reported.
+static void repl_client_start_bench(repl_client_t *client, const char *arg) {
+    char *endptr;
+    unsigned long len = strtoul(arg, &endptr, 10);
+    if (endptr == arg || *endptr != '\0' || len == 0 || len > BENCH_MAX) {
+        repl_client_send(client, "bench: invalid length\r\n> ");
+        return;
+    }
+    repl_net_stats_t st;
+    repl_net_stats(&st);
+    client->bench_remaining = (uint32_t)len;
+    client->bench_total = (uint32_t)len;
+    client->bench_start_us = 0;     // set by the first byte
+    client->bench_min_window_bps = UINT32_MAX;
+    client->bench_pool_err = st.pool_err;
+    client->bench_tcp_drop = st.tcp_drop;
+    client->bench_tcp_memerr = st.tcp_memerr;
+    client->bench_tcp_rexmit = st.tcp_rexmit;
+}
+
+static void repl_client_bench_report(repl_client_t *client) {
+    uint64_t us = time_us_64() - client->bench_start_us;
+    if (us == 0) {
+        us = 1;
+    }
+    repl_net_stats_t st;
+    repl_net_stats(&st);
+
+    char buf[256];
+    int n = snprintf(buf, sizeof(buf), "bench: %lu bytes in %lu ms, %lu B/s",
+                     (unsigned long)client->bench_total, (unsigned long)(us / 1000),
+                     (unsigned long)((uint64_t)client->bench_total * 1000000u / us));
+    if (client->bench_min_window_bps != UINT32_MAX) {
+        n += snprintf(buf + n, sizeof(buf) - (size_t)n, ", slowest second %lu B/s",
+                      (unsigned long)client->bench_min_window_bps);
+    }
+    snprintf(buf + n, sizeof(buf) - (size_t)n,
+             "\r\nbench: pbuf pool err %lu (peak %lu/%lu), tcp drop %lu, tcp memerr %lu, rexmit %lu\r\n> ",
+             (unsigned long)(st.pool_err - client->bench_pool_err), (unsigned long)st.pool_used_max,
+             (unsigned long)st.pool_avail, (unsigned long)(st.tcp_drop - client->bench_tcp_drop),
+             (unsigned long)(st.tcp_memerr - client->bench_tcp_memerr),
+             (unsigned long)(st.tcp_rexmit - client->bench_tcp_rexmit));
+    repl_client_send(client, buf);
+}
+
+static void repl_client_sink(repl_client_t *client, size_t len) {
+    uint64_t now = time_us_64();
+    if (client->bench_start_us == 0) {
+        client->bench_start_us = now;
+        client->bench_window_us = now;
+        client->bench_window_bytes = 0;
+    }
+
+    client->bench_window_bytes += (uint32_t)len;
+    uint64_t window = now - client->bench_window_us;
+    if (window >= BENCH_WINDOW_US) {
+        uint32_t bps = (uint32_t)((uint64_t)client->bench_window_bytes * 1000000u / window);
+        if (bps < client->bench_min_window_bps) {
+            client->bench_min_window_bps = bps;
+        }
+        client->bench_window_us = now;
+        client->bench_window_bytes = 0;
+    }
+
+    client->bench_remaining -= (uint32_t)len;
+    if (client->bench_remaining == 0) {
+        repl_client_bench_report(client);
+    }
+}
+
+static void repl_client_line(repl_client_t *client) {
+    size_t len = client->lines.len;
+    client->lines.len = 0;
+    if (len == 0) {
+        return;
+    }
+
+    // Transport commands are only honoured outside compressed blocks
+    if (client->lz4_remaining == 0 && strncmp(client->buf, LZ4_CMD, strlen(LZ4_CMD)) == 0) {
+        repl_client_start_lz4(client, client->buf + strlen(LZ4_CMD));
+        return;
+    }
+    if (client->lz4_remaining == 0 && strncmp(client->buf, BENCH_CMD, strlen(BENCH_CMD)) == 0) {
+        repl_client_start_bench(client, client->buf + strlen(BENCH_CMD));
+        return;
+    }
+
+    if (s_line_cb) {
+        s_line_cb(client->buf, len);
+        repl_client_send(client, "> ");
+    }
+}
+
+// Splits data into lines. Stops early after a line that switches the client
+// into compressed or bench mode and returns the number of bytes consumed.
+static size_t repl_client_split(repl_client_t *client, const char *data, size_t len) {
+    bool in_block = client->lz4_remaining > 0;
+    size_t used = 0;
+    while (used < len) {
+        bool line_done;
+        used += line_splitter_feed(&client->lines, data + used, len - used, &line_done);
+        if (!line_done) {
+            break;
+        }
+        repl_client_line(client);
+        if ((!in_block && client->lz4_remaining > 0) || client->bench_remaining > 0) {
+            return used;
+        }
+    }
+    return len;
+}
+
+static void repl_client_inflated(void *ctx, const char *data, size_t len) {
+    repl_client_split((repl_client_t *)ctx, data, len);
+}
+
+static void repl_client_inflate(repl_client_t *client, const uint8_t *data, size_t len) {
+    if (!client->lz4_failed &&
+        lz4_stream_feed(&client->lz4, data, len, repl_client_inflated, client) != LZ4_STREAM_OK) {
+        // Swallow the rest of the block; there is no way to resync inside it
+        client->lz4_failed = true;
+        repl_client_send(client, "lz4: corrupt block\r\n");
+    }
+    client->lz4_remaining -= (uint32_t)len;
+
+    if (client->lz4_remaining == 0) {
+        if (!client->lz4_failed && !lz4_stream_complete(&client->lz4)) {
+            repl_client_send(client, "lz4: truncated block\r\n");
+        }
+        repl_client_send(client, "> ");
+    }
+}
+
 static err_t repl_client_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err) {
     repl_client_t *client = (repl_client_t *)arg;
 
@@ -96,30 +305,32 @@ static err_t repl_client_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, e
     struct pbuf *q = p;
     while (q) {
         const char *data = (const char *)q->payload;
-        uint16_t len = q->len;
-
-        for (uint16_t i = 0; i < len; ++i) {
-            char c = data[i];
-            if (c == '\r') {
-                continue;
-            }
-            if (c == '\n') {
-                if (client->buf_len > 0 && s_line_cb) {
-                    client->buf[client->buf_len] = '\0';
-                    s_line_cb(client->buf, client->buf_len);
-                    const char *prompt = "> ";
-                    tcp_write(tpcb, prompt, 2, TCP_WRITE_FLAG_COPY);
+        size_t len = q->len;
+
+        size_t i = 0;
+        while (i < len) {
+            if (client->bench_remaining > 0) {
+                size_t n = len - i;
+                if (n > client->bench_remaining) {
+                    n = client->bench_remaining;
                 }
-                client->buf_len = 0;
-            } else {
-                if (client->buf_len < WIFI_REPL_LINE_MAX - 1) {
-                    client->buf[client->buf_len++] = c;
+                repl_client_sink(client, n);
+                i += n;
+            } else if (client->lz4_remaining > 0) {
+                size_t n = len - i;
+                if (n > client->lz4_remaining) {
+                    n = client->lz4_remaining;
                 }
+                repl_client_inflate(client, (const uint8_t *)data + i, n);
+                i += n;
+            } else {
+                i += repl_client_split(client, data + i, len - i);
             }
         }
         q = q->next;
     }
 
+    metrics_add(METRICS_RX_BYTES, p->tot_len);
     tcp_recved(tpcb, p->tot_len);
     pbuf_free(p);
     return ERR_OK;
@@ -150,7 +361,7 @@ static err_t repl_server_accept(void *arg, struct tcp_pcb *newpcb, err_t err) {
     }
 
     client->pcb = newpcb;
-    client->buf_len = 0;
+    line_splitter_init(&client->lines, client->buf, sizeof(client->buf));
 
     tcp_arg(newpcb, client);
     tcp_recv(newpcb, repl_client_recv);
@@ -164,28 +375,144 @@ static err_t repl_server_accept(void *arg, struct tcp_pcb *newpcb, err_t err) {
     return ERR_OK;
 }
 
-void wifi_repl_poll_errors(void) {
-    if (!s_error_queue || !s_active_pcb) {
+void wifi_repl_write(const char *text) {
+    if (s_active_pcb) {
+        tcp_write(s_active_pcb, text, (u16_t)strlen(text), TCP_WRITE_FLAG_COPY);
+    }
+}
+
+static const char *const s_line_state_names[] = {
+    [WIFI_REPL_LINE_QUEUED]   = "queued",
+    [WIFI_REPL_LINE_REJECTED] = "rejected",
+    [WIFI_REPL_LINE_STARTED]  = "started",
+    [WIFI_REPL_LINE_DONE]     = "done",
+    [WIFI_REPL_LINE_ABORTED]  = "aborted",
+};
+
+// "#<id> <state>[ <ms>ms][ err <code>@<offset>[ +<more>]]"
+static int format_event(const wifi_repl_event_t *ev, char *buf, size_t len) {
+    int n = snprintf(buf, len, "#%u %s", ev->id, s_line_state_names[ev->state]);
+    if (ev->state == WIFI_REPL_LINE_DONE || ev->state == WIFI_REPL_LINE_ABORTED) {
+        n += snprintf(buf + n, len - (size_t)n, " %lums", (unsigned long)ev->duration_ms);
+    }
+    if (ev->error_count > 0) {
+        n += snprintf(buf + n, len - (size_t)n, " err %u@%u", ev->error, ev->error_offset);
+        if (ev->error_count > 1) {
+            n += snprintf(buf + n, len - (size_t)n, " +%u", ev->error_count - 1);
+        }
+    }
+    n += snprintf(buf + n, len - (size_t)n, "\r\n");
+    return n;
+}
+
+void wifi_repl_write_event(const wifi_repl_event_t *ev) {
+    char buf[64];
+    format_event(ev, buf, sizeof(buf));
+    wifi_repl_write(buf);
+}
+
+// "[(<n> earlier error(s) not shown)\r\n][#<id> ]err <code>@<offset>: <message>[ (+<repeats> more)]"
+// buf has room for WIFI_REPL_LINE_MAX bytes of message and the rest; a
+// longer message is cut short.
+static void format_error(const wifi_repl_error_t *err, char *buf, size_t len) {
+    size_t n = 0;
+    buf[0] = '\0';
+    if (err->unreported > 0) {
+        snprintf(buf, len, "(%u earlier error(s) not shown)\r\n", err->unreported);
+        n = strlen(buf);
+    }
+    if (err->line_id != 0 && n < len) {
+        snprintf(buf + n, len - n, "#%u ", err->line_id);
+        n = strlen(buf);
+    }
+    if (n < len) {
+        snprintf(buf + n, len - n, "err %u@%u: ", err->code, err->offset);
+        n = strlen(buf);
+    }
+    if (n < len) {
+        snprintf(buf + n, len - n, err->fmt, err->arg);
+        n = strlen(buf);
+    }
+    // The messages end in CRLF; the repeat count goes before it.
+    while (n > 0 && (buf[n - 1] == '\n' || buf[n - 1] == '\r')) {
+        --n;
+    }
+    if (err->repeats > 0 && n < len) {
+        snprintf(buf + n, len - n, " (+%u more)", err->repeats);
+        n = strlen(buf);
+    }
+    if (n < len) {
+        snprintf(buf + n, len - n, "\r\n");
+    }
+}
+
+static char s_batch[SEND_BATCH_MAX];
+static size_t s_batch_len;
+
+// Appends the text if all of it fits, else leaves the batch as it was.
+static bool batch_append(const char *text, size_t len, size_t max) {
+    if (s_batch_len + len > max) {
+        return false;
+    }
+    memcpy(s_batch + s_batch_len, text, len);
+    s_batch_len += len;
+    return true;
+}
+
+// Replies, then records, in queue order. An entry is only taken off its
+// queue once it has fit into the batch, and the queue after it waits too, so
+// nothing is reordered or lost when the batch is full.
+static void wifi_repl_flush(void) {
+    if (!s_active_pcb) {
+        // Records are only of use to the client that sent the line.
+        wifi_repl_record_t rec;
+        while (s_record_queue && queue_try_remove(s_record_queue, &rec)) {
+        }
         return;
     }
-    char err_buf[WIFI_REPL_LINE_MAX];
-    while (queue_try_remove(s_error_queue, err_buf)) {
-        uint16_t len = (uint16_t)strlen(err_buf);
-        if (len > 0) {
-            tcp_write(s_active_pcb, err_buf, len, TCP_WRITE_FLAG_COPY);
-            tcp_output(s_active_pcb);
+    size_t max = tcp_sndbuf(s_active_pcb);
+    if (max > sizeof(s_batch)) {
+        max = sizeof(s_batch);
+    }
+    s_batch_len = 0;
+    bool full = false;
+
+    char text[WIFI_REPL_LINE_MAX + 128];
+    while (!full && s_reply_queue && queue_try_peek(s_reply_queue, text)) {
+        full = !batch_append(text, strlen(text), max);
+        if (!full) {
+            queue_try_remove(s_reply_queue, text);
         }
     }
+    wifi_repl_record_t rec;
+    while (!full && s_record_queue && queue_try_peek(s_record_queue, &rec)) {
+        if (rec.kind == WIFI_REPL_RECORD_ERROR) {
+            format_error(&rec.error, text, sizeof(text));
+        } else {
+            format_event(&rec.event, text, sizeof(text));
+        }
+        full = !batch_append(text, strlen(text), max);
+        if (!full) {
+            queue_try_remove(s_record_queue, &rec);
+        }
+    }
+
+    if (s_batch_len > 0) {
+        tcp_write(s_active_pcb, s_batch, (u16_t)s_batch_len, TCP_WRITE_FLAG_COPY);
+        tcp_output(s_active_pcb);
+    }
 }
 
-void wifi_repl_init(wifi_repl_line_cb_t cb, queue_t *error_queue) {
+void wifi_repl_init(wifi_repl_line_cb_t cb, queue_t *reply_queue, queue_t *record_queue) {
     s_line_cb = cb;
-    s_error_queue = error_queue;
+    s_reply_queue = reply_queue;
+    s_record_queue = record_queue;
 
     if (cyw43_arch_init()) {
         printf("wifi_repl: cyw43_arch_init failed\n");
         return;
     }
+    boot_mark(BOOT_CYW43_INIT);
 
     cyw43_arch_enable_ap_mode(WIFI_SSID, WIFI_PASSWORD, CYW43_AUTH_WPA2_AES_PSK);
 
@@ -202,6 +529,8 @@ void wifi_repl_init(wifi_repl_line_cb_t cb, queue_t *error_queue) {
         printf("wifi_repl: closednet iovar set → %s (%d)\n", ret == 0 ? "ok" : "FAILED", ret);
     }
 
+    boot_mark(BOOT_AP_UP);
+
     dhserv_init(&s_dhcp_config);
 
     struct tcp_pcb *pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
@@ -223,6 +552,7 @@ void wifi_repl_init(wifi_repl_line_cb_t cb, queue_t *error_queue) {
     }
 
     tcp_accept(listen_pcb, repl_server_accept);
+    boot_mark(BOOT_REPL_LISTENING);
 
     printf("wifi_repl: AP \"%s\" up, REPL on port %d\n", WIFI_SSID, REPL_PORT);
     
@@ -232,6 +562,6 @@ void wifi_repl_init(wifi_repl_line_cb_t cb, queue_t *error_queue) {
 }
 
 void wifi_repl_poll() {
-    wifi_repl_poll_errors();
+    wifi_repl_flush();
     wifi_repl_blink_led();
 }
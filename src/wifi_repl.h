@@ -2,6 +2,7 @@
 #define WIFI_REPL_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include "pico/util/queue.h"
 
 #ifdef __cplusplus
@@ -12,10 +13,68 @@ extern "C" {
 
 typedef void (*wifi_repl_line_cb_t)(const char *line, size_t len);
 
-void wifi_repl_init(wifi_repl_line_cb_t cb, queue_t *error_queue);
+// Per-line result records. Every line sent for typing gets an id, and the
+// client is told when it was queued, started and completed.
+typedef enum {
+    WIFI_REPL_LINE_QUEUED,
+    WIFI_REPL_LINE_REJECTED,    // text queue full, line dropped
+    WIFI_REPL_LINE_STARTED,
+    WIFI_REPL_LINE_DONE,
+    WIFI_REPL_LINE_ABORTED,
+} wifi_repl_line_state_t;
 
-void wifi_repl_poll_errors(void);
+typedef struct {
+    uint16_t id;
+    uint8_t state;          // wifi_repl_line_state_t
+    uint8_t error;          // first error in the line, 0 if none
+    uint16_t error_offset;
+    uint16_t error_count;
+    uint32_t duration_ms;   // DONE / ABORTED: time since STARTED
+} wifi_repl_event_t;
 
+#define WIFI_REPL_ERROR_ARG_MAX 48
+
+// A compile error, formatted here rather than on core 0. One event covers
+// every error of a line with the same code; the sender may also drop events
+// to keep a bad script from flooding the client, and says how many errors
+// went unreported with the next event it does send.
+typedef struct {
+    const char *fmt;        // static format with one %s, taking arg
+    uint16_t line_id;       // 0 for lines without records (jobs, autorun)
+    uint16_t offset;        // of the first of these errors
+    uint16_t repeats;       // further errors with this code in the line
+    uint16_t unreported;    // errors before this one that were not sent
+    uint8_t code;
+    char arg[WIFI_REPL_ERROR_ARG_MAX];  // truncated to fit
+} wifi_repl_error_t;
+
+typedef enum {
+    WIFI_REPL_RECORD_EVENT,
+    WIFI_REPL_RECORD_ERROR,
+} wifi_repl_record_kind_t;
+
+// Result records and error messages share one queue, so that a line's
+// errors always reach the client between its started and done records.
+typedef struct {
+    uint8_t kind;           // wifi_repl_record_kind_t
+    union {
+        wifi_repl_event_t event;
+        wifi_repl_error_t error;
+    };
+} wifi_repl_record_t;
+
+// reply_queue carries ready-made text (WIFI_REPL_LINE_MAX bytes each),
+// record_queue wifi_repl_record_t.
+void wifi_repl_init(wifi_repl_line_cb_t cb, queue_t *reply_queue, queue_t *record_queue);
+
+// Writes straight to the connected client. Only valid from the line callback.
+void wifi_repl_write(const char *text);
+
+// Same, for a result record.
+void wifi_repl_write_event(const wifi_repl_event_t *ev);
+
+// Sends whatever the queues hold, in one write of at most a TCP segment;
+// anything that does not fit waits for the next poll.
 void wifi_repl_poll(void);
 
 #ifdef __cplusplus